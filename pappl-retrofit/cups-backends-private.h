@@ -22,6 +22,8 @@
 #include <pappl/pappl.h>
 #include <cupsfilters/log.h>
 #include <cupsfilters/filter.h>
+#include <ppd/ppd.h>
+#include <pthread.h>
 #include <signal.h>
 
 
@@ -42,6 +44,14 @@ extern "C" {
 
 #define MAX_BACKENDS	200		// Maximum number of backends we'll run
 
+// Sending several jobs through one run of a CUPS backend
+
+#define PR_BACKEND_SESSION_MAX_JOBS_DEFAULT 20
+					// Jobs sent through one backend run
+#define PR_BACKEND_SESSION_IDLE_TIMEOUT_DEFAULT 5
+					// Time a backend keeps running
+					// waiting for the next job (seconds)
+
 // Error messages for side channel of CUPS backends
 static const char * const pr_cups_sc_status_str[] =
 {
@@ -60,6 +70,17 @@ static const char * const pr_cups_sc_status_str[] =
 // Types...
 //
 
+// When to send several jobs through one run of a CUPS backend
+typedef enum pr_backend_session_mode_e
+{
+  PR_BACKEND_SESSION_OFF,		// Never, one backend run per job
+  PR_BACKEND_SESSION_JCL,		// If the driver frames each job with
+					// PJL (JCLBegin/JCLEnd in the PPD)
+  PR_BACKEND_SESSION_ALL		// Always, the jobs are self-contained
+					// command streams (label and receipt
+					// printers)
+} pr_backend_session_mode_t;
+
 // Data for logging function for CUPS-backend-based device support
 typedef struct pr_cups_devlog_data_s
 {
@@ -96,6 +117,15 @@ typedef struct pr_cups_device_data_s
                                              // ppdFilterExternalCUPS()
   bool                         internal_filter_data; // Is filter_data
                                              // internal?
+  bool                         session;      // Does the backend keep
+                                             // running for the next job?
+  int                          session_jobs; // Jobs sent in this session
+  bool                         session_idle, // Waiting for the next job?
+                               session_watch;// Idle timer thread running?
+  pthread_t                    session_thread;// Idle timer thread
+  pthread_mutex_t              session_mutex;// Lock for idle timer
+  pthread_cond_t               session_cond; // Signaled when the next job
+                                             // takes over the session
 } pr_cups_device_data_t;
 
 
@@ -126,6 +156,12 @@ extern bool   _prCUPSDevList(pappl_device_cb_t cb, void *data,
 			     pappl_deverror_cb_t err_cb, void *err_data);
 extern bool   _prCUPSDevLaunchBackend(pappl_device_t *device);
 extern void   _prCUPSDevStopBackend(pappl_device_t *device);
+extern void   _prCUPSDevCancelBackend(pappl_device_t *device, int grace);
+extern bool   _prCUPSDevSessionPossible(pappl_device_t *device,
+					ppd_file_t *ppd);
+extern void   _prCUPSDevStartJob(pappl_device_t *device,
+				 cf_filter_data_t *filter_data, bool session);
+extern bool   _prCUPSDevEndJob(pappl_device_t *device, bool keep);
 extern bool   _prCUPSDevOpen(pappl_device_t *device, const char *device_uri,
 			     const char *name);
 extern void   _prCUPSDevClose(pappl_device_t *device);
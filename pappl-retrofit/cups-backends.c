@@ -22,6 +22,8 @@
 #include <cupsfilters/ieee1284.h>
 #include <cups/dir.h>
 #include <poll.h>
+#include <sys/wait.h>
+#include <time.h>
 
 
 //
@@ -803,8 +805,6 @@ _prCUPSDevLaunchBackend(pappl_device_t *device)
     // This is our filter_data we must free it
     device_data->internal_filter_data = true;
   }
-  else
-    device_data->internal_filter_data = false;
 
   // Put together full path of the backend file
   snprintf(buf, sizeof(buf), "%s/%s",
@@ -882,9 +882,15 @@ _prCUPSDevStopBackend(pappl_device_t *device)
   if (device_data->internal_filter_data && device_data->filter_data)
   {
     cfFilterCloseBackAndSidePipes(device_data->filter_data);
+    free(device_data->filter_data->printer);
+    free(device_data->filter_data->job_user);
+    free(device_data->filter_data->job_title);
+    cupsFreeOptions(device_data->filter_data->num_options,
+		    device_data->filter_data->options);
     free(device_data->filter_data);
     device_data->filter_data = NULL;
   }
+  device_data->internal_filter_data = false;
 
   if (device_data->backend_params.filter)
     free((char *)(device_data->backend_params.filter));
@@ -900,6 +906,403 @@ _prCUPSDevStopBackend(pappl_device_t *device)
 }
 
 
+//
+// '_prCUPSDevCancelBackend()' - Stop the CUPS backend of a canceled
+//                               job without waiting for it to send
+//                               the rest of the job. The backend gets
+//                               end of file on its input, then
+//                               SIGTERM, and finally SIGKILL, each
+//                               after waiting up to "grace" seconds
+//                               for it to exit.
+//
+
+void
+_prCUPSDevCancelBackend(pappl_device_t *device, // I - Device
+			int            grace)	// I - Grace period (seconds)
+{
+  pr_cups_device_data_t *device_data =
+    (pr_cups_device_data_t *)papplDeviceGetData(device);
+  int    status;			// Exit status of backend
+  int    sig = 0;			// Signal sent last
+  double end;				// End of the grace period
+
+
+  if (!device_data || !device_data->backend_pid)
+    return;
+
+  close(device_data->inputfd);
+  device_data->inputfd = -1;
+
+  end = _prGetCurrentTime() + grace;
+  while (waitpid(device_data->backend_pid, &status, WNOHANG) == 0)
+  {
+    if (_prGetCurrentTime() < end)
+    {
+      usleep(100000);
+      continue;
+    }
+    if (sig == SIGKILL)
+    {
+      // Reap it, SIGKILL cannot get ignored
+      waitpid(device_data->backend_pid, &status, 0);
+      break;
+    }
+    sig = sig ? SIGKILL : SIGTERM;
+    _prCUPSDevLog(&device_data->devlog_data, CF_LOGLEVEL_DEBUG,
+		  "Backend (PID %d) did not exit, sending %s",
+		  device_data->backend_pid,
+		  sig == SIGKILL ? "SIGKILL" : "SIGTERM");
+    kill(device_data->backend_pid, sig);
+    end = _prGetCurrentTime() + grace;
+  }
+
+  // Already reaped, _prCUPSDevStopBackend() only has to clean up
+  device_data->backend_pid = 0;
+}
+
+
+//
+// 'pr_cups_backend_alive()' - Check whether the backend of a device is
+//                             still running.
+//
+
+static bool				// O - `true` if running
+pr_cups_backend_alive(pr_cups_device_data_t *device_data)
+					// I - Device data
+{
+  int status;				// Exit status of backend
+
+
+  if (!device_data->backend_pid)
+    return (false);
+
+  if (waitpid(device_data->backend_pid, &status, WNOHANG) == 0)
+    return (true);
+
+  // Exited (and reaped now), _prCUPSDevStopBackend() only has to clean up
+  close(device_data->inputfd);
+  device_data->inputfd = -1;
+  device_data->backend_pid = 0;
+  return (false);
+}
+
+
+//
+// 'pr_cups_session_filter_data()' - Create the filter data of a backend
+//                                   session from the one of the job
+//                                   which starts it. The backend
+//                                   outlives the job and its
+//                                   filter_data, so it gets copies of
+//                                   the job's name, user, and options,
+//                                   and its own back and side channel.
+//
+
+static cf_filter_data_t *		// O - Filter data or NULL on error
+pr_cups_session_filter_data(pr_cups_device_data_t *device_data,
+					// I - Device data
+			    cf_filter_data_t      *filter_data)
+					// I - Job's filter data
+{
+  cf_filter_data_t *data;		// Session's filter data
+  int              i;
+
+
+  if ((data = (cf_filter_data_t *)calloc(1, sizeof(cf_filter_data_t))) ==
+      NULL)
+    return (NULL);
+
+  data->printer   = filter_data->printer ? strdup(filter_data->printer) :
+                                           NULL;
+  data->job_id    = filter_data->job_id;
+  data->job_user  = filter_data->job_user ? strdup(filter_data->job_user) :
+                                            NULL;
+  data->job_title = filter_data->job_title ?
+                    strdup(filter_data->job_title) : NULL;
+  data->copies    = filter_data->copies;
+  for (i = 0; i < filter_data->num_options; i ++)
+    data->num_options = cupsAddOption(filter_data->options[i].name,
+				      filter_data->options[i].value,
+				      data->num_options, &(data->options));
+  data->back_pipe[0] = -1;
+  data->back_pipe[1] = -1;
+  data->side_pipe[0] = -1;
+  data->side_pipe[1] = -1;
+  data->logfunc = _prCUPSDevLog;
+  data->logdata = &device_data->devlog_data;
+  cfFilterOpenBackAndSidePipes(data);
+
+  return (data);
+}
+
+
+//
+// 'pr_cups_session_attach()' - Let a job's filters use the back and side
+//                              channel of the backend session instead of
+//                              the job's own pipes.
+//
+
+static void
+pr_cups_session_attach(pr_cups_device_data_t *device_data,
+					// I - Device data
+		       cf_filter_data_t      *filter_data)
+					// I - Job's filter data
+{
+  cfFilterCloseBackAndSidePipes(filter_data);
+  filter_data->back_pipe[0] = dup(device_data->backfd);
+  filter_data->back_pipe[1] = -1;
+  filter_data->side_pipe[0] = dup(device_data->sidefd);
+  filter_data->side_pipe[1] = -1;
+}
+
+
+//
+// 'pr_cups_session_idle()' - Thread function to end a backend session
+//                            if no job takes it over within the idle
+//                            timeout.
+//
+
+static void *				// O - Thread exit status
+pr_cups_session_idle(void *data)	// I - Device
+{
+  pappl_device_t        *device = (pappl_device_t *)data;
+  pr_cups_device_data_t *device_data =
+    (pr_cups_device_data_t *)papplDeviceGetData(device);
+  struct timespec       timeout;	// End of idle time
+
+
+  clock_gettime(CLOCK_REALTIME, &timeout);
+  timeout.tv_sec += device_data->global_data->backend_session_idle_timeout;
+
+  pthread_mutex_lock(&device_data->session_mutex);
+  while (device_data->session_idle &&
+	 pthread_cond_timedwait(&device_data->session_cond,
+				&device_data->session_mutex,
+				&timeout) != ETIMEDOUT);
+  if (device_data->session_idle)
+  {
+    _prCUPSDevLog(&device_data->devlog_data, CF_LOGLEVEL_DEBUG,
+		  "No further job within %d seconds, ending backend session after %d jobs",
+		  device_data->global_data->backend_session_idle_timeout,
+		  device_data->session_jobs);
+    _prCUPSDevStopBackend(device);
+    device_data->session      = false;
+    device_data->session_idle = false;
+  }
+  pthread_mutex_unlock(&device_data->session_mutex);
+
+  return (NULL);
+}
+
+
+//
+// 'pr_cups_session_claim()' - Stop the idle timer of a backend session,
+//                             for the next job or for closing the
+//                             device.
+//
+
+static void
+pr_cups_session_claim(pr_cups_device_data_t *device_data)
+					// I - Device data
+{
+  if (!device_data->session_watch)
+    return;
+
+  pthread_mutex_lock(&device_data->session_mutex);
+  device_data->session_idle = false;
+  pthread_cond_signal(&device_data->session_cond);
+  pthread_mutex_unlock(&device_data->session_mutex);
+
+  pthread_join(device_data->session_thread, NULL);
+  device_data->session_watch = false;
+}
+
+
+//
+// '_prCUPSDevSessionPossible()' - Can jobs on this device be sent
+//                                 through one run of the CUPS backend
+//                                 together with the jobs before and
+//                                 after them? The backend must send
+//                                 its input as a plain byte stream to
+//                                 the printer (socket, usb, parallel,
+//                                 serial, backends of network
+//                                 protocols like ipp, lpd, or smb
+//                                 submit one job per run) and the
+//                                 jobs must stay separated in this
+//                                 stream, by the driver's PJL framing
+//                                 or as configured for printers
+//                                 taking each job as self-contained
+//                                 commands.
+//
+
+bool					// O - `true` if possible
+_prCUPSDevSessionPossible(pappl_device_t *device,// I - Device
+			  ppd_file_t     *ppd)	// I - Driver's PPD file
+{
+  pr_cups_device_data_t *device_data =
+    (pr_cups_device_data_t *)papplDeviceGetData(device);
+  static const char * const streaming[] =// Backends streaming their input
+  {					// to the printer
+    "parallel",
+    "serial",
+    "socket",
+    "usb"
+  };
+  static const char uel[] = "\033%-12345X";
+					// PJL Universal Exit Language
+  char   scheme[32],			// Backend name
+         *ptr;				// Pointer into backend name
+  size_t i;				// Looping var
+
+
+  if (!device_data ||
+      device_data->global_data->backend_session_mode ==
+      PR_BACKEND_SESSION_OFF)
+    return (false);
+
+  snprintf(scheme, sizeof(scheme), "%s", device_data->device_uri + 5);
+  if ((ptr = strchr(scheme, ':')) != NULL)
+    *ptr = '\0';
+  for (i = 0; i < sizeof(streaming) / sizeof(streaming[0]); i ++)
+    if (!strcmp(scheme, streaming[i]))
+      break;
+  if (i >= sizeof(streaming) / sizeof(streaming[0]))
+    return (false);
+
+  if (device_data->global_data->backend_session_mode ==
+      PR_BACKEND_SESSION_ALL)
+    return (true);
+
+  return (ppd && ppd->jcl_begin && ppd->jcl_end &&
+	  strstr(ppd->jcl_begin, uel) && strstr(ppd->jcl_end, uel));
+}
+
+
+//
+// '_prCUPSDevStartJob()' - Connect a job to the backend. With "session"
+//                          set the job gets sent through the backend
+//                          left running by the previous job if there
+//                          is one, otherwise a backend gets launched
+//                          which can keep running for the next jobs.
+//                          Such a backend uses its own back and side
+//                          channel and a copy of the job's name, user,
+//                          and options, and the job's filters get
+//                          connected to it. Jobs continuing the
+//                          session get sent with the data of the job
+//                          which has started it, the backend reads it
+//                          only on startup. Without "session" the
+//                          backend gets launched for this job only, on
+//                          the first access, with the job's
+//                          filter_data.
+//
+
+void
+_prCUPSDevStartJob(pappl_device_t   *device,// I - Device
+		   cf_filter_data_t *filter_data,// I - Job's filter data
+		   bool             session)// I - Use a backend session?
+{
+  pr_cups_device_data_t *device_data =
+    (pr_cups_device_data_t *)papplDeviceGetData(device);
+
+
+  if (!device_data)
+  {
+    papplDeviceError(device, "Device did not get opened!");
+    return;
+  }
+
+  pr_cups_session_claim(device_data);
+
+  if (device_data->session)
+  {
+    if (session && pr_cups_backend_alive(device_data))
+    {
+      // Continue the session
+      device_data->session_jobs ++;
+      pr_cups_session_attach(device_data, filter_data);
+      _prCUPSDevLog(&device_data->devlog_data, CF_LOGLEVEL_DEBUG,
+		    "Sending job %d through running backend (PID %d), job %d of the session",
+		    filter_data->job_id, device_data->backend_pid,
+		    device_data->session_jobs);
+      return;
+    }
+
+    // This job cannot use the session, end it
+    _prCUPSDevStopBackend(device);
+    device_data->session = false;
+  }
+
+  if (session)
+  {
+    // Launch a backend which can outlive the job
+    if ((device_data->filter_data =
+	 pr_cups_session_filter_data(device_data, filter_data)) != NULL)
+    {
+      device_data->internal_filter_data = true;
+      if (_prCUPSDevLaunchBackend(device))
+      {
+	device_data->session      = true;
+	device_data->session_jobs = 1;
+	pr_cups_session_attach(device_data, filter_data);
+	return;
+      }
+      _prCUPSDevStopBackend(device);
+    }
+  }
+
+  // Backend for this job only, sharing the job's filter_data
+  device_data->filter_data = filter_data;
+}
+
+
+//
+// '_prCUPSDevEndJob()' - Disconnect a finished job from the backend.
+//                        If "keep" is set and the job was sent through
+//                        a backend session which did not reach its
+//                        maximum number of jobs the backend keeps
+//                        running for the idle timeout, waiting for the
+//                        next job, otherwise it gets stopped.
+//
+
+bool					// O - `true` if backend keeps running
+_prCUPSDevEndJob(pappl_device_t *device,// I - Device
+		 bool           keep)	// I - Job finished successfully?
+{
+  pr_cups_device_data_t *device_data =
+    (pr_cups_device_data_t *)papplDeviceGetData(device);
+
+
+  if (!device_data)
+  {
+    papplDeviceError(device, "Device did not get opened!");
+    return (false);
+  }
+
+  if (device_data->session && keep &&
+      device_data->session_jobs <
+      device_data->global_data->backend_session_max_jobs &&
+      device_data->global_data->backend_session_idle_timeout > 0 &&
+      pr_cups_backend_alive(device_data))
+  {
+    papplDeviceFlush(device);
+    device_data->session_idle = true;
+    if (pthread_create(&device_data->session_thread, NULL,
+		       pr_cups_session_idle, device) == 0)
+    {
+      device_data->session_watch = true;
+      return (true);
+    }
+    device_data->session_idle = false;
+  }
+
+  // Stop the backend, a job's filter_data is freed after this
+  _prCUPSDevStopBackend(device);
+  device_data->session = false;
+  device_data->filter_data = NULL;
+
+  return (false);
+}
+
+
 //
 // '_prCUPSDevOpen()' - Open device connection for devices under the
 //                      "cups" scheme (based on CUPS backends). This
@@ -948,6 +1351,8 @@ _prCUPSDevOpen(pappl_device_t *device,
   // We do not yet start the backend
   device_data->filter_data = NULL;
   device_data->backend_pid = 0;
+  pthread_mutex_init(&device_data->session_mutex, NULL);
+  pthread_cond_init(&device_data->session_cond, NULL);
 
   papplDeviceSetData(device, device_data);
   return (true);
@@ -977,10 +1382,13 @@ _prCUPSDevClose(pappl_device_t *device)
     return;
   }
 
-  // Close the backend sub-process
+  // Close the backend sub-process, also if it is waiting for the next job
+  pr_cups_session_claim(device_data);
   _prCUPSDevStopBackend(device);
 
   // Clean up
+  pthread_mutex_destroy(&device_data->session_mutex);
+  pthread_cond_destroy(&device_data->session_cond);
   free(device_data->device_uri);
   free(device_data);
   papplDeviceSetData(device, NULL);
@@ -0,0 +1,84 @@
+//
+// PPD/Classic CUPS driver retro-fit Printer Application Library
+// (libpappl-retrofit) for the Printer Application Framework (PAPPL)
+//
+// filter-plugin-private.h
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#ifndef _PAPPL_RETROFIT_FILTER_PLUGIN_PRIVATE_H_
+#  define _PAPPL_RETROFIT_FILTER_PLUGIN_PRIVATE_H_
+
+//
+// Include necessary headers...
+//
+
+#include <pappl-retrofit/pappl-retrofit.h>
+#include <pappl-retrofit/filter-plugin.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+
+//
+// C++ magic...
+//
+
+#  ifdef __cplusplus
+extern "C" {
+#  endif // __cplusplus
+
+
+//
+// Constants...
+//
+
+#define PR_FILTER_PLUGIN_MAX	64	// Filter plugins we keep loaded
+
+
+//
+// Types...
+//
+
+typedef struct pr_loaded_filter_plugin_s// Filter plugin loaded into the
+					// Printer Application
+{
+  char           path[1024];		// Shared object file
+  dev_t          dev;			// Device of the file
+  ino_t          ino;			// Inode of the file
+  time_t         mtime;			// Modification time of the file
+  void           *handle;		// Handle from dlopen()
+  const pr_filter_plugin_t *plugin;	// Plugin's descriptor
+} pr_loaded_filter_plugin_t;
+
+typedef struct pr_filter_plugins_s	// Filter plugins
+{
+  pthread_mutex_t mutex;		// Lock
+  int            num_loaded;		// Number of plugins loaded
+  pr_loaded_filter_plugin_t loaded[PR_FILTER_PLUGIN_MAX];
+					// Plugins loaded
+} pr_filter_plugins_t;
+
+
+//
+// Functions...
+//
+
+extern void _prFilterPluginInit(pr_printer_app_global_data_t *global_data);
+extern const pr_filter_plugin_t *_prFilterPluginFind(
+				pr_printer_app_global_data_t *global_data,
+				const char *filter_path);
+
+
+//
+// C++ magic...
+//
+
+#  ifdef __cplusplus
+}
+#  endif // __cplusplus
+
+
+#endif // !_PAPPL_RETROFIT_FILTER_PLUGIN_PRIVATE_H_
@@ -0,0 +1,166 @@
+//
+// PPD/Classic CUPS driver retro-fit Printer Application Library
+// (libpappl-retrofit) for the Printer Application Framework (PAPPL)
+//
+// filter-plugin.c
+//
+// Printer drivers' CUPS filters as shared objects: If the directory
+// of the filter program "<filter>" also contains "<filter>.so", and
+// it provides a filter function for the interface
+// version we support (see filter-plugin.h), the job's filter chain
+// calls this function instead of executing the filter program via
+// ppdFilterExternalCUPS().
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+//
+// Include necessary headers...
+//
+
+#include <pappl-retrofit/filter-plugin-private.h>
+#include <pappl-retrofit/pappl-retrofit-private.h>
+#include <pappl-retrofit/libcups2-private.h>
+#ifdef HAVE_DLFCN_H
+#  include <dlfcn.h>
+#endif // HAVE_DLFCN_H
+#include <sys/stat.h>
+
+
+//
+// '_prFilterPluginInit()' - Set up the list of loaded filter plugins.
+//
+
+void
+_prFilterPluginInit(pr_printer_app_global_data_t *global_data)
+					// I - Global data
+{
+  memset(&global_data->filter_plugins, 0, sizeof(pr_filter_plugins_t));
+  pthread_mutex_init(&global_data->filter_plugins.mutex, NULL);
+}
+
+
+//
+// '_prFilterPluginFind()' - Find the plugin for a CUPS filter, loading
+//                           it if needed. Plugins stay loaded, a
+//                           plugin which got replaced on disk gets
+//                           loaded again, taking over the entry of
+//                           the old one, one which failed to load
+//                           only gets tried again when it got
+//                           replaced.
+//
+
+const pr_filter_plugin_t *		// O - Plugin or NULL if none
+_prFilterPluginFind(
+    pr_printer_app_global_data_t *global_data,// I - Global data
+    const char                   *filter_path)// I - CUPS filter program
+{
+#if defined(HAVE_DLOPEN) && defined(HAVE_DLFCN_H)
+  pr_filter_plugins_t       *plugins = &global_data->filter_plugins;
+  pr_loaded_filter_plugin_t *p,		// Current plugin
+                            *entry = NULL;// Entry for this plugin
+  const pr_filter_plugin_t  *plugin = NULL;// Plugin's descriptor
+  const char                *name;	// Name of the filter
+  char                      path[1024];	// Shared object file
+  struct stat               fileinfo;	// Shared object file information
+  void                      *handle;	// Handle from dlopen()
+  int                       i;
+
+
+  if (!global_data->filter_plugins_enabled)
+    return (NULL);
+
+  // The shared object sits next to the filter program, which is not
+  // necessarily in the filter directory
+  if ((name = strrchr(filter_path, '/')) != NULL)
+  {
+    name ++;
+    snprintf(path, sizeof(path), "%.*s/%s.so",
+	     (int)(name - 1 - filter_path), filter_path, name);
+  }
+  else
+  {
+    name = filter_path;
+    snprintf(path, sizeof(path), "%s/%s.so", global_data->filter_dir, name);
+  }
+  if (stat(path, &fileinfo) || !S_ISREG(fileinfo.st_mode))
+    return (NULL);
+
+  pthread_mutex_lock(&plugins->mutex);
+
+  for (i = 0, p = plugins->loaded; i < plugins->num_loaded; i ++, p ++)
+    if (!strcmp(p->path, path))
+    {
+      if (p->dev == fileinfo.st_dev && p->ino == fileinfo.st_ino &&
+	  p->mtime == fileinfo.st_mtime)
+      {
+	plugin = p->plugin;
+	pthread_mutex_unlock(&plugins->mutex);
+	return (plugin);
+      }
+      // Replaced on disk, jobs can still be running the old plugin, so
+      // it stays loaded, but its entry gets used for the new one
+      entry = p;
+      break;
+    }
+
+  if (!entry && plugins->num_loaded >= PR_FILTER_PLUGIN_MAX)
+  {
+    pthread_mutex_unlock(&plugins->mutex);
+    papplLog(global_data->system, PAPPL_LOGLEVEL_WARN,
+	     "Too many filter plugins, not loading %s", path);
+    return (NULL);
+  }
+
+  if ((handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL)
+    papplLog(global_data->system, PAPPL_LOGLEVEL_ERROR,
+	     "Unable to load filter plugin %s: %s", path, dlerror());
+  else if ((plugin = (const pr_filter_plugin_t *)
+	    dlsym(handle, PR_FILTER_PLUGIN_SYMBOL)) == NULL)
+    papplLog(global_data->system, PAPPL_LOGLEVEL_ERROR,
+	     "Filter plugin %s does not define \"%s\"", path,
+	     PR_FILTER_PLUGIN_SYMBOL);
+  else if (plugin->abi_version != PR_FILTER_PLUGIN_ABI_VERSION)
+  {
+    papplLog(global_data->system, PAPPL_LOGLEVEL_ERROR,
+	     "Filter plugin %s is for plugin interface version %d, we support version %d",
+	     path, plugin->abi_version, PR_FILTER_PLUGIN_ABI_VERSION);
+    plugin = NULL;
+  }
+  else if (!plugin->function || !plugin->name || strcmp(plugin->name, name))
+  {
+    papplLog(global_data->system, PAPPL_LOGLEVEL_ERROR,
+	     "Filter plugin %s is not a filter function for %s", path, name);
+    plugin = NULL;
+  }
+  else
+    papplLog(global_data->system, PAPPL_LOGLEVEL_INFO,
+	     "Loaded filter plugin %s, running %s in-process", path, name);
+
+  if (!plugin && handle)
+  {
+    dlclose(handle);
+    handle = NULL;
+  }
+
+  // Remember the result, also a failure, to not try again for each job
+  if ((p = entry) == NULL)
+    p = plugins->loaded + plugins->num_loaded ++;
+  snprintf(p->path, sizeof(p->path), "%s", path);
+  p->dev    = fileinfo.st_dev;
+  p->ino    = fileinfo.st_ino;
+  p->mtime  = fileinfo.st_mtime;
+  p->handle = handle;
+  p->plugin = plugin;
+
+  pthread_mutex_unlock(&plugins->mutex);
+
+  return (plugin);
+#else
+  (void)global_data;
+  (void)filter_path;
+
+  return (NULL);
+#endif // HAVE_DLOPEN && HAVE_DLFCN_H
+}
@@ -0,0 +1,90 @@
+//
+// PPD/Classic CUPS driver retro-fit Printer Application Library
+// (libpappl-retrofit) for the Printer Application Framework (PAPPL)
+//
+// filter-plugin.h
+//
+// Interface for printer drivers to provide their CUPS filter also as a
+// shared object with a filter function, so that the Printer
+// Application runs it in its own filter chain instead of executing the
+// filter program.
+//
+// A driver project installs "<filter>.so" next to the filter
+// executable "<filter>", in the same directory. The shared object
+// exports a variable named as PR_FILTER_PLUGIN_SYMBOL:
+//
+//   #include <pappl-retrofit/filter-plugin.h>
+//
+//   const pr_filter_plugin_t prFilterPlugin =
+//   {
+//     PR_FILTER_PLUGIN_ABI_VERSION,
+//     "rastertofoo",
+//     rastertofoo_function,
+//     NULL
+//   };
+//
+// The filter function gets the same input and produces the same output
+// as the filter program. The PPD options of the job are in the filter
+// data's options, the PPD file in its "libppd" extension
+// (PPD_FILTER_DATA_EXT). Messages go through the filter data's log
+// function, not to stderr. The function runs in a forked process of
+// the Printer Application, so it may keep global state for the job.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#ifndef _PAPPL_RETROFIT_FILTER_PLUGIN_H_
+#  define _PAPPL_RETROFIT_FILTER_PLUGIN_H_
+
+//
+// Include necessary headers...
+//
+
+#include <cupsfilters/filter.h>
+
+
+//
+// C++ magic...
+//
+
+#  ifdef __cplusplus
+extern "C" {
+#  endif // __cplusplus
+
+
+//
+// Constants...
+//
+
+#define PR_FILTER_PLUGIN_ABI_VERSION 1	// Version of this interface,
+					// increased on incompatible changes
+#define PR_FILTER_PLUGIN_SYMBOL "prFilterPlugin"
+					// Name of the plugin's descriptor
+
+
+//
+// Types...
+//
+
+typedef struct pr_filter_plugin_s	// Descriptor of a filter plugin
+{
+  int                  abi_version;	// PR_FILTER_PLUGIN_ABI_VERSION the
+					// plugin got built with
+  const char           *name;		// Name of the CUPS filter program
+					// the plugin replaces
+  cf_filter_function_t function;	// Filter function
+  void                 *parameters;	// Parameters for the filter function
+} pr_filter_plugin_t;
+
+
+//
+// C++ magic...
+//
+
+#  ifdef __cplusplus
+}
+#  endif // __cplusplus
+
+
+#endif // !_PAPPL_RETROFIT_FILTER_PLUGIN_H_
@@ -0,0 +1,179 @@
+//
+// PPD/Classic CUPS driver retro-fit Printer Application Library
+// (libpappl-retrofit) for the Printer Application Framework (PAPPL)
+//
+// filter-stats-private.h
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#ifndef _PAPPL_RETROFIT_FILTER_STATS_H_
+#  define _PAPPL_RETROFIT_FILTER_STATS_H_
+
+//
+// Include necessary headers...
+//
+
+#include <pappl-retrofit/pappl-retrofit.h>
+#include <pappl/pappl.h>
+#include <cupsfilters/filter.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+
+//
+// C++ magic...
+//
+
+#  ifdef __cplusplus
+extern "C" {
+#  endif // __cplusplus
+
+
+//
+// Constants...
+//
+
+#define PR_MAX_STATS_FILTERS	16	// Filters per driver we keep
+					// aggregates for
+#define PR_STATS_RECENT_WEIGHT	0.2	// Weight of the newest job in the
+					// rolling averages
+#define PR_MAX_STATS_CONVERSIONS 16	// Spooling conversions per driver
+					// we keep aggregates for
+#define PR_CONVERSION_MIN_JOBS	3	// Jobs a conversion must have been
+					// measured with to be compared
+#define PR_CONVERSION_EXPLORE_INTERVAL_DEFAULT 10
+					// Every how many jobs an alternative
+					// conversion gets tried
+#define PR_STATS_SAVE_INTERVAL	300	// Seconds between saves of changed
+					// conversion aggregates
+
+
+//
+// Types...
+//
+
+typedef struct pr_filter_stats_s	// Measurements of one filter of a job,
+					// in memory shared with the filter's
+					// process
+{
+  char           name[64];		// Filter name
+  double         wall;			// Wall clock time (seconds)
+  double         user,			// User CPU time (seconds)
+                 sys;			// System CPU time (seconds)
+  bool           cpu_measured;		// CPU time known? Not for a filter
+					// running in our own process
+  off_t          bytes_out;		// Bytes written to next filter
+  int            pages;			// Pages reported by the filter
+  int            status;		// Exit status
+  pid_t          pgid;			// Process group of the filter and
+					// the programs it runs, 0 if the
+					// filter runs in our own process
+  bool           done;			// Filter has finished?
+} pr_filter_stats_t;
+
+typedef struct pr_stats_wrapper_s	// Parameters of the wrapper filter
+					// function
+{
+  cf_filter_filter_in_chain_t *filter;	// Filter to measure
+  pr_filter_stats_t *stats;		// Where to put the measurements
+  cf_logfunc_t   logfunc;		// Original log function
+  void           *logdata;		// Original log function data
+  pid_t          parent;		// Process running cfFilterChain()
+  pappl_loglevel_t loglevel;		// Lowest level to log
+} pr_stats_wrapper_t;
+
+typedef struct pr_chain_stats_s		// Instrumentation of a job's chain
+{
+  int            num_filters;		// Number of filters
+  cf_filter_filter_in_chain_t *wrappers;// Wrapped filters
+  pr_stats_wrapper_t *params;		// Parameters of wrapped filters
+  pr_filter_stats_t *stats;		// Shared memory with measurements
+  cups_array_t   *chain;		// Chain of wrapped filters
+} pr_chain_stats_t;
+
+typedef struct pr_filter_aggregate_s	// Aggregated measurements of a filter
+					// over all jobs of a printer
+{
+  char           name[64];		// Filter name
+  int            jobs;			// Number of jobs
+  int            cpu_jobs;		// Jobs with CPU time measured
+  double         wall,			// Total wall clock time
+                 cpu;			// Total CPU time (user + system)
+  double         bytes_out;		// Total bytes of output
+  int            pages;			// Total pages
+  double         recent_wall,		// Rolling averages over recent jobs
+                 recent_cpu;
+} pr_filter_aggregate_t;
+
+typedef struct pr_conversion_aggregate_s// Aggregated measurements of a
+					// spooling conversion over all jobs
+					// of a printer
+{
+  char           key[256];		// Input and output format, filters
+  int            jobs;			// Number of jobs
+  int            pages;			// Total pages
+  double         wall,			// Total wall clock time
+                 cpu;			// Total CPU time (user + system)
+  double         recent_page_wall,	// Rolling averages per page over
+                 recent_page_cpu;	// recent jobs
+} pr_conversion_aggregate_t;
+
+typedef struct pr_driver_stats_s	// Filter statistics of a driver
+{
+  pthread_mutex_t mutex;		// Lock
+  int            num_filters;		// Number of filters
+  pr_filter_aggregate_t filters[PR_MAX_STATS_FILTERS];
+					// Aggregates of the filters
+  int            rate_jobs;		// Jobs in the page rate
+  double         page_rate;		// Pages per minute, rolling average
+					// over recent jobs
+  int            num_conversions;	// Number of spooling conversions
+  pr_conversion_aggregate_t conversions[PR_MAX_STATS_CONVERSIONS];
+					// Aggregates of the conversions
+  bool           conversions_loaded;	// Conversion aggregates of earlier
+					// sessions loaded?
+  bool           conversions_changed;	// Conversion aggregates changed
+					// since last save?
+} pr_driver_stats_t;
+
+
+//
+// Functions...
+//
+
+extern pr_chain_stats_t *_prChainStatsCreate(cups_array_t *chain,
+					      pappl_loglevel_t loglevel);
+extern void   _prChainStatsFinish(pr_chain_stats_t *chain_stats,
+				  pappl_job_t *job, pr_driver_stats_t *driver,
+				  off_t bytes_in);
+extern void   _prDriverStatsAddPageRate(pr_driver_stats_t *driver,
+					int pages, double seconds);
+extern void   _prDriverStatsAddConversion(pr_driver_stats_t *driver,
+					  const char *key,
+					  pr_chain_stats_t *chain_stats,
+					  int pages);
+extern double _prDriverStatsConversionCost(pr_driver_stats_t *driver,
+					   const char *key, int *jobs);
+extern void   _prDriverStatsLoad(pr_driver_stats_t *driver,
+				 pappl_printer_t *printer,
+				 const char *directory);
+extern void   _prDriverStatsSave(pr_driver_stats_t *driver,
+				 pappl_printer_t *printer,
+				 const char *directory);
+extern bool   _prDriverStatsSaveTimer(pappl_system_t *system, void *data);
+extern void   _prDriverStatsInit(pr_driver_stats_t *driver);
+extern void   _prDriverStatsFree(pr_driver_stats_t *driver);
+
+
+//
+// C++ magic...
+//
+
+#  ifdef __cplusplus
+}
+#  endif // __cplusplus
+
+
+#endif // !_PAPPL_RETROFIT_FILTER_STATS_H_
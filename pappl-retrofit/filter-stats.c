@@ -0,0 +1,802 @@
+//
+// PPD/Classic CUPS driver retro-fit Printer Application Library
+// (libpappl-retrofit) for the Printer Application Framework (PAPPL)
+//
+// filter-stats.c
+//
+// Instrumentation of the filter chain of spooling-mode jobs: Wall
+// clock time, CPU time, output size and pages of each filter, logged
+// per job and aggregated per printer, and the cost per page of each
+// spooling conversion, kept across restarts.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+//
+// Include necessary headers...
+//
+
+#include <pappl-retrofit/filter-stats-private.h>
+#include <pappl-retrofit/pappl-retrofit-private.h>
+#include <pappl-retrofit/libcups2-private.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+
+
+//
+// Types...
+//
+
+typedef struct pr_stats_relay_s		// Output relay thread data
+{
+  int   infd,				// Read end of interposed pipe
+        outfd;				// Original output of the filter
+  off_t bytes;				// Bytes passed through
+} pr_stats_relay_t;
+
+
+//
+// 'pr_cpu_time()' - CPU time used by the current process and its
+//                   children. Only meaningful in a process forked for
+//                   one filter, in the Printer Application's own
+//                   process it includes all other threads and jobs.
+//
+
+static void
+pr_cpu_time(double *user,		// O - User CPU time (seconds)
+	    double *sys)		// O - System CPU time (seconds)
+{
+  struct rusage self,			// Resources of this process
+                children;		// Resources of waited-for children
+
+
+  getrusage(RUSAGE_SELF, &self);
+  getrusage(RUSAGE_CHILDREN, &children);
+
+  *user = self.ru_utime.tv_sec + children.ru_utime.tv_sec +
+          (self.ru_utime.tv_usec + children.ru_utime.tv_usec) / 1000000.0;
+  *sys  = self.ru_stime.tv_sec + children.ru_stime.tv_sec +
+          (self.ru_stime.tv_usec + children.ru_stime.tv_usec) / 1000000.0;
+}
+
+
+//
+// 'pr_wall_time()' - Monotonic wall clock time in seconds.
+//
+
+static double				// O - Time
+pr_wall_time(void)
+{
+  struct timespec ts;			// Current time
+
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec + ts.tv_nsec / 1000000000.0);
+}
+
+
+//
+// 'pr_stats_relay()' - Pass the output of the measured filter on to
+//                      the next filter, counting the bytes. Both ends
+//                      are pipes, so splice() moves the data without
+//                      copying it through user space.
+//
+
+static void *				// O - Thread exit status (unused)
+pr_stats_relay(void *data)		// I - Relay data
+{
+  pr_stats_relay_t *relay = (pr_stats_relay_t *)data;
+  char             buf[PR_DEVICE_BUFFER_CHUNK];
+  ssize_t          bytes,		// Bytes read
+                   written;		// Bytes written
+
+
+#ifdef HAVE_SPLICE
+  while ((bytes = splice(relay->infd, NULL, relay->outfd, NULL,
+			 PR_DEVICE_BUFFER_CHUNK, SPLICE_F_MOVE)) != 0)
+  {
+    if (bytes < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+	continue;
+      // Next filter is gone or splice() not supported, continue below
+      break;
+    }
+    relay->bytes += bytes;
+  }
+  if (bytes == 0)
+    return (NULL);
+#endif // HAVE_SPLICE
+
+  while ((bytes = read(relay->infd, buf, sizeof(buf))) != 0)
+  {
+    if (bytes < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+	continue;
+      break;
+    }
+    relay->bytes += bytes;
+    for (written = 0; written < bytes;)
+    {
+      ssize_t n = write(relay->outfd, buf + written, bytes - written);
+      if (n < 0)
+      {
+	if (errno == EINTR || errno == EAGAIN)
+	  continue;
+	// Next filter is gone, drain our input so that the measured
+	// filter does not block
+	break;
+      }
+      written += n;
+    }
+  }
+
+  return (NULL);
+}
+
+
+//
+// 'pr_stats_log()' - Log function of a measured filter: Count the
+//                    "PAGE:" control messages and pass everything on
+//                    to the job's log function.
+//
+
+static void
+pr_stats_log(void          *data,	// I - Wrapper parameters
+	     cf_loglevel_t level,	// I - Log level
+	     const char    *message,	// I - printf-style message
+	     ...)			// I - Additional arguments
+{
+  pr_stats_wrapper_t *wrapper = (pr_stats_wrapper_t *)data;
+  va_list            arglist;
+  char               buf[1024];
+
+
+  // Do not format messages which get discarded anyway
+  if (level != CF_LOGLEVEL_CONTROL &&
+      (pappl_loglevel_t)level < wrapper->loglevel)
+    return;
+
+  va_start(arglist, message);
+  vsnprintf(buf, sizeof(buf), message, arglist);
+  va_end(arglist);
+
+  if (level == CF_LOGLEVEL_CONTROL && !strncmp(buf, "PAGE: ", 6))
+    wrapper->stats->pages ++;
+
+  if (wrapper->logfunc)
+    (wrapper->logfunc)(wrapper->logdata, level, "%s", buf);
+}
+
+
+//
+// 'pr_stats_filter()' - Filter function wrapping a filter of the
+//                       chain, measuring it. Usually it runs in the
+//                       process which cfFilterChain() has forked for
+//                       the filter, so the resource usage of this
+//                       process is the one of the filter, including
+//                       external executables it has waited for. A
+//                       filter which cfFilterChain() runs in our own
+//                       process (chain of only one filter) gets only
+//                       its wall clock time measured.
+//
+
+static int				// O - Exit status of the filter
+pr_stats_filter(int              inputfd,  // I - File descriptor input
+		                           //     stream
+		int              outputfd, // I - File descriptor output
+		                           //     stream
+		int              inputseekable, // I - Is input seekable?
+		cf_filter_data_t *data,	   // I - Job and printer data
+		void             *parameters) // I - Wrapper parameters
+{
+  pr_stats_wrapper_t *wrapper = (pr_stats_wrapper_t *)parameters;
+  pr_filter_stats_t  *stats = wrapper->stats;
+  pr_stats_relay_t   relay;		// Output relay data
+  pthread_t          relay_thread;	// Output relay thread
+  bool               relaying = false;	// Output relay running?
+  int                relay_pipe[2];	// Interposed pipe
+  struct stat        fileinfo;		// Output file information
+  double             start,		// Start time
+                     user_start,	// CPU time at start
+                     sys_start,
+                     user_end,		// CPU time at end
+                     sys_end;
+  bool               forked;		// Filter runs in its own process?
+  int                ret;		// Exit status of the filter
+
+
+  forked = (getpid() != wrapper->parent);
+
+  // Count the bytes passed on to the next filter, only pipes can be
+  // counted without touching the data. This is only done in a forked
+  // filter process, as only there we can be sure to close the pipe
+  // after the filter without hitting a file descriptor which another
+  // thread has opened in the meantime
+  if (forked &&
+      fstat(outputfd, &fileinfo) == 0 && S_ISFIFO(fileinfo.st_mode) &&
+      pipe(relay_pipe) == 0)
+  {
+    relay.infd  = relay_pipe[0];
+    relay.outfd = outputfd;
+    relay.bytes = 0;
+    if (pthread_create(&relay_thread, NULL, pr_stats_relay, &relay) == 0)
+    {
+      relaying = true;
+      outputfd = relay_pipe[1];
+    }
+    else
+    {
+      close(relay_pipe[0]);
+      close(relay_pipe[1]);
+    }
+  }
+
+  // A forked filter gets its own process group, so that cancelling
+  // the job can stop it together with everything it has started
+  if (forked && setpgid(0, 0) == 0)
+    stats->pgid = getpid();
+
+  // Count pages via the "PAGE:" control messages of the filter
+  wrapper->logfunc = data->logfunc;
+  wrapper->logdata = data->logdata;
+  data->logfunc    = pr_stats_log;
+  data->logdata    = wrapper;
+
+  start = pr_wall_time();
+  if (forked)
+    pr_cpu_time(&user_start, &sys_start);
+
+  ret = (wrapper->filter->function)(inputfd, outputfd, inputseekable, data,
+				    wrapper->filter->parameters);
+
+  stats->wall = pr_wall_time() - start;
+  if (forked)
+  {
+    pr_cpu_time(&user_end, &sys_end);
+    stats->user = user_end - user_start;
+    stats->sys  = sys_end - sys_start;
+    stats->cpu_measured = true;
+  }
+  stats->status = ret;
+
+  // Restore the log function, cfFilterChain() does not fork if the
+  // chain has only one filter
+  data->logfunc = wrapper->logfunc;
+  data->logdata = wrapper->logdata;
+
+  if (relaying)
+  {
+    // Filters usually close their output, but the relay only gets EOF
+    // when no write end is left open, so close it in any case
+    close(relay_pipe[1]);
+    pthread_join(relay_thread, NULL);
+    close(relay.infd);
+    close(relay.outfd);
+    stats->bytes_out = relay.bytes;
+  }
+  else
+    stats->bytes_out = -1;
+
+  stats->done = true;
+
+  return (ret);
+}
+
+
+//
+// '_prChainStatsCreate()' - Create a copy of a filter chain in which
+//                           every filter is wrapped by a measuring
+//                           filter function. The measurements are
+//                           stored in memory shared with the forked
+//                           filter processes. Returns NULL if the
+//                           chain cannot be instrumented, the
+//                           original chain should be used then.
+//
+
+pr_chain_stats_t *			// O - Instrumented chain or NULL
+_prChainStatsCreate(cups_array_t     *chain,// I - Filter chain
+		    pappl_loglevel_t loglevel)// I - Lowest level to log
+{
+  pr_chain_stats_t            *chain_stats;
+  cf_filter_filter_in_chain_t *filter;
+  int                         i, n;
+
+
+  if ((n = cupsArrayGetCount(chain)) <= 0)
+    return (NULL);
+
+  if ((chain_stats =
+       (pr_chain_stats_t *)calloc(1, sizeof(pr_chain_stats_t))) == NULL)
+    return (NULL);
+
+  chain_stats->num_filters = n;
+  chain_stats->wrappers =
+    (cf_filter_filter_in_chain_t *)calloc(n,
+					  sizeof(cf_filter_filter_in_chain_t));
+  chain_stats->params =
+    (pr_stats_wrapper_t *)calloc(n, sizeof(pr_stats_wrapper_t));
+  chain_stats->stats =
+    (pr_filter_stats_t *)mmap(NULL, n * sizeof(pr_filter_stats_t),
+			      PROT_READ | PROT_WRITE,
+			      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  chain_stats->chain = cupsArrayNew(NULL, NULL, NULL, 0, NULL, NULL);
+
+  if (!chain_stats->wrappers || !chain_stats->params ||
+      chain_stats->stats == MAP_FAILED || !chain_stats->chain)
+  {
+    if (chain_stats->stats == MAP_FAILED)
+      chain_stats->stats = NULL;
+    _prChainStatsFinish(chain_stats, NULL, NULL, 0);
+    return (NULL);
+  }
+
+  memset(chain_stats->stats, 0, n * sizeof(pr_filter_stats_t));
+
+  for (i = 0, filter = (cf_filter_filter_in_chain_t *)cupsArrayGetFirst(chain);
+       filter;
+       i ++, filter = (cf_filter_filter_in_chain_t *)cupsArrayGetNext(chain))
+  {
+    snprintf(chain_stats->stats[i].name, sizeof(chain_stats->stats[i].name),
+	     "%s", filter->name ? filter->name : "-");
+    chain_stats->params[i].filter     = filter;
+    chain_stats->params[i].stats      = chain_stats->stats + i;
+    chain_stats->params[i].parent     = getpid();
+    chain_stats->params[i].loglevel   = loglevel;
+    chain_stats->wrappers[i].function   = pr_stats_filter;
+    chain_stats->wrappers[i].parameters = chain_stats->params + i;
+    chain_stats->wrappers[i].name       = filter->name;
+    cupsArrayAdd(chain_stats->chain, chain_stats->wrappers + i);
+  }
+
+  return (chain_stats);
+}
+
+
+//
+// '_prChainStatsFinish()' - Log the measurements of a job's filter
+//                           chain in one line, add them to the
+//                           printer's aggregates, and free the
+//                           instrumented chain.
+//
+
+void
+_prChainStatsFinish(pr_chain_stats_t  *chain_stats, // I - Instrumented chain
+		    pappl_job_t       *job,	// I - Job, NULL for no logging
+		    pr_driver_stats_t *driver,	// I - Printer's aggregates or
+						//     NULL
+		    off_t             bytes_in)	// I - Size of job's input
+{
+  pr_filter_stats_t     *stats;
+  pr_filter_aggregate_t *agg;
+  char                  buf[2048],
+                        *ptr;
+  off_t                 in;		// Input of current filter
+  int                   i, j;
+
+
+  if (!chain_stats)
+    return;
+
+  if (job && chain_stats->stats)
+  {
+    snprintf(buf, sizeof(buf), "Filter chain statistics: input %lld bytes;",
+	     (long long)bytes_in);
+    ptr = buf + strlen(buf);
+    for (i = 0, in = bytes_in; i < chain_stats->num_filters; i ++)
+    {
+      stats = chain_stats->stats + i;
+      if (!stats->done)
+	snprintf(ptr, sizeof(buf) - (ptr - buf), " %s: not finished;",
+		 stats->name);
+      else if (!stats->cpu_measured)
+	snprintf(ptr, sizeof(buf) - (ptr - buf),
+		 " %s: %.3fs wall, CPU n/a, in %lld, out %s%lld,"
+		 " %d pages, status %d;",
+		 stats->name, stats->wall,
+		 (long long)in, stats->bytes_out < 0 ? "n/a " : "",
+		 (long long)(stats->bytes_out < 0 ? 0 : stats->bytes_out),
+		 stats->pages, stats->status);
+      else
+	snprintf(ptr, sizeof(buf) - (ptr - buf),
+		 " %s: %.3fs wall, %.3fs user, %.3fs sys, in %lld, out %s%lld,"
+		 " %d pages, status %d;",
+		 stats->name, stats->wall, stats->user, stats->sys,
+		 (long long)in, stats->bytes_out < 0 ? "n/a " : "",
+		 (long long)(stats->bytes_out < 0 ? 0 : stats->bytes_out),
+		 stats->pages, stats->status);
+      ptr += strlen(ptr);
+      in = stats->bytes_out;
+    }
+    if (ptr > buf && ptr[-1] == ';')
+      ptr[-1] = '\0';
+    _prLogJob(job, PAPPL_LOGLEVEL_INFO, "%s", buf);
+  }
+
+  if (driver && chain_stats->stats)
+  {
+    pthread_mutex_lock(&driver->mutex);
+    for (i = 0; i < chain_stats->num_filters; i ++)
+    {
+      stats = chain_stats->stats + i;
+      if (!stats->done)
+	continue;
+      for (j = 0, agg = driver->filters; j < driver->num_filters; j ++, agg ++)
+	if (!strcmp(agg->name, stats->name))
+	  break;
+      if (j >= driver->num_filters)
+      {
+	if (driver->num_filters >= PR_MAX_STATS_FILTERS)
+	  continue;
+	agg = driver->filters + driver->num_filters ++;
+	memset(agg, 0, sizeof(pr_filter_aggregate_t));
+	snprintf(agg->name, sizeof(agg->name), "%s", stats->name);
+	agg->recent_wall = stats->wall;
+      }
+      else
+	agg->recent_wall += PR_STATS_RECENT_WEIGHT *
+	                    (stats->wall - agg->recent_wall);
+      if (stats->cpu_measured)
+      {
+	if (agg->cpu_jobs == 0)
+	  agg->recent_cpu = stats->user + stats->sys;
+	else
+	  agg->recent_cpu += PR_STATS_RECENT_WEIGHT *
+	                     (stats->user + stats->sys - agg->recent_cpu);
+	agg->cpu_jobs ++;
+	agg->cpu += stats->user + stats->sys;
+      }
+      agg->jobs ++;
+      agg->wall  += stats->wall;
+      agg->pages += stats->pages;
+      if (stats->bytes_out > 0)
+	agg->bytes_out += stats->bytes_out;
+    }
+    pthread_mutex_unlock(&driver->mutex);
+  }
+
+  if (chain_stats->stats)
+    munmap(chain_stats->stats,
+	   chain_stats->num_filters * sizeof(pr_filter_stats_t));
+  cupsArrayDelete(chain_stats->chain);
+  free(chain_stats->params);
+  free(chain_stats->wrappers);
+  free(chain_stats);
+}
+
+
+//
+// '_prDriverStatsAddPageRate()' - Add the page rate of a job to the
+//                                 printer's rolling page rate.
+//
+
+void
+_prDriverStatsAddPageRate(pr_driver_stats_t *driver, // I - Printer's
+						      //     aggregates
+			  int    pages,	// I - Pages of the job
+			  double seconds)// I - Time from start to last page
+{
+  double rate;				// Pages per minute of the job
+
+
+  if (pages < 2 || seconds <= 0.0)
+    return;				// Single pages tell nothing about speed
+
+  rate = 60.0 * pages / seconds;
+
+  pthread_mutex_lock(&driver->mutex);
+  if (driver->rate_jobs ++ == 0)
+    driver->page_rate = rate;
+  else
+    driver->page_rate = PR_STATS_RECENT_WEIGHT * rate +
+      (1.0 - PR_STATS_RECENT_WEIGHT) * driver->page_rate;
+  pthread_mutex_unlock(&driver->mutex);
+}
+
+
+//
+// '_prDriverStatsAddConversion()' - Add the measurements of a job's
+//                                   filter chain to the aggregates of
+//                                   its spooling conversion. The last
+//                                   filter, sending the data to the
+//                                   printer, does not count, its time
+//                                   depends on the printer and not on
+//                                   the conversion. Chains with a
+//                                   filter without measured CPU time
+//                                   do not count either. The pages are
+//                                   the ones reported by the last
+//                                   converting filter, the driver,
+//                                   the given ones only if no filter
+//                                   reports pages.
+//
+
+void
+_prDriverStatsAddConversion(
+    pr_driver_stats_t *driver,		// I - Printer's aggregates
+    const char        *key,		// I - Conversion
+    pr_chain_stats_t  *chain_stats,	// I - Measurements of the job
+    int               pages)		// I - Pages of the job, if no
+					//     filter reports them
+{
+  pr_filter_stats_t         *stats;
+  pr_conversion_aggregate_t *agg;
+  double                    wall = 0.0,	// Time until last filter finished
+                            cpu = 0.0;	// CPU time of all filters
+  int                       i;
+
+
+  if (!chain_stats || !chain_stats->stats)
+    return;
+
+  for (i = 0; i < chain_stats->num_filters - 1; i ++)
+  {
+    stats = chain_stats->stats + i;
+    if (!stats->done || stats->status || !stats->cpu_measured)
+      return;
+    // The filters run concurrently, in a pipeline
+    if (stats->wall > wall)
+      wall = stats->wall;
+    cpu += stats->user + stats->sys;
+    // The pages as they come out of the conversion
+    if (stats->pages > 0)
+      pages = stats->pages;
+  }
+  if (wall <= 0.0 || pages <= 0)
+    return;
+
+  pthread_mutex_lock(&driver->mutex);
+  for (i = 0, agg = driver->conversions; i < driver->num_conversions;
+       i ++, agg ++)
+    if (!strcmp(agg->key, key))
+      break;
+  if (i >= driver->num_conversions)
+  {
+    if (driver->num_conversions >= PR_MAX_STATS_CONVERSIONS)
+    {
+      pthread_mutex_unlock(&driver->mutex);
+      return;
+    }
+    agg = driver->conversions + driver->num_conversions ++;
+    memset(agg, 0, sizeof(pr_conversion_aggregate_t));
+    snprintf(agg->key, sizeof(agg->key), "%s", key);
+    agg->recent_page_wall = wall / pages;
+    agg->recent_page_cpu  = cpu / pages;
+  }
+  else
+  {
+    agg->recent_page_wall += PR_STATS_RECENT_WEIGHT *
+                             (wall / pages - agg->recent_page_wall);
+    agg->recent_page_cpu  += PR_STATS_RECENT_WEIGHT *
+                             (cpu / pages - agg->recent_page_cpu);
+  }
+  agg->jobs ++;
+  agg->pages += pages;
+  agg->wall  += wall;
+  agg->cpu   += cpu;
+  driver->conversions_changed = true;
+  pthread_mutex_unlock(&driver->mutex);
+}
+
+
+//
+// '_prDriverStatsConversionCost()' - Cost of a spooling conversion, the
+//                                    recent CPU time per page, as the
+//                                    wall clock time of the filters
+//                                    also depends on how fast the
+//                                    printer takes the data. Returns
+//                                    -1.0 if the conversion did not get
+//                                    used yet.
+//
+
+double					// O - CPU seconds per page or -1.0
+_prDriverStatsConversionCost(
+    pr_driver_stats_t *driver,		// I - Printer's aggregates
+    const char        *key,		// I - Conversion
+    int               *jobs)		// O - Jobs measured
+{
+  pr_conversion_aggregate_t *agg;
+  double                    cost = -1.0;
+  int                       i;
+
+
+  *jobs = 0;
+
+  pthread_mutex_lock(&driver->mutex);
+  for (i = 0, agg = driver->conversions; i < driver->num_conversions;
+       i ++, agg ++)
+    if (!strcmp(agg->key, key))
+    {
+      *jobs = agg->jobs;
+      cost  = agg->recent_page_cpu;
+      break;
+    }
+  pthread_mutex_unlock(&driver->mutex);
+
+  return (cost);
+}
+
+
+//
+// '_prDriverStatsLoad()' - Load the conversion aggregates of a printer
+//                          saved by an earlier session, only done
+//                          once.
+//
+
+void
+_prDriverStatsLoad(pr_driver_stats_t *driver, // I - Printer's aggregates
+		   pappl_printer_t   *printer,// I - Printer
+		   const char        *directory)// I - State directory
+{
+  pr_conversion_aggregate_t agg;	// Aggregate read from the file
+  char                      filename[1024],
+                            line[512];
+  int                       fd;
+  FILE                      *fp;
+
+
+  pthread_mutex_lock(&driver->mutex);
+
+  if (driver->conversions_loaded)
+  {
+    pthread_mutex_unlock(&driver->mutex);
+    return;
+  }
+  driver->conversions_loaded = true;
+
+  if ((fd = papplPrinterOpenFile(printer, filename, sizeof(filename),
+				 directory, "conversions", "stats", "r")) < 0)
+  {
+    pthread_mutex_unlock(&driver->mutex);
+    return;
+  }
+  if ((fp = fdopen(fd, "r")) == NULL)
+  {
+    close(fd);
+    pthread_mutex_unlock(&driver->mutex);
+    return;
+  }
+
+  // One line per conversion: Jobs, pages, total wall and CPU time,
+  // recent wall and CPU time per page, key
+  while (fgets(line, sizeof(line), fp) &&
+	 driver->num_conversions < PR_MAX_STATS_CONVERSIONS)
+  {
+    memset(&agg, 0, sizeof(agg));
+    if (sscanf(line, "%d %d %lf %lf %lf %lf %255[^\n]", &agg.jobs,
+	       &agg.pages, &agg.wall, &agg.cpu, &agg.recent_page_wall,
+	       &agg.recent_page_cpu, agg.key) == 7 && agg.jobs > 0)
+      driver->conversions[driver->num_conversions ++] = agg;
+  }
+  fclose(fp);
+
+  papplLogPrinter(printer, PAPPL_LOGLEVEL_DEBUG,
+		  "Loaded measurements of %d spooling conversions from %s",
+		  driver->num_conversions, filename);
+
+  pthread_mutex_unlock(&driver->mutex);
+}
+
+
+//
+// '_prDriverStatsSave()' - Save the conversion aggregates of a printer
+//                          for the next session, if they have changed
+//                          since the last save.
+//
+
+void
+_prDriverStatsSave(pr_driver_stats_t *driver, // I - Printer's aggregates
+		   pappl_printer_t   *printer,// I - Printer
+		   const char        *directory)// I - State directory
+{
+  pr_conversion_aggregate_t *agg;
+  char                      filename[1024];
+  int                       fd, i;
+  FILE                      *fp;
+
+
+  pthread_mutex_lock(&driver->mutex);
+
+  if (!driver->conversions_changed)
+  {
+    pthread_mutex_unlock(&driver->mutex);
+    return;
+  }
+
+  if ((fd = papplPrinterOpenFile(printer, filename, sizeof(filename),
+				 directory, "conversions", "stats", "w")) < 0)
+  {
+    pthread_mutex_unlock(&driver->mutex);
+    papplLogPrinter(printer, PAPPL_LOGLEVEL_DEBUG,
+		    "Unable to save measurements of spooling conversions to %s: %s",
+		    filename, strerror(errno));
+    return;
+  }
+  if ((fp = fdopen(fd, "w")) == NULL)
+  {
+    close(fd);
+    pthread_mutex_unlock(&driver->mutex);
+    return;
+  }
+
+  for (i = driver->num_conversions, agg = driver->conversions; i > 0;
+       i --, agg ++)
+    fprintf(fp, "%d %d %.6f %.6f %.6f %.6f %s\n", agg->jobs, agg->pages,
+	    agg->wall, agg->cpu, agg->recent_page_wall, agg->recent_page_cpu,
+	    agg->key);
+  driver->conversions_changed = false;
+
+  pthread_mutex_unlock(&driver->mutex);
+
+  fclose(fp);
+}
+
+
+//
+// 'pr_driver_stats_save_printer()' - Save the conversion aggregates of
+//                                    one printer, callback of
+//                                    papplSystemIteratePrinters().
+//
+
+static void
+pr_driver_stats_save_printer(pappl_printer_t *printer,	// I - Printer
+			     void            *data)	// I - Global data
+{
+  pr_printer_app_global_data_t *global_data =
+    (pr_printer_app_global_data_t *)data;
+  pappl_pr_driver_data_t       driver_data;
+  pr_driver_extension_t        *extension;
+
+
+  papplPrinterGetDriverData(printer, &driver_data);
+  if ((extension = (pr_driver_extension_t *)driver_data.extension) != NULL)
+    _prDriverStatsSave(&extension->stats, printer, global_data->state_dir);
+}
+
+
+//
+// '_prDriverStatsSaveTimer()' - Timer callback to save the changed
+//                               conversion aggregates of all printers,
+//                               so that they are not rewritten after
+//                               every job. The remaining changes get
+//                               saved when the printers get deleted
+//                               on shutdown.
+//
+
+bool					// O - true to keep the timer running
+_prDriverStatsSaveTimer(pappl_system_t *system,	// I - System
+			void           *data)	// I - Global data
+{
+  papplSystemIteratePrinters(system, pr_driver_stats_save_printer, data);
+
+  return (true);
+}
+
+
+//
+// '_prDriverStatsInit()' - Initialize the filter statistics of a
+//                          printer.
+//
+
+void
+_prDriverStatsInit(pr_driver_stats_t *driver) // I - Printer's aggregates
+{
+  memset(driver, 0, sizeof(pr_driver_stats_t));
+  pthread_mutex_init(&driver->mutex, NULL);
+}
+
+
+//
+// '_prDriverStatsFree()' - Free the filter statistics of a printer.
+//
+
+void
+_prDriverStatsFree(pr_driver_stats_t *driver) // I - Printer's aggregates
+{
+  pthread_mutex_destroy(&driver->mutex);
+}
@@ -0,0 +1,109 @@
+//
+// PPD/Classic CUPS driver retro-fit Printer Application Library
+// (libpappl-retrofit) for the Printer Application Framework (PAPPL)
+//
+// governor-private.h
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#ifndef _PAPPL_RETROFIT_GOVERNOR_H_
+#  define _PAPPL_RETROFIT_GOVERNOR_H_
+
+//
+// Include necessary headers...
+//
+
+#include <pappl-retrofit/pappl-retrofit.h>
+#include <pappl/pappl.h>
+#include <pthread.h>
+#include <stdbool.h>
+
+
+//
+// C++ magic...
+//
+
+#  ifdef __cplusplus
+extern "C" {
+#  endif // __cplusplus
+
+
+//
+// Constants...
+//
+
+#define PR_GOVERNOR_CHAIN_MEMORY_DEFAULT 256
+					// Memory assumed for a render chain
+					// (in MB)
+#define PR_GOVERNOR_MAX_PRINTERS 256	// Printers we keep track of for
+					// fair sharing
+#define PR_GOVERNOR_POLL_INTERVAL 1	// Interval for checking whether a
+					// waiting job got canceled (seconds)
+#define PR_GOVERNOR_MAX_BYPASS	60.0	// Time after which small jobs do not
+					// get ahead of a waiting job any
+					// more (seconds)
+
+
+//
+// Types...
+//
+
+typedef struct pr_governor_waiter_s	// Job waiting for a render slot
+{
+  int            printer_id;		// Printer ID
+  int            job_id;		// Job ID
+  double         cost;			// Estimated cost of the job, -1.0 if
+					// unknown
+  double         since;			// Time when the job started waiting
+  bool           granted;		// Slot granted?
+  struct pr_governor_waiter_s *next;	// Next waiting job
+} pr_governor_waiter_t;
+
+typedef struct pr_governor_printer_s	// Render slots of a printer
+{
+  int            printer_id;		// Printer ID
+  int            running;		// Render chains running
+  unsigned long  last_grant;		// Number of the printer's last grant
+} pr_governor_printer_t;
+
+typedef struct pr_governor_s		// System-wide limit of concurrent
+					// render chains
+{
+  pthread_mutex_t mutex;		// Lock
+  pthread_cond_t cond;			// Signaled when slots get granted
+  int            max_chains;		// Maximum concurrent render chains,
+					// 0 for no limit
+  int            running;		// Render chains running
+  unsigned long  grants;		// Slots granted so far
+  pr_governor_waiter_t *waiters;	// Jobs waiting, in order of arrival
+  int            num_printers;		// Number of printers seen
+  pr_governor_printer_t printers[PR_GOVERNOR_MAX_PRINTERS];
+					// Render slots of each printer
+} pr_governor_t;
+
+
+//
+// Functions...
+//
+
+extern void _prGovernorInit(pr_printer_app_global_data_t *global_data);
+extern bool _prGovernorAcquire(pr_printer_app_global_data_t *global_data,
+			       pappl_job_t *job);
+extern bool _prGovernorTryAcquire(pr_printer_app_global_data_t *global_data,
+				  pappl_printer_t *printer);
+extern void _prGovernorRelease(pr_printer_app_global_data_t *global_data,
+			       pappl_printer_t *printer);
+
+
+//
+// C++ magic...
+//
+
+#  ifdef __cplusplus
+}
+#  endif // __cplusplus
+
+
+#endif // !_PAPPL_RETROFIT_GOVERNOR_H_
@@ -0,0 +1,339 @@
+//
+// PPD/Classic CUPS driver retro-fit Printer Application Library
+// (libpappl-retrofit) for the Printer Application Framework (PAPPL)
+//
+// governor.c
+//
+// System-wide admission control for render chains: Each printer's job
+// thread starts its own filter processes, so with many queues getting
+// jobs at the same time the host would run more renderers than it has
+// CPUs and memory for. Jobs get a render slot before starting their
+// filter chain, if none is free they wait, sharing the slots fairly
+// between the printers and optionally letting small jobs go first.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+//
+// Include necessary headers...
+//
+
+#include <pappl-retrofit/pappl-retrofit-private.h>
+#include <time.h>
+
+
+//
+// 'pr_governor_printer()' - Find the render slot record of a printer,
+//                           create it if needed. Governor must be
+//                           locked.
+//
+
+static pr_governor_printer_t *		// O - Printer's record
+pr_governor_printer(pr_governor_t *gov,	// I - Governor
+		    int           printer_id)// I - Printer ID
+{
+  pr_governor_printer_t *p,		// Current record
+                        *unused = NULL;	// Record to reuse
+  int                   i;
+
+
+  for (i = 0, p = gov->printers; i < gov->num_printers; i ++, p ++)
+  {
+    if (p->printer_id == printer_id)
+      return (p);
+    if (p->running == 0 && (!unused || p->last_grant < unused->last_grant))
+      unused = p;
+  }
+
+  if (gov->num_printers < PR_GOVERNOR_MAX_PRINTERS)
+    p = gov->printers + gov->num_printers ++;
+  else if (unused)
+    p = unused;
+  else
+    p = gov->printers;			// Cannot happen, fewer slots than
+					// printers
+
+  memset(p, 0, sizeof(pr_governor_printer_t));
+  p->printer_id = printer_id;
+
+  return (p);
+}
+
+
+//
+// 'pr_governor_before()' - Should job "a" get the next free slot before
+//                          job "b" (which arrived earlier)? First the
+//                          printer with fewer running render chains,
+//                          then, if enabled, the smaller job unless
+//                          the other one is waiting for too long
+//                          already, then the printer which did not get
+//                          a slot for the longest time. Governor must
+//                          be locked.
+//
+
+static bool				// O - `true` if "a" goes first
+pr_governor_before(
+    pr_printer_app_global_data_t *global_data,// I - Global data
+    pr_governor_waiter_t         *a,	// I - Waiting job
+    pr_governor_waiter_t         *b,	// I - Waiting job, arrived earlier
+    double                       now)	// I - Current time
+{
+  pr_governor_t         *gov = &global_data->governor;
+  pr_governor_printer_t *pa = pr_governor_printer(gov, a->printer_id),
+                        *pb = pr_governor_printer(gov, b->printer_id);
+
+
+  if (pa->running != pb->running)
+    return (pa->running < pb->running);
+
+  if (global_data->render_small_jobs_first && a->cost >= 0.0 &&
+      b->cost >= 0.0 && a->cost != b->cost &&
+      now - a->since < PR_GOVERNOR_MAX_BYPASS &&
+      now - b->since < PR_GOVERNOR_MAX_BYPASS)
+    return (a->cost < b->cost);
+
+  if (pa != pb)
+    return (pa->last_grant < pb->last_grant);
+
+  return (false);
+}
+
+
+//
+// 'pr_governor_grant()' - Take a render slot for a printer. Governor
+//                         must be locked.
+//
+
+static void
+pr_governor_grant(pr_governor_t *gov,	// I - Governor
+		  int           printer_id)// I - Printer ID
+{
+  pr_governor_printer_t *p = pr_governor_printer(gov, printer_id);
+
+
+  gov->running ++;
+  p->running ++;
+  p->last_grant = ++ gov->grants;
+}
+
+
+//
+// 'pr_governor_dispatch()' - Grant the free render slots to the
+//                            waiting jobs. Governor must be locked.
+//
+
+static void
+pr_governor_dispatch(
+    pr_printer_app_global_data_t *global_data)// I - Global data
+{
+  pr_governor_t        *gov = &global_data->governor;
+  pr_governor_waiter_t *w,		// Current waiting job
+                       **best,		// Link to job getting the slot
+                       **link;		// Link to current job
+  double               now = _prGetCurrentTime();
+  bool                 granted = false;	// Slots granted?
+
+
+  while (gov->running < gov->max_chains && gov->waiters)
+  {
+    for (best = &gov->waiters, link = &gov->waiters->next; (w = *link);
+	 link = &w->next)
+      if (pr_governor_before(global_data, w, *best, now))
+	best = link;
+
+    w = *best;
+    *best = w->next;
+    w->next = NULL;
+    w->granted = true;
+    pr_governor_grant(gov, w->printer_id);
+    granted = true;
+  }
+
+  if (granted)
+    pthread_cond_broadcast(&gov->cond);
+}
+
+
+//
+// '_prGovernorInit()' - Set up the render slots: One per CPU, or as
+//                       configured, but not more than fit into the
+//                       memory budget.
+//
+
+void
+_prGovernorInit(pr_printer_app_global_data_t *global_data)
+					// I - Global data
+{
+  pr_governor_t *gov = &global_data->governor;
+  long          cpus;			// Number of CPUs
+  size_t        by_memory;		// Render chains fitting into memory
+
+
+  memset(gov, 0, sizeof(pr_governor_t));
+  pthread_mutex_init(&gov->mutex, NULL);
+  pthread_cond_init(&gov->cond, NULL);
+
+  if ((gov->max_chains = global_data->render_max_chains) < 0)
+    gov->max_chains = (cpus = sysconf(_SC_NPROCESSORS_ONLN)) > 0 ?
+      (int)cpus : 1;
+
+  if (gov->max_chains > 0 && global_data->render_memory_budget > 0 &&
+      global_data->render_chain_memory > 0)
+  {
+    by_memory = global_data->render_memory_budget /
+      global_data->render_chain_memory;
+    if (by_memory < 1)
+      by_memory = 1;
+    if (by_memory < (size_t)gov->max_chains)
+      gov->max_chains = (int)by_memory;
+  }
+
+  if (gov->max_chains > 0)
+    papplLog(global_data->system, PAPPL_LOGLEVEL_INFO,
+	     "Running at most %d render chains at a time%s", gov->max_chains,
+	     global_data->render_small_jobs_first ? ", small jobs first" : "");
+}
+
+
+//
+// '_prGovernorAcquire()' - Get a render slot for a job, waiting until
+//                          one is free. While waiting the job has the
+//                          "resources-are-not-ready" state reason.
+//                          Returns `false` if the job got canceled
+//                          while waiting.
+//
+
+bool					// O - `true` if the job got a slot
+_prGovernorAcquire(pr_printer_app_global_data_t *global_data,
+					// I - Global data
+		   pappl_job_t *job)	// I - Job
+{
+  pr_governor_t        *gov = &global_data->governor;
+  pr_governor_waiter_t waiter,		// This job
+                       **link;		// Link to waiting job
+  struct timespec      timeout;		// Timeout for waiting
+  int                  running,		// Render chains running
+                       waiting;		// Jobs waiting
+
+
+  if (gov->max_chains <= 0)
+    return (true);
+
+  memset(&waiter, 0, sizeof(waiter));
+  waiter.printer_id = papplPrinterGetID(papplJobGetPrinter(job));
+  waiter.job_id     = papplJobGetID(job);
+  waiter.cost       = global_data->render_small_jobs_first ?
+                      _prPreflightGetCost(global_data, waiter.job_id) : -1.0;
+  waiter.since      = _prGetCurrentTime();
+
+  pthread_mutex_lock(&gov->mutex);
+  for (link = &gov->waiters; *link; link = &(*link)->next);
+  *link = &waiter;
+  pr_governor_dispatch(global_data);
+  if (waiter.granted)
+  {
+    pthread_mutex_unlock(&gov->mutex);
+    return (true);
+  }
+  running = gov->running;
+  for (waiting = 0, link = &gov->waiters; *link; link = &(*link)->next)
+    waiting ++;
+  pthread_mutex_unlock(&gov->mutex);
+
+  _prLogJob(job, PAPPL_LOGLEVEL_INFO,
+	    "Waiting for a render slot, %d jobs rendering, %d waiting",
+	    running, waiting);
+  papplJobSetReasons(job, PAPPL_JREASON_RESOURCES_ARE_NOT_READY,
+		     PAPPL_JREASON_NONE);
+  papplJobSetMessage(job, "Waiting for other jobs to finish rendering");
+
+  pthread_mutex_lock(&gov->mutex);
+  while (!waiter.granted && !papplJobIsCanceled(job))
+  {
+    clock_gettime(CLOCK_REALTIME, &timeout);
+    timeout.tv_sec += PR_GOVERNOR_POLL_INTERVAL;
+    pthread_cond_timedwait(&gov->cond, &gov->mutex, &timeout);
+  }
+  if (!waiter.granted)
+  {
+    // Canceled, leave the queue
+    for (link = &gov->waiters; *link && *link != &waiter;
+	 link = &(*link)->next);
+    if (*link)
+      *link = waiter.next;
+  }
+  pthread_mutex_unlock(&gov->mutex);
+
+  papplJobSetReasons(job, PAPPL_JREASON_NONE,
+		     PAPPL_JREASON_RESOURCES_ARE_NOT_READY);
+  if (waiter.granted)
+  {
+    _prLogJob(job, PAPPL_LOGLEVEL_INFO,
+	      "Waited %.1f seconds for a render slot",
+	      _prGetCurrentTime() - waiter.since);
+    papplJobSetMessage(job, "Waited %.0f seconds for other jobs to finish rendering",
+		       _prGetCurrentTime() - waiter.since);
+  }
+
+  return (waiter.granted);
+}
+
+
+//
+// '_prGovernorTryAcquire()' - Get a render slot for a printer only if
+//                             one is free and no job is waiting, for
+//                             optional work like rendering jobs ahead
+//                             of time.
+//
+
+bool					// O - `true` if we got a slot
+_prGovernorTryAcquire(pr_printer_app_global_data_t *global_data,
+					// I - Global data
+		      pappl_printer_t *printer)// I - Printer
+{
+  pr_governor_t *gov = &global_data->governor;
+  bool          ret = false;
+
+
+  if (gov->max_chains <= 0)
+    return (true);
+
+  pthread_mutex_lock(&gov->mutex);
+  if (gov->running < gov->max_chains && !gov->waiters)
+  {
+    pr_governor_grant(gov, papplPrinterGetID(printer));
+    ret = true;
+  }
+  pthread_mutex_unlock(&gov->mutex);
+
+  return (ret);
+}
+
+
+//
+// '_prGovernorRelease()' - Give a render slot back, when the job's
+//                          filter chain has finished.
+//
+
+void
+_prGovernorRelease(pr_printer_app_global_data_t *global_data,
+					// I - Global data
+		   pappl_printer_t *printer)// I - Printer
+{
+  pr_governor_t         *gov = &global_data->governor;
+  pr_governor_printer_t *p;		// Printer's record
+
+
+  if (gov->max_chains <= 0)
+    return;
+
+  pthread_mutex_lock(&gov->mutex);
+  p = pr_governor_printer(gov, papplPrinterGetID(printer));
+  if (p->running > 0)
+    p->running --;
+  if (gov->running > 0)
+    gov->running --;
+  pr_governor_dispatch(global_data);
+  pthread_mutex_unlock(&gov->mutex);
+}
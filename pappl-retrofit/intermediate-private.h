@@ -0,0 +1,82 @@
+//
+// PPD/Classic CUPS driver retro-fit Printer Application Library
+// (libpappl-retrofit) for the Printer Application Framework (PAPPL)
+//
+// intermediate-private.h
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#ifndef _PAPPL_RETROFIT_INTERMEDIATE_H_
+#  define _PAPPL_RETROFIT_INTERMEDIATE_H_
+
+//
+// Include necessary headers...
+//
+
+#include <pappl-retrofit/pappl-retrofit.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+
+//
+// C++ magic...
+//
+
+#  ifdef __cplusplus
+extern "C" {
+#  endif // __cplusplus
+
+
+//
+// Constants...
+//
+
+#define PR_INTERMEDIATE_MEM_SIZE_DEFAULT (64 * 1024 * 1024)
+					// Default memory limit for an
+					// intermediate file
+
+
+//
+// Types...
+//
+
+typedef struct pr_intermediate_s	// Seekable intermediate file, kept in
+					// memory up to a size limit, in
+					// memory shared with forked processes
+{
+  int            fd;			// Memory file, -1 for none
+  size_t         max_mem;		// Size limit for the memory file
+  off_t          size;			// Bytes written
+  bool           spilled;		// Data moved to the spill file?
+  int            spill_fd;		// Spill file, valid only in the
+					// process which writes
+  char           spill_file[1024];	// Name of the spill file
+} pr_intermediate_t;
+
+
+//
+// Functions...
+//
+
+extern pr_intermediate_t *_prIntermediateCreate(const char *name,
+						const char *spill_file,
+						size_t max_mem);
+extern int  _prIntermediateWrite(pr_intermediate_t *im, const void *buf,
+				 size_t len);
+extern void _prIntermediateFinish(pr_intermediate_t *im);
+extern int  _prIntermediateOpen(pr_intermediate_t *im);
+extern void _prIntermediateFree(pr_intermediate_t *im);
+
+
+//
+// C++ magic...
+//
+
+#  ifdef __cplusplus
+}
+#  endif // __cplusplus
+
+
+#endif // !_PAPPL_RETROFIT_INTERMEDIATE_H_
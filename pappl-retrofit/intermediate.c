@@ -0,0 +1,240 @@
+//
+// PPD/Classic CUPS driver retro-fit Printer Application Library
+// (libpappl-retrofit) for the Printer Application Framework (PAPPL)
+//
+// intermediate.c
+//
+// Seekable intermediate files for data which has to be read more than
+// once: Kept in an anonymous memory file (memfd_create()) as long as
+// they do not exceed a size limit, moved to a file in the spool
+// directory when they grow beyond it, so that small and medium jobs
+// do not cause any disk traffic.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+//
+// Include necessary headers...
+//
+
+#include <pappl-retrofit/pappl-retrofit-private.h>
+#include <pappl-retrofit/libcups2-private.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+//
+// 'pr_write_all()' - Write a buffer completely.
+//
+
+static int				// O - 0 on success, -1 on error
+pr_write_all(int        fd,		// I - File descriptor
+	     const char *buf,		// I - Data
+	     size_t     len)		// I - Length of data
+{
+  ssize_t n;				// Bytes written
+
+
+  while (len > 0)
+  {
+    if ((n = write(fd, buf, len)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+	continue;
+      return (-1);
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+
+  return (0);
+}
+
+
+//
+// 'pr_intermediate_spill()' - Move the data of the memory file into the
+//                             spill file, when the size limit got
+//                             reached.
+//
+
+static int				// O - 0 on success, -1 on error
+pr_intermediate_spill(pr_intermediate_t *im)// I - Intermediate file
+{
+  char    buf[65536];			// Copy buffer
+  ssize_t bytes;			// Bytes read
+  off_t   pos = 0;			// Position in memory file
+
+
+  if ((im->spill_fd = open(im->spill_file, O_CREAT | O_RDWR | O_TRUNC,
+			   S_IRUSR | S_IWUSR)) < 0)
+    return (-1);
+
+  while (pos < im->size)
+  {
+    if ((bytes = pread(im->fd, buf, sizeof(buf), pos)) < 0)
+    {
+      if (errno == EINTR)
+	continue;
+      return (-1);
+    }
+    if (bytes == 0 || pr_write_all(im->spill_fd, buf, (size_t)bytes))
+      return (-1);
+    pos += bytes;
+  }
+
+  // Give the memory back, the data is only read from the spill file
+  // from now on. The memory file stays open, other processes have it
+  // open under the same number and _prIntermediateFree() closes it.
+  if (ftruncate(im->fd, 0))
+    return (-1);
+  im->spilled = true;
+
+  return (0);
+}
+
+
+//
+// '_prIntermediateCreate()' - Create an intermediate file. Its data is
+//                             kept in memory up to "max_mem" bytes and
+//                             in "spill_file" when it gets larger, or
+//                             from the start if "max_mem" is 0 or the
+//                             system does not support memory files.
+//                             The intermediate file is in memory
+//                             shared with processes forked later, so
+//                             that the data can be written in a
+//                             filter process and read in the job's
+//                             thread.
+//
+
+pr_intermediate_t *			// O - Intermediate file or NULL
+_prIntermediateCreate(const char *name,	// I - Name, for debugging
+		      const char *spill_file,// I - File name when on disk
+		      size_t     max_mem)// I - Size limit for memory
+{
+  pr_intermediate_t *im;		// Intermediate file
+
+
+  if ((im = (pr_intermediate_t *)mmap(NULL, sizeof(pr_intermediate_t),
+				      PROT_READ | PROT_WRITE,
+				      MAP_SHARED | MAP_ANONYMOUS, -1, 0)) ==
+      MAP_FAILED)
+    return (NULL);
+
+  memset(im, 0, sizeof(pr_intermediate_t));
+  im->fd       = -1;
+  im->spill_fd = -1;
+  im->max_mem  = max_mem;
+  snprintf(im->spill_file, sizeof(im->spill_file), "%s", spill_file);
+
+#ifdef HAVE_MEMFD_CREATE
+  if (max_mem > 0)
+    im->fd = memfd_create(name, MFD_CLOEXEC);
+#else
+  (void)name;
+#endif // HAVE_MEMFD_CREATE
+
+  if (im->fd < 0)
+  {
+    // No memory file, write to disk right away
+    if ((im->spill_fd = open(im->spill_file, O_CREAT | O_RDWR | O_TRUNC,
+			     S_IRUSR | S_IWUSR)) < 0)
+    {
+      munmap(im, sizeof(pr_intermediate_t));
+      return (NULL);
+    }
+    im->spilled = true;
+  }
+
+  return (im);
+}
+
+
+//
+// '_prIntermediateWrite()' - Append data to an intermediate file,
+//                            moving it to disk if it gets larger than
+//                            the memory limit.
+//
+
+int					// O - 0 on success, -1 on error
+_prIntermediateWrite(
+    pr_intermediate_t *im,		// I - Intermediate file
+    const void        *buf,		// I - Data
+    size_t            len)		// I - Length of data
+{
+  if (!im->spilled && (size_t)im->size + len > im->max_mem &&
+      pr_intermediate_spill(im))
+    return (-1);
+
+  if (pr_write_all(im->spilled ? im->spill_fd : im->fd, (const char *)buf,
+		   len))
+    return (-1);
+  im->size += (off_t)len;
+
+  return (0);
+}
+
+
+//
+// '_prIntermediateFinish()' - Close the writing end of an intermediate
+//                             file, must be called by the process which
+//                             wrote the data.
+//
+
+void
+_prIntermediateFinish(pr_intermediate_t *im)// I - Intermediate file
+{
+  if (im->spill_fd >= 0)
+  {
+    close(im->spill_fd);
+    im->spill_fd = -1;
+  }
+}
+
+
+//
+// '_prIntermediateOpen()' - Open an intermediate file for reading from
+//                           the start, with its own file position.
+//
+
+int					// O - File descriptor or -1
+_prIntermediateOpen(pr_intermediate_t *im)// I - Intermediate file
+{
+  char filename[64];			// Memory file in /proc
+  int  fd;				// File descriptor
+
+
+  if (im->spilled)
+    return (open(im->spill_file, O_RDONLY));
+
+  snprintf(filename, sizeof(filename), "/proc/self/fd/%d", im->fd);
+  if ((fd = open(filename, O_RDONLY)) < 0 &&
+      (fd = dup(im->fd)) >= 0 && lseek(fd, 0, SEEK_SET) < 0)
+  {
+    close(fd);
+    fd = -1;
+  }
+
+  return (fd);
+}
+
+
+//
+// '_prIntermediateFree()' - Free an intermediate file and remove its
+//                           spill file.
+//
+
+void
+_prIntermediateFree(pr_intermediate_t *im)// I - Intermediate file
+{
+  if (!im)
+    return;
+
+  _prIntermediateFinish(im);
+  if (im->fd >= 0)
+    close(im->fd);
+  if (im->spilled)
+    unlink(im->spill_file);
+  munmap(im, sizeof(pr_intermediate_t));
+}
@@ -0,0 +1,61 @@
+//
+// PPD/Classic CUPS driver retro-fit Printer Application Library
+// (libpappl-retrofit) for the Printer Application Framework (PAPPL)
+//
+// log-sink-private.h
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#ifndef _PAPPL_RETROFIT_LOG_SINK_H_
+#  define _PAPPL_RETROFIT_LOG_SINK_H_
+
+//
+// Include necessary headers...
+//
+
+#include <pappl-retrofit/pappl-retrofit.h>
+#include <pappl/pappl.h>
+
+
+//
+// C++ magic...
+//
+
+#  ifdef __cplusplus
+extern "C" {
+#  endif // __cplusplus
+
+
+//
+// Constants...
+//
+
+#define PR_LOG_SINK_SLOTS	1024	// Messages the buffer holds, must
+					// be a power of 2
+#define PR_LOG_SINK_MESSAGE	1024	// Maximum length of a message
+#define PR_LOG_SINK_BATCH	16	// Messages the writer takes out of
+					// the buffer at once
+
+
+//
+// Functions...
+//
+
+extern void   _prLogSinkInit(pappl_system_t *system);
+extern void   _prLogSinkFlush(void);
+extern void   _prLogJob(pappl_job_t *job, pappl_loglevel_t level,
+			const char *message, ...);
+
+
+//
+// C++ magic...
+//
+
+#  ifdef __cplusplus
+}
+#  endif // __cplusplus
+
+
+#endif // !_PAPPL_RETROFIT_LOG_SINK_H_
@@ -0,0 +1,383 @@
+//
+// PPD/Classic CUPS driver retro-fit Printer Application Library
+// (libpappl-retrofit) for the Printer Application Framework (PAPPL)
+//
+// log-sink.c
+//
+// Asynchronous job log: Job threads and filter processes put their
+// log messages into a lock-free ring buffer and a writer thread of
+// the process passes them on to PAPPL's log, so that a slow log
+// target does not stall printing. The writer sleeps on a condition
+// variable while the buffer is empty and takes the messages out of the
+// buffer in batches, logging each of them with its own papplLog() call.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+//
+// Include necessary headers...
+//
+
+#include <pappl-retrofit/pappl-retrofit-private.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+
+
+//
+// Types...
+//
+
+typedef struct pr_log_entry_s		// Message in the ring buffer
+{
+  atomic_size_t    seq;			// Sequence number of the slot
+  pappl_loglevel_t level;		// Log level
+  int              job_id;		// Job ID
+  char             message[PR_LOG_SINK_MESSAGE];
+					// Message
+} pr_log_entry_t;
+
+typedef struct pr_log_sink_s		// Ring buffer of a process, many
+					// writers, one reader
+{
+  pappl_system_t   *system;		// System to log to
+  pr_log_entry_t   entries[PR_LOG_SINK_SLOTS];
+					// Messages
+  atomic_size_t    head,		// Next slot to fill
+                   tail;		// Next slot to log
+  atomic_ulong     dropped_debug,	// Debug messages dropped
+                   dropped;		// Other messages dropped
+  atomic_int       writer;		// 1 if the writer thread of this
+					// process runs, -1 if we have to log
+					// synchronously
+  atomic_bool      stop;		// Writer thread should stop
+  atomic_bool      sleeping;		// Writer waits for messages?
+  pthread_mutex_t  mutex;		// Lock for waking up the writer
+  pthread_cond_t   cond;		// Signalled when a message comes in
+					// while the writer sleeps
+  pthread_t        writer_thread;	// Writer thread
+} pr_log_sink_t;
+
+
+//
+// Local globals...
+//
+
+static pr_log_sink_t pr_log_sink;	// Log buffer of this process
+
+
+//
+// 'pr_log_sink_reset()' - Empty the ring buffer.
+//
+
+static void
+pr_log_sink_reset(void)
+{
+  size_t i;				// Looping var
+
+
+  for (i = 0; i < PR_LOG_SINK_SLOTS; i ++)
+    atomic_store_explicit(&pr_log_sink.entries[i].seq, i,
+			  memory_order_relaxed);
+  atomic_store(&pr_log_sink.head, 0);
+  atomic_store(&pr_log_sink.tail, 0);
+  atomic_store(&pr_log_sink.dropped_debug, 0);
+  atomic_store(&pr_log_sink.dropped, 0);
+  atomic_store(&pr_log_sink.stop, false);
+  atomic_store(&pr_log_sink.sleeping, false);
+}
+
+
+//
+// 'pr_log_sink_fork()' - A forked process does not have the writer
+//                        thread, it starts its own one when it logs
+//                        the first time. Messages not yet logged
+//                        belong to the parent.
+//
+
+static void
+pr_log_sink_fork(void)
+{
+  pr_log_sink_reset();
+  atomic_store(&pr_log_sink.writer, 0);
+  pthread_mutex_init(&pr_log_sink.mutex, NULL);
+  pthread_cond_init(&pr_log_sink.cond, NULL);
+}
+
+
+//
+// 'pr_log_sink_wakeup()' - Wake up the writer if it sleeps.
+//
+
+static void
+pr_log_sink_wakeup(void)
+{
+  if (atomic_exchange(&pr_log_sink.sleeping, false))
+  {
+    pthread_mutex_lock(&pr_log_sink.mutex);
+    pthread_cond_signal(&pr_log_sink.cond);
+    pthread_mutex_unlock(&pr_log_sink.mutex);
+  }
+}
+
+
+//
+// 'pr_log_sink_empty()' - Check whether the writer has nothing to log.
+//
+
+static bool				// O - true if nothing to log
+pr_log_sink_empty(void)
+{
+  size_t tail = atomic_load(&pr_log_sink.tail);
+
+
+  return (atomic_load(&pr_log_sink.entries[tail & (PR_LOG_SINK_SLOTS - 1)].
+		      seq) != tail + 1);
+}
+
+
+//
+// 'pr_log_sink_drain()' - Log all messages of the ring buffer, called
+//                         only by the writer. The messages get copied
+//                         out in batches, freeing their slots for the
+//                         senders before the slower logging, and every
+//                         message gets its own line with PAPPL's
+//                         time stamp and log level. Returns the number
+//                         of messages logged.
+//
+
+static int				// O - Messages logged
+pr_log_sink_drain(void)
+{
+  pr_log_entry_t   *entry;		// Current slot
+  size_t           tail;		// Position of current slot
+  unsigned long    dropped_debug,	// Debug messages dropped
+                   dropped;		// Other messages dropped
+  struct
+  {
+    pappl_loglevel_t level;		// Log level
+    int              job_id;		// Job ID
+    char             message[PR_LOG_SINK_MESSAGE];
+					// Message
+  }                batch[PR_LOG_SINK_BATCH];
+					// Messages taken out of the buffer
+  int              i,
+                   num_batch,		// Messages in the batch
+                   count = 0;		// Messages logged
+
+
+  do
+  {
+    tail = atomic_load_explicit(&pr_log_sink.tail, memory_order_relaxed);
+    for (num_batch = 0; num_batch < PR_LOG_SINK_BATCH; num_batch ++, tail ++)
+    {
+      entry = pr_log_sink.entries + (tail & (PR_LOG_SINK_SLOTS - 1));
+      if (atomic_load_explicit(&entry->seq, memory_order_acquire) !=
+	  tail + 1)
+	break;			// Empty or not completely written yet
+
+      batch[num_batch].level  = entry->level;
+      batch[num_batch].job_id = entry->job_id;
+      memcpy(batch[num_batch].message, entry->message,
+	     sizeof(batch[num_batch].message));
+
+      atomic_store_explicit(&entry->seq, tail + PR_LOG_SINK_SLOTS,
+			    memory_order_release);
+    }
+    atomic_store_explicit(&pr_log_sink.tail, tail, memory_order_release);
+
+    for (i = 0; i < num_batch; i ++)
+      papplLog(pr_log_sink.system, batch[i].level, "[Job %d] %s",
+	       batch[i].job_id, batch[i].message);
+    count += num_batch;
+  }
+  while (num_batch == PR_LOG_SINK_BATCH);
+
+  dropped_debug = atomic_exchange(&pr_log_sink.dropped_debug, 0);
+  dropped       = atomic_exchange(&pr_log_sink.dropped, 0);
+  if (dropped_debug || dropped)
+    papplLog(pr_log_sink.system, PAPPL_LOGLEVEL_WARN,
+	     "Job log buffer full, dropped %lu debug and %lu other messages",
+	     dropped_debug, dropped);
+
+  return (count);
+}
+
+
+//
+// 'pr_log_sink_writer()' - Writer thread, passes the messages on to
+//                          PAPPL's log.
+//
+
+static void *				// O - Thread exit status (unused)
+pr_log_sink_writer(void *data)		// I - Unused
+{
+  (void)data;
+
+  while (!atomic_load(&pr_log_sink.stop))
+  {
+    if (pr_log_sink_drain() > 0)
+      continue;
+
+    // Sleep until a message comes in, a sender which publishes its
+    // message after our check sees the flag and wakes us up
+    pthread_mutex_lock(&pr_log_sink.mutex);
+    atomic_store(&pr_log_sink.sleeping, true);
+    if (pr_log_sink_empty() && !atomic_load(&pr_log_sink.stop))
+      pthread_cond_wait(&pr_log_sink.cond, &pr_log_sink.mutex);
+    atomic_store(&pr_log_sink.sleeping, false);
+    pthread_mutex_unlock(&pr_log_sink.mutex);
+  }
+
+  pr_log_sink_drain();
+
+  return (NULL);
+}
+
+
+//
+// 'pr_log_sink_atexit()' - Log what is left before the process exits.
+//
+
+static void
+pr_log_sink_atexit(void)
+{
+  _prLogSinkFlush();
+}
+
+
+//
+// '_prLogSinkInit()' - Set up the job log buffer. Until it is set up
+//                      _prLogJob() logs synchronously.
+//
+
+void
+_prLogSinkInit(pappl_system_t *system)	// I - System
+{
+  pr_log_sink_reset();
+  atomic_store(&pr_log_sink.writer, 0);
+  pthread_mutex_init(&pr_log_sink.mutex, NULL);
+  pthread_cond_init(&pr_log_sink.cond, NULL);
+  pr_log_sink.system = system;
+  pthread_atfork(NULL, NULL, pr_log_sink_fork);
+  atexit(pr_log_sink_atexit);
+}
+
+
+//
+// '_prLogSinkFlush()' - Stop the writer thread of this process after
+//                       it has logged all messages. Must be called
+//                       before a process ends with _exit(). A new
+//                       writer thread gets started when a message
+//                       comes in afterwards.
+//
+
+void
+_prLogSinkFlush(void)
+{
+  if (atomic_load(&pr_log_sink.writer) != 1)
+    return;
+
+  pthread_mutex_lock(&pr_log_sink.mutex);
+  atomic_store(&pr_log_sink.stop, true);
+  pthread_cond_signal(&pr_log_sink.cond);
+  pthread_mutex_unlock(&pr_log_sink.mutex);
+  pthread_join(pr_log_sink.writer_thread, NULL);
+  atomic_store(&pr_log_sink.stop, false);
+  atomic_store(&pr_log_sink.writer, 0);
+}
+
+
+//
+// '_prLogJob()' - Log a message for a job without waiting for the log
+//                 to get written, replacement for papplLogJob(). If
+//                 the buffer is full, messages get dropped and
+//                 counted, debug messages already when it is three
+//                 quarters full, to keep room for the important
+//                 ones.
+//
+
+void
+_prLogJob(pappl_job_t      *job,	// I - Job
+	  pappl_loglevel_t level,	// I - Log level
+	  const char       *message,	// I - printf-style message
+	  ...)				// I - Additional arguments
+{
+  va_list        ap;			// Pointer to additional args
+  pr_log_entry_t *entry;		// Slot for the message
+  size_t         head,			// Position of the slot
+                 seq;			// Sequence number of the slot
+  int            writer = 0;		// State of writer thread
+  char           buffer[PR_LOG_SINK_MESSAGE];
+					// Message when logging synchronously
+
+
+  if (pr_log_sink.system)
+  {
+    if (level < papplSystemGetLogLevel(pr_log_sink.system))
+      return;
+
+    // Start the writer thread of this process with the first message
+    if (atomic_load(&pr_log_sink.writer) == 0 &&
+	atomic_compare_exchange_strong(&pr_log_sink.writer, &writer, 1) &&
+	pthread_create(&pr_log_sink.writer_thread, NULL, pr_log_sink_writer,
+		       NULL))
+      atomic_store(&pr_log_sink.writer, -1);
+  }
+
+  if (!pr_log_sink.system || atomic_load(&pr_log_sink.writer) < 0)
+  {
+    va_start(ap, message);
+    vsnprintf(buffer, sizeof(buffer), message, ap);
+    va_end(ap);
+    papplLogJob(job, level, "%s", buffer);
+    return;
+  }
+
+  // Claim a slot
+  head = atomic_load_explicit(&pr_log_sink.head, memory_order_relaxed);
+  for (;;)
+  {
+    if (level == PAPPL_LOGLEVEL_DEBUG &&
+	head - atomic_load_explicit(&pr_log_sink.tail, memory_order_acquire) >=
+	PR_LOG_SINK_SLOTS / 4 * 3)
+    {
+      atomic_fetch_add(&pr_log_sink.dropped_debug, 1);
+      return;
+    }
+
+    entry = pr_log_sink.entries + (head & (PR_LOG_SINK_SLOTS - 1));
+    seq   = atomic_load_explicit(&entry->seq, memory_order_acquire);
+    if (seq == head)
+    {
+      if (atomic_compare_exchange_weak_explicit(&pr_log_sink.head, &head,
+						head + 1,
+						memory_order_relaxed,
+						memory_order_relaxed))
+	break;
+    }
+    else if (seq < head)
+    {
+      // Full, the writer has not logged this slot yet
+      if (level == PAPPL_LOGLEVEL_DEBUG)
+	atomic_fetch_add(&pr_log_sink.dropped_debug, 1);
+      else
+	atomic_fetch_add(&pr_log_sink.dropped, 1);
+      return;
+    }
+    else
+      head = atomic_load_explicit(&pr_log_sink.head, memory_order_relaxed);
+  }
+
+  entry->level  = level;
+  entry->job_id = papplJobGetID(job);
+  va_start(ap, message);
+  vsnprintf(entry->message, sizeof(entry->message), message, ap);
+  va_end(ap);
+
+  // Publish the message to the writer, sequentially consistent so that
+  // either the writer sees it before going to sleep or we see the
+  // writer sleeping
+  atomic_store(&entry->seq, head + 1);
+  pr_log_sink_wakeup();
+}
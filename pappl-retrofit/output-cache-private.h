@@ -0,0 +1,65 @@
+//
+// PPD/Classic CUPS driver retro-fit Printer Application Library
+// (libpappl-retrofit) for the Printer Application Framework (PAPPL)
+//
+// output-cache-private.h
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#ifndef _PAPPL_RETROFIT_OUTPUT_CACHE_H_
+#  define _PAPPL_RETROFIT_OUTPUT_CACHE_H_
+
+//
+// Include necessary headers...
+//
+
+#include <pappl-retrofit/pappl-retrofit.h>
+#include <pappl-retrofit/print-job-private.h>
+#include <pappl/pappl.h>
+
+
+//
+// C++ magic...
+//
+
+#  ifdef __cplusplus
+extern "C" {
+#  endif // __cplusplus
+
+
+//
+// Constants...
+//
+
+#define PR_OUTPUT_CACHE_KEY_SIZE 65	// SHA2-256 as hex string
+
+
+//
+// Functions...
+//
+
+extern void   _prOutputCacheInit(pr_printer_app_global_data_t *global_data);
+extern bool   _prOutputCacheKey(pappl_job_t *job, pr_job_data_t *job_data,
+				int fd, const char *filter_path,
+				char *key, size_t keysize);
+extern int    _prOutputCacheOpen(pr_printer_app_global_data_t *global_data,
+				 const char *key);
+extern void   _prOutputCacheTempName(pr_printer_app_global_data_t *global_data,
+				     const char *key, pappl_job_t *job,
+				     char *filename, size_t filenamesize);
+extern void   _prOutputCacheStore(pr_printer_app_global_data_t *global_data,
+				  const char *key, const char *tempname);
+
+
+//
+// C++ magic...
+//
+
+#  ifdef __cplusplus
+}
+#  endif // __cplusplus
+
+
+#endif // !_PAPPL_RETROFIT_OUTPUT_CACHE_H_
@@ -0,0 +1,406 @@
+//
+// PPD/Classic CUPS driver retro-fit Printer Application Library
+// (libpappl-retrofit) for the Printer Application Framework (PAPPL)
+//
+// output-cache.c
+//
+// Cache of print-ready output of jobs printed in spooling mode, so
+// that the same document sent repeatedly with the same options only
+// gets rendered once.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+//
+// Include necessary headers...
+//
+
+#include <pappl-retrofit/output-cache-private.h>
+#include <pappl-retrofit/pappl-retrofit-private.h>
+#include <pappl-retrofit/libcups2-private.h>
+#include <cups/dir.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+
+//
+// Types...
+//
+
+typedef struct pr_cache_entry_s		// Cache file, for eviction
+{
+  char   name[256];			// File name
+  off_t  size;				// Size
+  time_t used;				// Time of last use
+} pr_cache_entry_t;
+
+
+//
+// 'pr_compare_entries()' - Sort cache entries by time of last use.
+//
+
+static int				// O - Result of comparison
+pr_compare_entries(const void *a,	// I - First entry
+		   const void *b)	// I - Second entry
+{
+  time_t ta = ((const pr_cache_entry_t *)a)->used,
+         tb = ((const pr_cache_entry_t *)b)->used;
+
+  return (ta < tb ? -1 : ta > tb ? 1 : 0);
+}
+
+
+//
+// 'pr_compare_options()' - Sort options by name.
+//
+
+static int				// O - Result of comparison
+pr_compare_options(const void *a,	// I - First option
+		   const void *b)	// I - Second option
+{
+  return (strcmp((*(cups_option_t * const *)a)->name,
+		 (*(cups_option_t * const *)b)->name));
+}
+
+
+//
+// 'pr_output_cache_evict()' - Remove the least recently used files
+//                             from the cache until it fits into its
+//                             size limit. Also removes temporary
+//                             files of jobs which did not complete.
+//                             To be called with the cache mutex
+//                             locked.
+//
+
+static void
+pr_output_cache_evict(pr_printer_app_global_data_t *global_data,
+					// I - Global data
+		      bool startup)	// I - Remove all temporary files?
+{
+  cups_dir_t       *dir;		// Cache directory
+  cups_dentry_t    *dent;		// Directory entry
+  pr_cache_entry_t *entries = NULL,	// Cache files
+                   *temp;
+  int              num_entries = 0,
+                   alloc_entries = 0,
+                   i;
+  off_t            total = 0;		// Total size of cache
+  char             filename[2048];
+
+
+  if ((dir = cupsDirOpen(global_data->output_cache_dir)) == NULL)
+    return;
+
+  while ((dent = cupsDirRead(dir)) != NULL)
+  {
+    if (!S_ISREG(dent->fileinfo.st_mode))
+      continue;
+    if (strstr(dent->filename, ".tmp"))
+    {
+      // Temporary file of a job being rendered, leftovers from an
+      // earlier run get removed
+      if (startup)
+      {
+	snprintf(filename, sizeof(filename), "%s/%s",
+		 global_data->output_cache_dir, dent->filename);
+	unlink(filename);
+      }
+      continue;
+    }
+    if (num_entries >= alloc_entries)
+    {
+      alloc_entries += 64;
+      if ((temp = (pr_cache_entry_t *)
+	   realloc(entries, (size_t)alloc_entries *
+		   sizeof(pr_cache_entry_t))) == NULL)
+	break;
+      entries = temp;
+    }
+    snprintf(entries[num_entries].name, sizeof(entries[0].name), "%s",
+	     dent->filename);
+    entries[num_entries].size = dent->fileinfo.st_size;
+    entries[num_entries].used = dent->fileinfo.st_mtime;
+    total += dent->fileinfo.st_size;
+    num_entries ++;
+  }
+  cupsDirClose(dir);
+
+  if (total > (off_t)global_data->output_cache_size)
+  {
+    qsort(entries, (size_t)num_entries, sizeof(pr_cache_entry_t),
+	  pr_compare_entries);
+    for (i = 0;
+	 i < num_entries && total > (off_t)global_data->output_cache_size;
+	 i ++)
+    {
+      snprintf(filename, sizeof(filename), "%s/%s",
+	       global_data->output_cache_dir, entries[i].name);
+      if (unlink(filename) == 0)
+      {
+	total -= entries[i].size;
+	papplLog(global_data->system, PAPPL_LOGLEVEL_DEBUG,
+		 "Output cache: Evicted %s (%ld bytes)", entries[i].name,
+		 (long)entries[i].size);
+      }
+    }
+  }
+
+  free(entries);
+}
+
+
+//
+// '_prOutputCacheInit()' - Create the cache directory if the cache is
+//                          enabled and clean it up.
+//
+
+void
+_prOutputCacheInit(pr_printer_app_global_data_t *global_data)
+					// I - Global data
+{
+  if (!global_data->output_cache_size)
+    return;
+
+  pthread_mutex_init(&global_data->output_cache_mutex, NULL);
+
+  if (mkdir(global_data->output_cache_dir, 0700) && errno != EEXIST)
+  {
+    papplLog(global_data->system, PAPPL_LOGLEVEL_ERROR,
+	     "Unable to create output cache directory %s: %s",
+	     global_data->output_cache_dir, strerror(errno));
+    global_data->output_cache_size = 0;
+    return;
+  }
+
+  papplLog(global_data->system, PAPPL_LOGLEVEL_INFO,
+	   "Caching print-ready output of jobs in %s, up to %ld KB",
+	   global_data->output_cache_dir,
+	   (long)(global_data->output_cache_size / 1024));
+
+  pthread_mutex_lock(&global_data->output_cache_mutex);
+  pr_output_cache_evict(global_data, true);
+  pthread_mutex_unlock(&global_data->output_cache_mutex);
+}
+
+
+//
+// '_prOutputCacheKey()' - Compute the cache key for a job: SHA2-256
+//                         hash of the input file content, the
+//                         printer's driver and PPD file, and the
+//                         options handed to the filters, sorted by
+//                         name and without the ones which differ for
+//                         every job. Returns false if the cache is
+//                         disabled or the job's output must not be
+//                         cached (banner pages and PPDs with JCL, as
+//                         they contain the job ID).
+//
+
+bool					// O - Job can be cached?
+_prOutputCacheKey(pappl_job_t   *job,	// I - Job
+		  pr_job_data_t *job_data,
+					// I - Job data
+		  int           fd,	// I - Input file
+		  const char    *filter_path,
+					// I - Filter from PPD
+		  char          *key,	// O - Cache key
+		  size_t        keysize)// I - Size of key buffer
+{
+  pr_printer_app_global_data_t *global_data = job_data->global_data;
+  cf_filter_data_t *filter_data = job_data->filter_data;
+  struct stat      fileinfo;		// Input file information
+  void             *data;		// Mapped input file
+  cups_option_t    **sorted;		// Options sorted by name
+  unsigned char    hash[32];		// SHA2-256 hash
+  char             *buf = NULL;		// Data to be hashed for key
+  size_t           buflen = 0;
+  FILE             *fp;
+  cups_file_t      *ppdfp;		// PPD file
+  char             line[1024];
+  ssize_t          bytes;
+  int              i;
+  static const char * const volatile_options[] =
+  {					// Options which differ for every
+					// job but do not go into the output
+    "job-uuid",
+    "job-originating-host-name",
+    "time-at-creation",
+    "time-at-processing"
+  };
+
+
+  key[0] = '\0';
+
+#ifndef HAVE_OPEN_MEMSTREAM
+  // We need open_memstream() to collect the data for the key
+  return (false);
+#endif // !HAVE_OPEN_MEMSTREAM
+
+  if (!global_data->output_cache_size ||
+      strcmp(filter_data->content_type,
+	     "application/vnd.cups-pdf-banner") == 0 ||
+      job_data->ppd->jcl_begin)
+    return (false);
+
+  if (fstat(fd, &fileinfo) || !S_ISREG(fileinfo.st_mode) ||
+      fileinfo.st_size <= 0)
+    return (false);
+
+  if ((fp = open_memstream(&buf, &buflen)) == NULL)
+    return (false);
+
+  // Input file content
+  if ((data = mmap(NULL, (size_t)fileinfo.st_size, PROT_READ, MAP_SHARED,
+		   fd, 0)) == MAP_FAILED)
+  {
+    fclose(fp);
+    free(buf);
+    return (false);
+  }
+  bytes = cupsHashData("sha2-256", data, (size_t)fileinfo.st_size, hash,
+		       sizeof(hash));
+  munmap(data, (size_t)fileinfo.st_size);
+  if (bytes < 0)
+  {
+    fclose(fp);
+    free(buf);
+    return (false);
+  }
+  fprintf(fp, "input=%s\n",
+	  cupsHashString(hash, (size_t)bytes, line, sizeof(line)));
+
+  // Driver, PPD file and the filters
+  fprintf(fp, "driver=%s\n",
+	  papplPrinterGetDriverName(papplJobGetPrinter(job)));
+  if (job_data->temp_ppd_name &&
+      (ppdfp = cupsFileOpen(job_data->temp_ppd_name, "r")) != NULL)
+  {
+    while (cupsFileGets(ppdfp, line, sizeof(line)))
+      fprintf(fp, "ppd=%s\n", line);
+    cupsFileClose(ppdfp);
+  }
+  fprintf(fp, "format=%s\nfinal-format=%s\nfilter=%s\ncopies=%d\n",
+	  filter_data->content_type, filter_data->final_content_type,
+	  filter_path, filter_data->copies);
+  fprintf(fp, "user=%s\ntitle=%s\n",
+	  filter_data->job_user ? filter_data->job_user : "",
+	  filter_data->job_title ? filter_data->job_title : "");
+
+  // Options, normalized
+  if (filter_data->num_options > 0 &&
+      (sorted = (cups_option_t **)calloc((size_t)filter_data->num_options,
+					 sizeof(cups_option_t *))) != NULL)
+  {
+    for (i = 0; i < filter_data->num_options; i ++)
+      sorted[i] = filter_data->options + i;
+    qsort(sorted, (size_t)filter_data->num_options, sizeof(cups_option_t *),
+	  pr_compare_options);
+    for (i = 0; i < filter_data->num_options; i ++)
+    {
+      size_t j;
+
+      for (j = 0;
+	   j < sizeof(volatile_options) / sizeof(volatile_options[0]);
+	   j ++)
+	if (strcmp(sorted[i]->name, volatile_options[j]) == 0)
+	  break;
+      if (j < sizeof(volatile_options) / sizeof(volatile_options[0]))
+	continue;
+      fprintf(fp, "option:%s=%s\n", sorted[i]->name, sorted[i]->value);
+    }
+    free(sorted);
+  }
+
+  fclose(fp);
+
+  bytes = cupsHashData("sha2-256", buf, buflen, hash, sizeof(hash));
+  free(buf);
+  if (bytes < 0)
+    return (false);
+  cupsHashString(hash, (size_t)bytes, key, keysize);
+
+  return (key[0] != '\0');
+}
+
+
+//
+// '_prOutputCacheOpen()' - Open the cached output for the given key,
+//                          returns -1 if it is not in the cache. The
+//                          modification time of the file gets
+//                          updated, to record its use for the LRU
+//                          eviction.
+//
+
+int					// O - File descriptor or -1
+_prOutputCacheOpen(pr_printer_app_global_data_t *global_data,
+					// I - Global data
+		   const char *key)	// I - Cache key
+{
+  char filename[2048];			// Cache file
+  int  fd;
+
+
+  snprintf(filename, sizeof(filename), "%s/%s.prn",
+	   global_data->output_cache_dir, key);
+
+  pthread_mutex_lock(&global_data->output_cache_mutex);
+  if ((fd = open(filename, O_RDONLY)) >= 0)
+    futimens(fd, NULL);
+  pthread_mutex_unlock(&global_data->output_cache_mutex);
+
+  return (fd);
+}
+
+
+//
+// '_prOutputCacheTempName()' - File name for output of a job which
+//                              is going into the cache once the job
+//                              is complete.
+//
+
+void
+_prOutputCacheTempName(pr_printer_app_global_data_t *global_data,
+					// I - Global data
+		       const char *key,	// I - Cache key
+		       pappl_job_t *job,// I - Job
+		       char *filename,	// O - File name
+		       size_t filenamesize)
+					// I - Size of file name buffer
+{
+  snprintf(filename, filenamesize, "%s/%s.tmp-%s-%d",
+	   global_data->output_cache_dir, key,
+	   papplPrinterGetName(papplJobGetPrinter(job)), papplJobGetID(job));
+}
+
+
+//
+// '_prOutputCacheStore()' - Put the output of a successfully
+//                           completed job into the cache and remove
+//                           the least recently used files if the
+//                           cache gets too large. If the temporary
+//                           file is missing, as writing it failed, the
+//                           cache is left as it is.
+//
+
+void
+_prOutputCacheStore(pr_printer_app_global_data_t *global_data,
+					// I - Global data
+		    const char *key,	// I - Cache key
+		    const char *tempname)
+					// I - Temporary file with output
+{
+  char filename[2048];			// Cache file
+
+
+  snprintf(filename, sizeof(filename), "%s/%s.prn",
+	   global_data->output_cache_dir, key);
+
+  pthread_mutex_lock(&global_data->output_cache_mutex);
+  if (rename(tempname, filename) == 0)
+  {
+    papplLog(global_data->system, PAPPL_LOGLEVEL_DEBUG,
+	     "Output cache: Added %s.prn", key);
+    pr_output_cache_evict(global_data, false);
+  }
+  pthread_mutex_unlock(&global_data->output_cache_mutex);
+}
@@ -24,6 +24,16 @@
 
 #include <pappl-retrofit/pappl-retrofit.h>
 #include <pappl-retrofit/print-job-private.h>
+#include <pappl-retrofit/filter-plugin-private.h>
+#include <pappl-retrofit/filter-stats-private.h>
+#include <pappl-retrofit/governor-private.h>
+#include <pappl-retrofit/intermediate-private.h>
+#include <pappl-retrofit/log-sink-private.h>
+#include <pappl-retrofit/output-cache-private.h>
+#include <pappl-retrofit/preflight-private.h>
+#include <pappl-retrofit/prerender-private.h>
+#include <pappl-retrofit/render-pool-private.h>
+#include <pappl-retrofit/resume-private.h>
 #include <pappl-retrofit/cups-backends-private.h>
 #include <pappl-retrofit/cups-side-back-channel-private.h>
 #include <pappl-retrofit/web-interface-private.h>
@@ -65,6 +75,31 @@ typedef struct ipp_name_lookup_s        // Entry for PPD/IPP option name
 
 // Additional driver data specific to the CUPS-driver retro-fitting
 // printer applications
+typedef struct pr_conversion_alternative_s // Spooling conversion suitable
+					// for an input format
+{
+  pr_spooling_conversion_t *conversion; // Spooling conversion
+  char       *filter_path;              // CUPS filter from the PPD file
+  char       key[256];                  // Input and output format and
+                                        // filters, to identify the
+                                        // conversion in the statistics
+} pr_conversion_alternative_t;
+
+typedef struct pr_conversion_route_s	// How to print an input format in
+					// spooling mode
+{
+  const char *srctype;                  // Input format
+  pr_spooling_conversion_t *conversion; // Spooling conversion to use, NULL
+                                        // if the format is not supported
+  char       *filter_path;              // CUPS filter from the PPD file
+  int        num_alternatives;          // Number of suitable conversions
+  pr_conversion_alternative_t *alternatives; // Suitable conversions in
+                                        // order of priority, the first one
+                                        // is the one above
+  int        jobs;                      // Jobs printed via this route, for
+                                        // exploring the alternatives
+} pr_conversion_route_t;
+
 typedef struct pr_driver_extension_s	// Driver data extension
 {
   ppd_file_t *ppd;                      // PPD file loaded from collection
@@ -93,6 +128,20 @@ typedef struct pr_driver_extension_s	// Driver data extension
                                         // raster input
   char       *temp_ppd_name;            // File name of temporary copy of the
                                         // PPD file to be used by CUPS filters
+  int        num_routes;                // Number of input formats in routing
+  pr_conversion_route_t *routes;        // Routing table for spooling mode
+  time_t     routes_mtime;              // Modification time of filter
+                                        // directory when table got built
+  pthread_mutex_t routes_mutex;         // Lock for the routing table, jobs
+                                        // only get copies of its entries
+  ipp_t      *filter_printer_attrs;     // Printer attributes derived from
+                                        // the PPD by ppdFilterLoadPPD(),
+                                        // each job's filters get a copy,
+                                        // NULL until the first job
+  pthread_mutex_t attrs_mutex;          // Lock for filter_printer_attrs
+  pr_driver_stats_t stats;              // Filter chain statistics of the
+                                        // printer's jobs
+  pr_prerender_queue_t prerender;       // Jobs rendered ahead of time
   bool       updated;                   // Is the driver data updated for
                                         // "Installable Options" changes?
   pr_printer_app_global_data_t *global_data; // Global data
@@ -140,9 +189,130 @@ struct pr_printer_app_global_data_s
                                          // added by the user are held
   char              spool_dir[1024];     // Spool directory, customizable via
                                          // SPOOL_DIR environment variable
+  size_t            device_buffer_size;  // Memory budget for buffering job
+                                         // output to slow devices,
+                                         // customizable via
+                                         // DEVICE_BUFFER_SIZE environment
+                                         // variable (in KB)
+  int               spool_cleanup_interval;// Interval of spool janitor runs
+                                         // (seconds), customizable via
+                                         // SPOOL_CLEANUP_INTERVAL
+                                         // environment variable
+  int               debug_copy_max_age;  // Age after which debug copies
+                                         // get removed (seconds),
+                                         // customizable via
+                                         // DEBUG_COPY_MAX_AGE environment
+                                         // variable
+  cups_array_t      *debug_copies;       // Debug copy files created, for
+                                         // the spool janitor
+  pthread_mutex_t   debug_copies_mutex;  // Lock for list of debug copies
+  size_t            output_cache_size;   // Size limit for cache of
+                                         // print-ready job output, 0 for no
+                                         // cache, customizable via
+                                         // OUTPUT_CACHE_SIZE environment
+                                         // variable (in MB)
+  char              output_cache_dir[1024];// Directory of output cache,
+                                         // customizable via
+                                         // OUTPUT_CACHE_DIR environment
+                                         // variable
+  pthread_mutex_t   output_cache_mutex;  // Lock for output cache
+  int               render_workers;      // Maximum processes to render a
+                                         // large job page-parallel, 1 for
+                                         // no parallel rendering,
+                                         // customizable via RENDER_WORKERS
+                                         // environment variable
+  int               render_pool_size;    // Number of long-lived render
+                                         // worker processes, 0 for none,
+                                         // customizable via
+                                         // RENDER_POOL_SIZE environment
+                                         // variable
+  int               render_pool_max_jobs;// Jobs after which a render worker
+                                         // gets replaced, customizable via
+                                         // RENDER_POOL_MAX_JOBS environment
+                                         // variable
+  int               render_pool_fds[2];  // Socket pair to hand jobs over to
+                                         // the render workers
+  pid_t             render_pool_supervisor;
+                                         // Process which starts the render
+                                         // workers and replaces exited ones
+  int               prerender_depth;     // Queued jobs to render ahead of
+                                         // time while a job is printing, 0
+                                         // for none, customizable via
+                                         // PRERENDER_DEPTH environment
+                                         // variable
+  size_t            prerender_size;      // Disk budget for jobs rendered
+                                         // ahead of time, customizable via
+                                         // PRERENDER_SIZE environment
+                                         // variable (in MB)
+  size_t            intermediate_mem_size;// Memory limit for intermediate
+                                         // files, larger ones go to the
+                                         // spool directory, 0 for always
+                                         // on disk, customizable via
+                                         // INTERMEDIATE_MEM_SIZE
+                                         // environment variable (in MB)
+  bool              adaptive_conversions;// Choose among the suitable
+                                         // spooling conversions by their
+                                         // measured cost instead of by
+                                         // priority, customizable via
+                                         // CONVERSION_POLICY environment
+                                         // variable
+  int               conversion_explore_interval;// Every how many jobs of
+                                         // an input format an alternative
+                                         // conversion gets tried, 0 for
+                                         // never, customizable via
+                                         // CONVERSION_EXPLORE_INTERVAL
+                                         // environment variable
+  int               render_max_chains;   // Maximum concurrent render
+                                         // chains of all printers, 0 for
+                                         // no limit, -1 for one per CPU,
+                                         // customizable via
+                                         // RENDER_MAX_CHAINS environment
+                                         // variable
+  size_t            render_memory_budget;// Memory for all render chains
+                                         // together, 0 for no limit,
+                                         // customizable via
+                                         // RENDER_MEMORY_BUDGET
+                                         // environment variable (in MB)
+  size_t            render_chain_memory; // Memory assumed for one render
+                                         // chain, customizable via
+                                         // RENDER_CHAIN_MEMORY environment
+                                         // variable (in MB)
+  bool              render_small_jobs_first;// Give free render slots to
+                                         // small jobs first, customizable
+                                         // via RENDER_SMALL_JOBS_FIRST
+                                         // environment variable
+  pr_governor_t     governor;            // Render slots
+  bool              resume_jobs;         // Resume jobs after the connection
+                                         // to a printer on a CUPS backend
+                                         // got lost, customizable via
+                                         // RESUME_JOBS environment variable
+  pr_backend_session_mode_t backend_session_mode;// When to send several
+                                         // jobs through one run of a CUPS
+                                         // backend, customizable via
+                                         // BACKEND_SESSIONS environment
+                                         // variable
+  int               backend_session_max_jobs;// Jobs sent through one run
+                                         // of a CUPS backend, customizable
+                                         // via BACKEND_SESSION_MAX_JOBS
+                                         // environment variable
+  int               backend_session_idle_timeout;// Seconds a CUPS backend
+                                         // keeps running waiting for the
+                                         // next job, customizable via
+                                         // BACKEND_SESSION_IDLE_TIMEOUT
+                                         // environment variable
+  pr_preflight_t    preflight[PR_PREFLIGHT_MAX_JOBS];
+                                         // Page counts and costs of the
+                                         // most recently queued jobs
+  int               num_preflight;       // Number of preflight results
+  pthread_mutex_t   preflight_mutex;     // Lock for preflight results
   char              filter_dir[1024];    // Filter directory, customizable
                                          // via FILTER_DIR environment
                                          // variable
+  bool              filter_plugins_enabled;// Run CUPS filters provided as
+                                         // shared object in-process,
+                                         // customizable via FILTER_PLUGINS
+                                         // environment variable
+  pr_filter_plugins_t filter_plugins;    // Filter plugins loaded
   char              backend_dir[1024];   // Backend directory, customizable
                                          // via BACKEND_DIR environment
                                          // variable
@@ -167,6 +337,13 @@ extern char   *_prCUPSFilterPath(const char *filter,
 extern char   *_prPPDFindCUPSFilter(const char *input_format,
 				    int num_filters, char **filters,
 				    const char *filter_dir);
+extern void   _prBuildConversionRoutes(pr_driver_extension_t *extension);
+extern bool   _prFindConversionRoute(pr_driver_extension_t *extension,
+				     const char *informat);
+extern bool   _prChooseConversion(pr_driver_extension_t *extension,
+				  const char *informat, pappl_job_t *job,
+				  pr_conversion_alternative_t *choice);
+extern void   _prFreeConversionRoutes(pr_driver_extension_t *extension);
 extern char   *_prPPDMissingFilters(int num_filters, char **filters,
 				    const char *filter_dir);
 extern bool   _prStrHasCode(const char *str);
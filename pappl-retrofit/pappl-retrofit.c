@@ -70,6 +70,23 @@ prRetroFitPrinterApp(pr_printer_app_config_t *printer_app_config,
 		      &global_data);   // Global data
 
   // Clean up
+  _prLogSinkFlush();
+  _prRenderPoolStop(&global_data);
+  if (global_data.debug_copies)
+  {
+    pr_debug_copy_t *debug_copy;
+    for (debug_copy =
+	   (pr_debug_copy_t *)cupsArrayGetFirst(global_data.debug_copies);
+	 debug_copy;
+	 debug_copy =
+	   (pr_debug_copy_t *)cupsArrayGetNext(global_data.debug_copies))
+    {
+      free(debug_copy->filename);
+      free(debug_copy);
+    }
+    cupsArrayDelete(global_data.debug_copies);
+    pthread_mutex_destroy(&global_data.debug_copies_mutex);
+  }
   cupsArrayDelete(global_data.config->spooling_conversions);
   cupsArrayDelete(global_data.config->stream_formats);
   if (global_data.config->driver_selection_regex_list)
@@ -731,6 +748,11 @@ _prDriverDelete(
       free((char *)(extension->vendor_ppd_options[i]));
   }
 
+  // Measurements of the spooling conversions not saved yet
+  if (printer && extension->global_data->adaptive_conversions)
+    _prDriverStatsSave(&extension->stats, printer,
+		       extension->global_data->state_dir);
+
   // Extension
   for (opt_name =
 	 (ipp_name_lookup_t *)cupsArrayGetFirst(extension->ipp_name_lookup);
@@ -753,6 +775,15 @@ _prDriverDelete(
   if (extension->num_inst_options)
     cupsFreeOptions(extension->num_inst_options, extension->inst_options);
   free(extension->stream_filter);
+  pthread_mutex_lock(&extension->routes_mutex);
+  _prFreeConversionRoutes(extension);
+  pthread_mutex_unlock(&extension->routes_mutex);
+  pthread_mutex_destroy(&extension->routes_mutex);
+  if (extension->filter_printer_attrs)
+    ippDelete(extension->filter_printer_attrs);
+  pthread_mutex_destroy(&extension->attrs_mutex);
+  _prDriverStatsFree(&extension->stats);
+  _prPrerenderFree(&extension->prerender);
   if (extension->temp_ppd_name)
   {
     unlink(extension->temp_ppd_name);
@@ -911,6 +942,310 @@ _prPPDFindCUPSFilter(const char *input_format, // I - Input data format
 }
 
 
+//
+// 'pr_build_conversion_routes()' - Build the routing table, with the
+//                                  lock of the table held.
+//
+
+static void
+pr_build_conversion_routes(
+    pr_driver_extension_t *extension)  // I - Driver extension
+{
+  pr_printer_app_global_data_t *global_data = extension->global_data;
+  ppd_file_t               *ppd = extension->ppd;
+  pr_spooling_conversion_t *conversion;
+  pr_conversion_route_t    *route;
+  pr_conversion_alternative_t *alternative;
+  struct stat              fileinfo;
+  char                     *filter_path,
+                           *ptr;
+  int                      i, num_conversions;
+
+
+  _prFreeConversionRoutes(extension);
+
+  if (stat(global_data->filter_dir, &fileinfo) == 0)
+    extension->routes_mtime = fileinfo.st_mtime;
+  else
+    extension->routes_mtime = 0;
+
+  num_conversions =
+    cupsArrayGetCount(global_data->config->spooling_conversions);
+  if ((extension->routes =
+       (pr_conversion_route_t *)
+       calloc((size_t)num_conversions + 1,
+	      sizeof(pr_conversion_route_t))) == NULL)
+    return;
+
+  for (conversion =
+	 (pr_spooling_conversion_t *)
+	 cupsArrayGetFirst(global_data->config->spooling_conversions);
+       conversion;
+       conversion =
+	 (pr_spooling_conversion_t *)
+	 cupsArrayGetNext(global_data->config->spooling_conversions))
+  {
+    // The first suitable conversion for an input format wins, the
+    // others are kept as alternatives for choosing by measured cost
+    for (i = 0; i < extension->num_routes; i ++)
+      if (strcmp(extension->routes[i].srctype, conversion->srctype) == 0)
+	break;
+    if (i < extension->num_routes)
+      route = extension->routes + i;
+    else
+    {
+      route = extension->routes + extension->num_routes;
+      route->srctype = conversion->srctype;
+      route->alternatives =
+	(pr_conversion_alternative_t *)
+	calloc((size_t)num_conversions, sizeof(pr_conversion_alternative_t));
+      extension->num_routes ++;
+    }
+
+    if (route->alternatives &&
+	(filter_path =
+	 _prPPDFindCUPSFilter(conversion->dsttype,
+			      ppd->num_filters, ppd->filters,
+			      global_data->filter_dir)) != NULL)
+    {
+      alternative = route->alternatives + route->num_alternatives ++;
+      alternative->conversion = conversion;
+      alternative->filter_path = filter_path;
+
+      // "srctype -> dsttype: filter | filter | PPD's filter"
+      snprintf(alternative->key, sizeof(alternative->key), "%s -> %s:",
+	       conversion->srctype, conversion->dsttype);
+      for (i = 0; i < conversion->num_filters; i ++)
+      {
+	ptr = alternative->key + strlen(alternative->key);
+	snprintf(ptr, sizeof(alternative->key) - (ptr - alternative->key),
+		 "%s %s", i ? " |" : "",
+		 conversion->filters[i].name ? conversion->filters[i].name :
+		 "?");
+      }
+      if (strlen(filter_path) > 1)
+      {
+	ptr = alternative->key + strlen(alternative->key);
+	snprintf(ptr, sizeof(alternative->key) - (ptr - alternative->key),
+		 " | %s", strrchr(filter_path, '/') ?
+		 strrchr(filter_path, '/') + 1 : filter_path);
+      }
+
+      if (!route->conversion)
+      {
+	route->conversion = conversion;
+	route->filter_path = filter_path;
+      }
+    }
+  }
+}
+
+
+//
+// '_prBuildConversionRoutes()' - Build the table which tells for each
+//                                input format of the spooling
+//                                conversions which conversion and
+//                                which CUPS filter from the PPD file
+//                                to use for printing with this
+//                                driver. This way we have to parse
+//                                the "*cupsFilter(2):" lines and look
+//                                for the filter executables only once
+//                                and not with every job. The table
+//                                depends on the contents of the
+//                                filter directory, so we remember the
+//                                modification time of it.
+//
+
+void
+_prBuildConversionRoutes(
+    pr_driver_extension_t *extension)  // I - Driver extension
+{
+  pthread_mutex_lock(&extension->routes_mutex);
+  pr_build_conversion_routes(extension);
+  pthread_mutex_unlock(&extension->routes_mutex);
+}
+
+
+//
+// 'pr_find_conversion_route()' - Look up the route of the given input
+//                                format, with the lock of the routing
+//                                table held. If the filter directory
+//                                got changed since the table was
+//                                built, the table gets re-built.
+//                                Returns NULL if the input format is
+//                                not supported.
+//
+
+static pr_conversion_route_t *         // O - Route or NULL
+pr_find_conversion_route(
+    pr_driver_extension_t *extension,  // I - Driver extension
+    const char            *informat)   // I - Input format
+{
+  struct stat fileinfo;
+  int         i;
+
+
+  if (!extension->routes ||
+      (stat(extension->global_data->filter_dir, &fileinfo) == 0 &&
+       fileinfo.st_mtime != extension->routes_mtime))
+    pr_build_conversion_routes(extension);
+
+  for (i = 0; i < extension->num_routes; i ++)
+    if (strcmp(extension->routes[i].srctype, informat) == 0)
+      return (extension->routes[i].conversion ? extension->routes + i : NULL);
+
+  return (NULL);
+}
+
+
+//
+// '_prFindConversionRoute()' - Check whether there is a spooling
+//                              conversion and a CUPS filter of the PPD
+//                              file for the given input format.
+//
+
+bool                                   // O - true if format supported
+_prFindConversionRoute(
+    pr_driver_extension_t *extension,  // I - Driver extension
+    const char            *informat)   // I - Input format
+{
+  bool ret;
+
+
+  pthread_mutex_lock(&extension->routes_mutex);
+  ret = (pr_find_conversion_route(extension, informat) != NULL);
+  pthread_mutex_unlock(&extension->routes_mutex);
+
+  return (ret);
+}
+
+
+//
+// '_prChooseConversion()' - Choose the spooling conversion for a job
+//                           among the suitable ones of its input
+//                           format. By default this is the first one,
+//                           in the order of the Printer Application's
+//                           configuration. With the adaptive policy
+//                           it is the one with the lowest CPU time per
+//                           page measured on recent jobs of this
+//                           printer, and every so many jobs the least
+//                           tried one, to learn its cost and to notice
+//                           when costs change. The routing table can
+//                           get re-built while the job is running, so
+//                           the job gets a copy of the chosen
+//                           conversion, the caller has to free its
+//                           filter_path. Returns false if the input
+//                           format is not supported.
+//
+
+bool                                   // O - true if conversion found
+_prChooseConversion(
+    pr_driver_extension_t *extension,  // I - Driver extension
+    const char            *informat,   // I - Input format
+    pappl_job_t           *job,        // I - Job
+    pr_conversion_alternative_t *choice) // O - Copy of conversion to use
+{
+  pr_printer_app_global_data_t *global_data = extension->global_data;
+  pr_conversion_route_t        *route;
+  pr_conversion_alternative_t  *alternative,
+                               *best,
+                               *explore = NULL;
+  double                       cost,
+                               best_cost = -1.0;
+  int                          i, jobs, num_jobs,
+                               explore_jobs = INT_MAX;
+
+
+  pthread_mutex_lock(&extension->routes_mutex);
+
+  if ((route = pr_find_conversion_route(extension, informat)) == NULL)
+  {
+    pthread_mutex_unlock(&extension->routes_mutex);
+    return (false);
+  }
+
+  best = route->alternatives;
+
+  if (global_data->adaptive_conversions && route->num_alternatives > 1)
+  {
+    _prDriverStatsLoad(&extension->stats, papplJobGetPrinter(job),
+		       global_data->state_dir);
+
+    num_jobs = ++ route->jobs;
+
+    for (i = 0, alternative = route->alternatives;
+	 i < route->num_alternatives;
+	 i ++, alternative ++)
+    {
+      cost = _prDriverStatsConversionCost(&extension->stats, alternative->key,
+					  &jobs);
+      if (jobs < explore_jobs)
+      {
+	explore = alternative;
+	explore_jobs = jobs;
+      }
+      // On equal cost the one with higher priority wins
+      if (jobs >= PR_CONVERSION_MIN_JOBS &&
+	  (best_cost < 0.0 || cost < best_cost))
+      {
+	best = alternative;
+	best_cost = cost;
+      }
+    }
+
+    if (global_data->conversion_explore_interval > 0 &&
+	num_jobs % global_data->conversion_explore_interval == 0 &&
+	explore && explore != best)
+    {
+      _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+		"Trying spooling conversion %s (measured on %d jobs)",
+		explore->key, explore_jobs);
+      best = explore;
+    }
+    else if (best_cost >= 0.0)
+      _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+		"Using spooling conversion %s, %.3f CPU seconds per page",
+		best->key, best_cost);
+  }
+
+  // The spooling conversions belong to the configuration and live as
+  // long as the Printer Application, only the filter path is owned by
+  // the table
+  *choice = *best;
+  choice->filter_path = strdup(best->filter_path);
+
+  pthread_mutex_unlock(&extension->routes_mutex);
+
+  return (choice->filter_path != NULL);
+}
+
+
+//
+// '_prFreeConversionRoutes()' - Free the routing table of a driver,
+//                               the caller holds the lock of the
+//                               table.
+//
+
+void
+_prFreeConversionRoutes(
+    pr_driver_extension_t *extension)  // I - Driver extension
+{
+  int i, j;
+
+
+  for (i = 0; i < extension->num_routes; i ++)
+  {
+    // The route's filter path is the one of its first alternative
+    for (j = 0; j < extension->routes[i].num_alternatives; j ++)
+      free(extension->routes[i].alternatives[j].filter_path);
+    free(extension->routes[i].alternatives);
+  }
+  free(extension->routes);
+  extension->routes = NULL;
+  extension->num_routes = 0;
+}
+
+
 //
 // '_prPPDMissingFilters()' - Check the strings of the
 //                            "*cupsFilter(2):" lines in a PPD file
@@ -1357,6 +1692,10 @@ _prDriverSetup(
     extension->updated              = false;
     extension->temp_ppd_name        = NULL;
     extension->global_data          = global_data;
+    pthread_mutex_init(&extension->routes_mutex, NULL);
+    pthread_mutex_init(&extension->attrs_mutex, NULL);
+    _prDriverStatsInit(&extension->stats);
+    _prPrerenderInit(&extension->prerender);
     driver_data->delete_cb          = _prDriverDelete;
     driver_data->identify_cb        = global_data->config->identify_cb;
     driver_data->identify_default   = PAPPL_IDENTIFY_ACTIONS_SOUND;
@@ -1479,6 +1818,9 @@ _prDriverSetup(
 
     extension->stream_filter = ptr;
     extension->stream_format = stream_format;
+
+    // Routing of input formats for printing in spooling mode
+    _prBuildConversionRoutes(extension);
     driver_data->rendjob_cb    = stream_format->rendjob_cb;
     driver_data->rendpage_cb   = stream_format->rendpage_cb;
     driver_data->rstartjob_cb  = stream_format->rstartjob_cb;
@@ -1497,6 +1839,17 @@ _prDriverSetup(
     pc = ppd->cache;
     extension->updated = true;
 
+    // Printer attributes of the filters have to reflect the new
+    // settings, let the next job derive them again, running jobs have
+    // their own copies
+    pthread_mutex_lock(&extension->attrs_mutex);
+    if (extension->filter_printer_attrs)
+    {
+      ippDelete(extension->filter_printer_attrs);
+      extension->filter_printer_attrs = NULL;
+    }
+    pthread_mutex_unlock(&extension->attrs_mutex);
+
     // We are in Update mode
     update = true;
   }
@@ -3794,7 +4147,8 @@ prSetupAddPPDFilesPage (void *data)  // I - Global data
 // 'prSetupDeviceSettingsPage()' - Add web admin interface page for
 //                                 device settings: Installable
 //                                 accessories and polling PostScript
-//                                 option defaults
+//                                 option defaults, and the page
+//                                 with the filter chain statistics
 //
 
 void
@@ -3836,6 +4190,13 @@ prSetupDeviceSettingsPage(pappl_printer_t *printer, // I - Printer
     papplPrinterAddLink(printer, "Device Settings", path,
 			PAPPL_LOPTIONS_NAVIGATION | PAPPL_LOPTIONS_STATUS);
   }
+
+  papplPrinterGetPath(printer, "filterstats", path, sizeof(path));
+  papplSystemAddResourceCallback(system, path, "text/html",
+			     (pappl_resource_cb_t)_prPrinterWebFilterStats,
+			     printer);
+  papplPrinterAddLink(printer, "Filter Statistics", path,
+		      PAPPL_LOPTIONS_STATUS);
 }
 
 
@@ -4282,10 +4643,62 @@ _prSetup(pr_printer_app_global_data_t *global_data)  // I - Global data
 
 
   //
-  // Clean up debug copy files of jobs in spool directory
+  // Job log messages get written by a separate thread
+  //
+
+  _prLogSinkInit(system);
+
+  //
+  // Clean up debug copy files of jobs in spool directory left over from
+  // earlier runs, the ones of our jobs get removed periodically by the
+  // spool janitor
   //
 
   _prCleanDebugCopies(global_data);
+  pthread_mutex_init(&global_data->debug_copies_mutex, NULL);
+  global_data->debug_copies = cupsArrayNew(NULL, NULL, NULL, 0, NULL, NULL);
+  papplSystemAddTimerCallback(system,
+			      time(NULL) + global_data->spool_cleanup_interval,
+			      global_data->spool_cleanup_interval,
+			      _prSpoolJanitor, global_data);
+
+  //
+  // Cache for print-ready output of jobs, if enabled
+  //
+
+  _prOutputCacheInit(global_data);
+
+  //
+  // Render slots shared by all printers
+  //
+
+  _prGovernorInit(global_data);
+
+  //
+  // Measurements of the spooling conversions get saved periodically
+  // for the next session, only needed for choosing conversions by
+  // their cost
+  //
+
+  if (global_data->adaptive_conversions)
+    papplSystemAddTimerCallback(system, time(NULL) + PR_STATS_SAVE_INTERVAL,
+				PR_STATS_SAVE_INTERVAL,
+				_prDriverStatsSaveTimer, global_data);
+
+  //
+  // CUPS filters provided as shared objects, loaded on first use
+  //
+
+  _prFilterPluginInit(global_data);
+
+  //
+  // Count the pages of newly queued jobs right away, for accurate
+  // "job-impressions" and job cost estimates
+  //
+
+  pthread_mutex_init(&global_data->preflight_mutex, NULL);
+  global_data->num_preflight = 0;
+  papplSystemSetEventCallback(system, _prPreflightEvent, global_data);
 
   //
   // Create PPD collection index data structure
@@ -4391,6 +4804,13 @@ _prSetup(pr_printer_app_global_data_t *global_data)  // I - Global data
 			 _prCUPSDevWrite, _prCUPSDevStatus,
 			 _prCUPSDevID);
   }
+
+  //
+  // Start the render workers, if configured, we are not running any
+  // threads yet
+  //
+
+  _prRenderPoolStart(global_data);
 }
 
 
@@ -4700,6 +5120,173 @@ _prSystemCB(int            num_options,	// I - Number of options
     snprintf(global_data->spool_dir, sizeof(global_data->spool_dir),
 	     "/var/spool/%s", global_data->config->system_package_name);
 
+  // Memory budget for buffering job output to slow devices (in KB)
+  if ((val = cupsGetOption("device-buffer-size", num_options, options)) !=
+      NULL ||
+      (val = getenv("DEVICE_BUFFER_SIZE")) != NULL)
+    global_data->device_buffer_size = (size_t)strtoul(val, NULL, 10) * 1024;
+  else if (!global_data->device_buffer_size)
+    global_data->device_buffer_size = PR_DEVICE_BUFFER_SIZE_DEFAULT;
+
+  // Spool janitor: How often to run and when to remove debug copies
+  // (in seconds)
+  if ((val = cupsGetOption("spool-cleanup-interval", num_options, options)) !=
+      NULL ||
+      (val = getenv("SPOOL_CLEANUP_INTERVAL")) != NULL)
+    global_data->spool_cleanup_interval = atoi(val);
+  if (global_data->spool_cleanup_interval <= 0)
+    global_data->spool_cleanup_interval = PR_SPOOL_CLEANUP_INTERVAL_DEFAULT;
+  if ((val = cupsGetOption("debug-copy-max-age", num_options, options)) !=
+      NULL ||
+      (val = getenv("DEBUG_COPY_MAX_AGE")) != NULL)
+    global_data->debug_copy_max_age = atoi(val);
+  if (global_data->debug_copy_max_age <= 0)
+    global_data->debug_copy_max_age = PR_DEBUG_COPY_MAX_AGE_DEFAULT;
+
+  // Cache for print-ready output of jobs (size in MB, 0 = no cache)
+  if ((val = cupsGetOption("output-cache-size", num_options, options)) !=
+      NULL ||
+      (val = getenv("OUTPUT_CACHE_SIZE")) != NULL)
+    global_data->output_cache_size =
+      (size_t)strtoul(val, NULL, 10) * 1024 * 1024;
+  if ((val = cupsGetOption("output-cache-directory", num_options, options)) !=
+      NULL ||
+      (val = getenv("OUTPUT_CACHE_DIR")) != NULL)
+    snprintf(global_data->output_cache_dir,
+	     sizeof(global_data->output_cache_dir), "%s", val);
+  else if (!global_data->output_cache_dir[0])
+    snprintf(global_data->output_cache_dir,
+	     sizeof(global_data->output_cache_dir), "%s/output-cache",
+	     global_data->spool_dir);
+
+  // Page-parallel rendering of large jobs
+  if ((val = cupsGetOption("render-workers", num_options, options)) != NULL ||
+      (val = getenv("RENDER_WORKERS")) != NULL)
+    global_data->render_workers = atoi(val);
+  if (global_data->render_workers < 1)
+    global_data->render_workers = 1;
+
+  // System-wide limit of concurrent render chains: One per CPU, as
+  // far as the memory budget (default half of the physical memory)
+  // allows
+  if ((val = cupsGetOption("render-max-chains", num_options, options)) !=
+      NULL ||
+      (val = getenv("RENDER_MAX_CHAINS")) != NULL)
+    global_data->render_max_chains = atoi(val);
+  else
+    global_data->render_max_chains = -1;
+  if (global_data->render_max_chains < -1)
+    global_data->render_max_chains = -1;
+  if ((val = cupsGetOption("render-memory-budget", num_options, options)) !=
+      NULL ||
+      (val = getenv("RENDER_MEMORY_BUDGET")) != NULL)
+    global_data->render_memory_budget =
+      (size_t)strtoul(val, NULL, 10) * 1024 * 1024;
+  else if (sysconf(_SC_PHYS_PAGES) > 0 && sysconf(_SC_PAGESIZE) > 0)
+    global_data->render_memory_budget =
+      (size_t)sysconf(_SC_PHYS_PAGES) * (size_t)sysconf(_SC_PAGESIZE) / 2;
+  if ((val = cupsGetOption("render-chain-memory", num_options, options)) !=
+      NULL ||
+      (val = getenv("RENDER_CHAIN_MEMORY")) != NULL)
+    global_data->render_chain_memory =
+      (size_t)strtoul(val, NULL, 10) * 1024 * 1024;
+  if (global_data->render_chain_memory == 0)
+    global_data->render_chain_memory =
+      (size_t)PR_GOVERNOR_CHAIN_MEMORY_DEFAULT * 1024 * 1024;
+  if ((val = cupsGetOption("render-small-jobs-first", num_options,
+			   options)) != NULL ||
+      (val = getenv("RENDER_SMALL_JOBS_FIRST")) != NULL)
+    global_data->render_small_jobs_first =
+      (!strcasecmp(val, "yes") || !strcasecmp(val, "true") ||
+       !strcasecmp(val, "on") || atoi(val) > 0);
+
+  // Pool of long-lived render workers
+  if ((val = cupsGetOption("render-pool-size", num_options, options)) !=
+      NULL ||
+      (val = getenv("RENDER_POOL_SIZE")) != NULL)
+    global_data->render_pool_size = atoi(val);
+  if ((val = cupsGetOption("render-pool-max-jobs", num_options, options)) !=
+      NULL ||
+      (val = getenv("RENDER_POOL_MAX_JOBS")) != NULL)
+    global_data->render_pool_max_jobs = atoi(val);
+  if (global_data->render_pool_max_jobs <= 0)
+    global_data->render_pool_max_jobs = PR_RENDER_POOL_MAX_JOBS_DEFAULT;
+
+  // Rendering queued jobs ahead of time (disk budget in MB)
+  if ((val = cupsGetOption("prerender-depth", num_options, options)) !=
+      NULL ||
+      (val = getenv("PRERENDER_DEPTH")) != NULL)
+    global_data->prerender_depth = atoi(val);
+  if ((val = cupsGetOption("prerender-size", num_options, options)) !=
+      NULL ||
+      (val = getenv("PRERENDER_SIZE")) != NULL)
+    global_data->prerender_size = (size_t)strtoul(val, NULL, 10) * 1024 * 1024;
+  if (global_data->prerender_size == 0)
+    global_data->prerender_size = PR_PRERENDER_SIZE_DEFAULT;
+
+  // Choice among the suitable spooling conversions: "priority" (first
+  // one in the configuration) or "adaptive" (lowest measured cost)
+  if ((val = cupsGetOption("conversion-policy", num_options, options)) !=
+      NULL ||
+      (val = getenv("CONVERSION_POLICY")) != NULL)
+    global_data->adaptive_conversions = !strcasecmp(val, "adaptive");
+  if ((val = cupsGetOption("conversion-explore-interval", num_options,
+			   options)) != NULL ||
+      (val = getenv("CONVERSION_EXPLORE_INTERVAL")) != NULL)
+    global_data->conversion_explore_interval = atoi(val);
+  else
+    global_data->conversion_explore_interval =
+      PR_CONVERSION_EXPLORE_INTERVAL_DEFAULT;
+
+  // Resume jobs on CUPS backends after the connection to the printer
+  // got lost
+  if ((val = cupsGetOption("resume-jobs", num_options, options)) != NULL ||
+      (val = getenv("RESUME_JOBS")) != NULL)
+    global_data->resume_jobs =
+      (!strcasecmp(val, "yes") || !strcasecmp(val, "true") ||
+       !strcasecmp(val, "on") || atoi(val) > 0);
+
+  // Bursts of jobs sent through one run of the CUPS backend: "off",
+  // "jcl" (only for drivers framing each job with PJL), or "all"
+  if ((val = cupsGetOption("backend-sessions", num_options, options)) !=
+      NULL ||
+      (val = getenv("BACKEND_SESSIONS")) != NULL)
+  {
+    if (!strcasecmp(val, "all"))
+      global_data->backend_session_mode = PR_BACKEND_SESSION_ALL;
+    else if (!strcasecmp(val, "jcl") || !strcasecmp(val, "yes") ||
+	     !strcasecmp(val, "true") || !strcasecmp(val, "on") ||
+	     atoi(val) > 0)
+      global_data->backend_session_mode = PR_BACKEND_SESSION_JCL;
+    else
+      global_data->backend_session_mode = PR_BACKEND_SESSION_OFF;
+  }
+  if ((val = cupsGetOption("backend-session-max-jobs", num_options,
+			   options)) != NULL ||
+      (val = getenv("BACKEND_SESSION_MAX_JOBS")) != NULL)
+    global_data->backend_session_max_jobs = atoi(val);
+  if (global_data->backend_session_max_jobs <= 0)
+    global_data->backend_session_max_jobs =
+      PR_BACKEND_SESSION_MAX_JOBS_DEFAULT;
+  if ((val = cupsGetOption("backend-session-idle-timeout", num_options,
+			   options)) != NULL ||
+      (val = getenv("BACKEND_SESSION_IDLE_TIMEOUT")) != NULL)
+    global_data->backend_session_idle_timeout = atoi(val);
+  else
+    global_data->backend_session_idle_timeout =
+      PR_BACKEND_SESSION_IDLE_TIMEOUT_DEFAULT;
+  if (global_data->backend_session_idle_timeout < 0)
+    global_data->backend_session_idle_timeout = 0;
+
+  // Memory limit for intermediate files (in MB, 0 = always on disk)
+  if ((val = cupsGetOption("intermediate-mem-size", num_options, options)) !=
+      NULL ||
+      (val = getenv("INTERMEDIATE_MEM_SIZE")) != NULL)
+    global_data->intermediate_mem_size =
+      (size_t)strtoul(val, NULL, 10) * 1024 * 1024;
+  else
+    global_data->intermediate_mem_size = PR_INTERMEDIATE_MEM_SIZE_DEFAULT;
+
   // CUPS filter dir
   if ((val = cupsGetOption("filter-directory", num_options, options)) != NULL ||
       (val = getenv("FILTER_DIR")) != NULL)
@@ -4709,6 +5296,17 @@ _prSystemCB(int            num_options,	// I - Number of options
     snprintf(global_data->filter_dir, sizeof(global_data->filter_dir),
 	     "/usr/lib/%s/filter", global_data->config->system_package_name);
 
+  // Run CUPS filters which are also provided as shared object
+  // ("<filter>.so" in the filter directory) in-process
+  if ((val = cupsGetOption("filter-plugins", num_options, options)) !=
+      NULL ||
+      (val = getenv("FILTER_PLUGINS")) != NULL)
+    global_data->filter_plugins_enabled =
+      (!strcasecmp(val, "yes") || !strcasecmp(val, "true") ||
+       !strcasecmp(val, "on") || atoi(val) > 0);
+  else
+    global_data->filter_plugins_enabled = true;
+
   // Set CUPS_SERVERBIN (only if not already set and if FILTER_DIR ends
   // with "/filter"). This gives the best possible environment to the
   // CUPS filters when they are called out of the Printer Application.
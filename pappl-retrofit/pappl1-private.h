@@ -52,6 +52,10 @@
 #    define papplJobGetDocumentFilename(job, doc)  papplJobGetFilename(job)
 #    define papplJobGetDocumentFormat(job, doc)    papplJobGetFormat(job)
 
+//   PAPPL 1.4.x jobs always have exactly one document.
+
+#    define papplJobGetNumberOfDocuments(job)      1
+
 #  endif // HAVE_PAPPL1
 
 #endif // !_PAPPL1_PRIVATE_H_
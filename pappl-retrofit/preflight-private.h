@@ -0,0 +1,81 @@
+//
+// PPD/Classic CUPS driver retro-fit Printer Application Library
+// (libpappl-retrofit) for the Printer Application Framework (PAPPL)
+//
+// preflight-private.h
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#ifndef _PAPPL_RETROFIT_PREFLIGHT_H_
+#  define _PAPPL_RETROFIT_PREFLIGHT_H_
+
+//
+// Include necessary headers...
+//
+
+#include <pappl-retrofit/pappl-retrofit.h>
+#include <pappl/pappl.h>
+#include <sys/types.h>
+
+
+//
+// C++ magic...
+//
+
+#  ifdef __cplusplus
+extern "C" {
+#  endif // __cplusplus
+
+
+//
+// Constants...
+//
+
+#define PR_PREFLIGHT_MAX_JOBS	256	// Jobs we remember the preflight
+					// results of
+#define PR_PREFLIGHT_PAGE_BYTES	(64 * 1024)
+					// Assumed bytes per page if the page
+					// count is unknown
+#define PR_PREFLIGHT_PS_TAIL	65536	// Bytes at the end of a PostScript
+					// file searched for "%%Pages: N"
+
+
+//
+// Types...
+//
+
+typedef struct pr_preflight_s		// Preflight result of a job
+{
+  int            job_id;		// Job ID
+  int            pages;			// Pages, -1 if unknown
+  off_t          bytes;			// Size of the job's documents
+  double         cost;			// Estimated cost, in pages, -1.0
+					// while the preflight is running
+} pr_preflight_t;
+
+
+//
+// Functions...
+//
+
+extern int    _prPreflightPages(const char *filename, const char *format);
+extern double _prPreflightCost(int pages, off_t bytes);
+extern void   _prPreflightEvent(pappl_system_t *system,
+				pappl_printer_t *printer, pappl_job_t *job,
+				pappl_event_t event, void *data);
+extern double _prPreflightGetCost(pr_printer_app_global_data_t *global_data,
+				  int job_id);
+
+
+//
+// C++ magic...
+//
+
+#  ifdef __cplusplus
+}
+#  endif // __cplusplus
+
+
+#endif // !_PAPPL_RETROFIT_PREFLIGHT_H_
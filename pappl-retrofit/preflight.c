@@ -0,0 +1,481 @@
+//
+// PPD/Classic CUPS driver retro-fit Printer Application Library
+// (libpappl-retrofit) for the Printer Application Framework (PAPPL)
+//
+// preflight.c
+//
+// Preflight of queued jobs: Count the pages of a job's document
+// cheaply from its structure (PDF page tree, PostScript DSC comments,
+// raster headers) as soon as the job is queued, so that
+// "job-impressions" is correct before the job gets processed and the
+// cost of the job can be estimated.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+//
+// Include necessary headers...
+//
+
+#include <pappl-retrofit/pappl-retrofit-private.h>
+#include <pappl-retrofit/pappl1-private.h>
+#include <pappl-retrofit/libcups2-private.h>
+#include <cupsfilters/pdf.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+//
+// Types...
+//
+
+typedef struct pr_preflight_job_s	// Job to preflight
+{
+  pr_printer_app_global_data_t *global_data;
+					// Global data
+  int            printer_id;		// Printer ID
+  int            job_id;		// Job ID
+} pr_preflight_job_t;
+
+
+//
+// 'pr_find_string()' - Find a string in a memory buffer.
+//
+
+static const char *			// O - First match or NULL
+pr_find_string(const char *data,	// I - Buffer
+	       size_t     len,		// I - Length of buffer
+	       const char *s)		// I - String to find
+{
+  return ((const char *)memmem(data, len, s, strlen(s)));
+}
+
+
+//
+// 'pr_pdf_pages()' - Read the page count from the root of a PDF file's
+//                    page tree. An incremental update appends a new
+//                    version of the root, so the last root in the
+//                    file is the one which counts. Returns -1 if the
+//                    page tree is not readable as plain text, for
+//                    example in a compressed object stream.
+//
+
+static int				// O - Pages or -1
+pr_pdf_pages(const char *data,		// I - File contents
+	     size_t     len)		// I - Length of file
+{
+  const char	*ptr,			// Current position
+		*end = data + len,	// End of file
+		*dictstart,		// Start of dictionary
+		*dictend,		// End of dictionary
+		*count;			// "/Count" in dictionary
+  int		pages = -1,		// Pages found
+		root = -1,		// Count of last root node
+		n;			// Count of current node
+
+
+  for (ptr = data;
+       (ptr = pr_find_string(ptr, end - ptr, "/Type")) != NULL;
+       ptr ++)
+  {
+    // "/Type /Pages", but not "/Type /Page"
+    const char *val = ptr + 5;
+    while (val < end && isspace(*val & 255))
+      val ++;
+    if (end - val < 7 || strncmp(val, "/Pages", 6) ||
+	isalnum(val[6] & 255))
+      continue;
+
+    // Find the dictionary around it
+    for (dictstart = ptr; dictstart > data && ptr - dictstart < 1024;
+	 dictstart --)
+      if (dictstart[0] == '<' && dictstart[1] == '<')
+	break;
+    if (dictstart[0] != '<' || dictstart[1] != '<')
+      continue;
+    if ((dictend = pr_find_string(val, end - val > 1024 ? 1024 : end - val,
+				  ">>")) == NULL)
+      continue;
+
+    // Only the root node has no parent, its count is the one of the
+    // document, the largest of all nodes in any case
+    if ((count = pr_find_string(dictstart, dictend - dictstart,
+				"/Count")) == NULL)
+      continue;
+    n = (int)strtol(count + 6, NULL, 10);
+    if (!pr_find_string(dictstart, dictend - dictstart, "/Parent"))
+      root = n;
+    else if (n > pages)
+      pages = n;
+  }
+
+  return (root >= 0 ? root : pages);
+}
+
+
+//
+// 'pr_ps_pages()' - Read the page count from the DSC comments of a
+//                   PostScript file.
+//
+
+static int				// O - Pages or -1
+pr_ps_pages(const char *data,		// I - File contents
+	    size_t     len)		// I - Length of file
+{
+  const char	*ptr,			// Current position
+		*header_end,		// End of header comments
+		*trailer;		// Start of last part of the file
+  size_t	header_len;		// Length of header comments
+  int		pages = -1;		// Pages found
+
+
+  if (len < 4 || strncmp(data, "%!", 2))
+    return (-1);
+
+  // "%%Pages: N" in the header comments, or "%%Pages: (atend)" and
+  // the actual value in the trailer
+  if ((header_end = pr_find_string(data, len, "%%EndComments")) != NULL)
+    header_len = header_end - data;
+  else
+    header_len = len > PR_PREFLIGHT_PS_TAIL ? PR_PREFLIGHT_PS_TAIL : len;
+  if ((ptr = pr_find_string(data, header_len, "%%Pages:")) == NULL)
+    return (-1);
+  ptr += 8;
+  while (ptr < data + len && (*ptr == ' ' || *ptr == '\t'))
+    ptr ++;
+  if (isdigit(*ptr & 255))
+    return ((int)strtol(ptr, NULL, 10));
+  if (strncmp(ptr, "(atend)", 7))
+    return (-1);
+
+  trailer = len > PR_PREFLIGHT_PS_TAIL ? data + len - PR_PREFLIGHT_PS_TAIL :
+    ptr;
+  while ((ptr = pr_find_string(trailer, data + len - trailer, "%%Pages:")) !=
+	 NULL)
+  {
+    if (isdigit(ptr[8 + strspn(ptr + 8, " \t")] & 255))
+      pages = (int)strtol(ptr + 8, NULL, 10);
+    trailer = ptr + 8;
+  }
+
+  return (pages);
+}
+
+
+//
+// 'pr_be32()' - Read a big-endian 32-bit unsigned integer.
+//
+
+static unsigned				// O - Value
+pr_be32(const unsigned char *p)		// I - Bytes
+{
+  return (((unsigned)p[0] << 24) | ((unsigned)p[1] << 16) |
+	  ((unsigned)p[2] << 8) | (unsigned)p[3]);
+}
+
+
+//
+// '_prPreflightPages()' - Count the pages of a document without
+//                         rendering it. Returns -1 if the page count
+//                         cannot be determined cheaply.
+//
+
+int					// O - Pages or -1
+_prPreflightPages(const char *filename,	// I - Document file
+		  const char *format)	// I - MIME type of document
+{
+  int		fd,			// File descriptor
+		pages = -1;		// Pages found
+  struct stat	st;			// File information
+  const char	*data;			// File contents
+  size_t	len;			// Length of file
+
+
+  if (!filename || !format)
+    return (-1);
+  if ((fd = open(filename, O_RDONLY)) < 0)
+    return (-1);
+  if (fstat(fd, &st) || st.st_size == 0 ||
+      (data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd,
+		   0)) == MAP_FAILED)
+  {
+    close(fd);
+    return (-1);
+  }
+  len = (size_t)st.st_size;
+
+  if (!strcmp(format, "application/pdf"))
+  {
+    if ((pages = pr_pdf_pages(data, len)) < 0)
+      // Compressed page tree, let QPDF parse the file
+      pages = cfPDFPages(filename);
+  }
+  else if (!strcmp(format, "application/postscript"))
+    pages = pr_ps_pages(data, len);
+  else if (!strcmp(format, "image/pwg-raster"))
+  {
+    // Synchronization word and TotalPageCount of first page header,
+    // 0 means that the creator did not know the page count
+    if (len >= 4 + 460 && !memcmp(data, "RaS2", 4) &&
+	(pages = (int)pr_be32((const unsigned char *)data + 4 + 452)) == 0)
+      pages = -1;
+  }
+  else if (!strcmp(format, "image/urf"))
+  {
+    // File header: "UNIRAST\0" and page count
+    if (len >= 12 && !memcmp(data, "UNIRAST", 8) &&
+	(pages = (int)pr_be32((const unsigned char *)data + 8)) == 0)
+      pages = -1;
+  }
+
+  munmap((void *)data, len);
+  close(fd);
+
+  return (pages < 0 ? -1 : pages);
+}
+
+
+//
+// '_prPreflightCost()' - Estimate the cost of a job, in pages. If the
+//                        page count is not known, guess it from the
+//                        size of the document.
+//
+
+double					// O - Estimated cost
+_prPreflightCost(int   pages,		// I - Pages or -1
+		 off_t bytes)		// I - Size of document
+{
+  if (pages >= 0)
+    return ((double)pages);
+  else
+    return ((double)(bytes / PR_PREFLIGHT_PAGE_BYTES + 1));
+}
+
+
+//
+// 'pr_preflight_find()' - Find the preflight entry of a job, with the
+//                         lock of the preflight results held.
+//
+
+static pr_preflight_t *			// O - Entry or NULL
+pr_preflight_find(pr_printer_app_global_data_t *global_data,
+					// I - Global data
+		  int job_id)		// I - Job ID
+{
+  int		i;			// Looping var
+
+
+  for (i = 0; i < global_data->num_preflight && i < PR_PREFLIGHT_MAX_JOBS;
+       i ++)
+    if (global_data->preflight[i].job_id == job_id)
+      return (global_data->preflight + i);
+
+  return (NULL);
+}
+
+
+//
+// 'pr_preflight_release()' - Remove the entry of a job which we have
+//                            claimed but not preflighted.
+//
+
+static void
+pr_preflight_release(pr_printer_app_global_data_t *global_data,
+					// I - Global data
+		     int job_id)	// I - Job ID
+{
+  pr_preflight_t *entry;		// Entry of the job
+
+
+  pthread_mutex_lock(&global_data->preflight_mutex);
+  if ((entry = pr_preflight_find(global_data, job_id)) != NULL &&
+      entry->cost < 0.0)
+    entry->job_id = 0;
+  pthread_mutex_unlock(&global_data->preflight_mutex);
+}
+
+
+//
+// '_prPreflightGetCost()' - Estimated cost of a queued job, for a
+//                           scheduling policy favoring small jobs.
+//                           Returns -1.0 if the job did not get
+//                           preflighted.
+//
+
+double					// O - Estimated cost or -1.0
+_prPreflightGetCost(pr_printer_app_global_data_t *global_data,
+					// I - Global data
+		    int job_id)		// I - Job ID
+{
+  pr_preflight_t *entry;		// Entry of the job
+  double	cost = -1.0;		// Cost of the job
+
+
+  pthread_mutex_lock(&global_data->preflight_mutex);
+  if ((entry = pr_preflight_find(global_data, job_id)) != NULL)
+    cost = entry->cost;
+  pthread_mutex_unlock(&global_data->preflight_mutex);
+
+  return (cost);
+}
+
+
+//
+// 'pr_preflight_job()' - Preflight a job, running in its own thread as
+//                        PAPPL holds its locks when calling the event
+//                        callback. The job's entry in the results got
+//                        claimed by the callback already.
+//
+
+static void *				// O - Thread exit status
+pr_preflight_job(void *data)		// I - Job to preflight
+{
+  pr_preflight_job_t *pjob = (pr_preflight_job_t *)data;
+  pr_printer_app_global_data_t *global_data = pjob->global_data;
+  pappl_printer_t *printer;		// Printer
+  pappl_job_t	*job;			// Job
+  const char	*filename,		// Document file
+		*format;		// Document format
+  struct stat	st;			// File information
+  int		doc,			// Current document
+		num_docs,		// Number of documents
+		doc_pages,		// Pages of the document
+		pages = 0;		// Pages of the job, -1 if unknown
+  off_t		bytes = 0;		// Size of the job's documents
+  double	cost = 0.0;		// Estimated cost
+  pr_preflight_t *entry;		// Entry in preflight results
+
+
+  // Other state changes than the one to pending, which the event does
+  // not tell, release the claim again
+  if ((printer = papplSystemFindPrinter(global_data->system, NULL,
+					pjob->printer_id, NULL)) == NULL ||
+      (job = papplPrinterFindJob(printer, pjob->job_id)) == NULL ||
+      papplJobGetState(job) != IPP_JSTATE_PENDING ||
+      (num_docs = papplJobGetNumberOfDocuments(job)) < 1)
+  {
+    pr_preflight_release(global_data, pjob->job_id);
+    free(pjob);
+    return (NULL);
+  }
+
+  // All documents of the job get printed, so they all count
+  for (doc = 1; doc <= num_docs; doc ++)
+  {
+    if ((filename = papplJobGetDocumentFilename(job, doc)) == NULL ||
+	(format = papplJobGetDocumentFormat(job, doc)) == NULL ||
+	stat(filename, &st))
+    {
+      pr_preflight_release(global_data, pjob->job_id);
+      free(pjob);
+      return (NULL);
+    }
+
+    doc_pages = _prPreflightPages(filename, format);
+    cost += _prPreflightCost(doc_pages, st.st_size);
+    bytes += st.st_size;
+    if (doc_pages < 0)
+      pages = -1;
+    else if (pages >= 0)
+      pages += doc_pages;
+    _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	      "Preflight: Document %d of %d, %s, %d pages", doc, num_docs,
+	      format, doc_pages);
+  }
+
+  // The job can have gotten processed already while we were counting
+  if (pages > 0 && papplJobGetImpressions(job) == 0)
+    papplJobSetImpressions(job, pages);
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	    "Preflight: %d pages, estimated cost %.0f", pages, cost);
+
+  // Our claim can have been overwritten by the entries of many newer
+  // jobs in the meantime
+  pthread_mutex_lock(&global_data->preflight_mutex);
+  if ((entry = pr_preflight_find(global_data, pjob->job_id)) == NULL)
+  {
+    entry = global_data->preflight +
+      (global_data->num_preflight % PR_PREFLIGHT_MAX_JOBS);
+    global_data->num_preflight ++;
+  }
+  entry->job_id = pjob->job_id;
+  entry->pages = pages;
+  entry->bytes = bytes;
+  entry->cost = cost;
+  pthread_mutex_unlock(&global_data->preflight_mutex);
+
+  free(pjob);
+  return (NULL);
+}
+
+
+//
+// '_prPreflightEvent()' - System event callback, start the preflight of
+//                         jobs when they get queued. A job gets an
+//                         entry in the preflight results as soon as
+//                         its preflight starts, so that the events of
+//                         its later state changes do not start it
+//                         again.
+//
+
+void
+_prPreflightEvent(pappl_system_t  *system,// I - System
+		  pappl_printer_t *printer,// I - Printer
+		  pappl_job_t     *job,	// I - Job
+		  pappl_event_t   event,// I - Event
+		  void            *data)// I - Global data
+{
+  pr_printer_app_global_data_t *global_data =
+    (pr_printer_app_global_data_t *)data;
+  pr_preflight_job_t *pjob;		// Job to preflight
+  pr_preflight_t *entry;		// Entry in preflight results
+  pthread_t	tid;			// Thread ID
+  int		job_id;			// Job ID
+
+
+  (void)system;
+
+  // Jobs get created before their document arrives and change their
+  // state to pending when it is received, the thread checks the state
+  // as PAPPL can hold the job's lock here
+  if (!printer || !job || !(event & PAPPL_EVENT_JOB_STATE_CHANGED))
+    return;
+
+  // Check and claim the job's entry in one go, so that only one
+  // preflight of the job runs
+  job_id = papplJobGetID(job);
+  pthread_mutex_lock(&global_data->preflight_mutex);
+  if (pr_preflight_find(global_data, job_id))
+  {
+    pthread_mutex_unlock(&global_data->preflight_mutex);
+    return;
+  }
+  entry = global_data->preflight +
+    (global_data->num_preflight % PR_PREFLIGHT_MAX_JOBS);
+  entry->job_id = job_id;
+  entry->pages = -1;
+  entry->bytes = 0;
+  entry->cost = -1.0;
+  global_data->num_preflight ++;
+  pthread_mutex_unlock(&global_data->preflight_mutex);
+
+  if ((pjob = calloc(1, sizeof(pr_preflight_job_t))) == NULL)
+  {
+    pr_preflight_release(global_data, job_id);
+    return;
+  }
+  pjob->global_data = global_data;
+  pjob->printer_id = papplPrinterGetID(printer);
+  pjob->job_id = job_id;
+
+  if (pthread_create(&tid, NULL, pr_preflight_job, pjob))
+  {
+    pr_preflight_release(global_data, job_id);
+    free(pjob);
+    return;
+  }
+  pthread_detach(tid);
+}
@@ -0,0 +1,84 @@
+//
+// PPD/Classic CUPS driver retro-fit Printer Application Library
+// (libpappl-retrofit) for the Printer Application Framework (PAPPL)
+//
+// prerender-private.h
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#ifndef _PAPPL_RETROFIT_PRERENDER_H_
+#  define _PAPPL_RETROFIT_PRERENDER_H_
+
+//
+// Include necessary headers...
+//
+
+#include <pappl-retrofit/pappl-retrofit.h>
+#include <pappl/pappl.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+
+//
+// C++ magic...
+//
+
+#  ifdef __cplusplus
+extern "C" {
+#  endif // __cplusplus
+
+
+//
+// Constants...
+//
+
+#define PR_PRERENDER_SIZE_DEFAULT (256 * 1024 * 1024)
+					// Default disk budget for output
+					// rendered ahead of time
+
+
+//
+// Types...
+//
+
+typedef struct pr_prerendered_s		// Job rendered ahead of time
+{
+  int            job_id;		// Job ID
+  char           filename[1024];	// Print-ready output
+  off_t          size;			// Size of output
+  bool           done,			// Rendering finished?
+                 ok;			// Rendering successful?
+} pr_prerendered_t;
+
+typedef struct pr_prerender_queue_s	// Pre-render stage of a printer
+{
+  pthread_mutex_t mutex;		// Lock
+  pthread_cond_t cond;			// Signals finished renderings
+  cups_array_t   *jobs;			// Jobs rendered ahead of time
+  bool           running,		// Pre-render thread running?
+                 stop;			// Printer is going away?
+} pr_prerender_queue_t;
+
+
+//
+// Functions...
+//
+
+extern void   _prPrerenderInit(pr_prerender_queue_t *queue);
+extern void   _prPrerenderFree(pr_prerender_queue_t *queue);
+extern void   _prPrerenderStart(pappl_printer_t *printer);
+extern int    _prPrerenderOpen(pappl_job_t *job);
+
+
+//
+// C++ magic...
+//
+
+#  ifdef __cplusplus
+}
+#  endif // __cplusplus
+
+
+#endif // !_PAPPL_RETROFIT_PRERENDER_H_
@@ -0,0 +1,368 @@
+//
+// PPD/Classic CUPS driver retro-fit Printer Application Library
+// (libpappl-retrofit) for the Printer Application Framework (PAPPL)
+//
+// prerender.c
+//
+// Pre-render stage: While a printer sends a job to the device, the
+// jobs queued behind it get converted into print-ready output, so
+// that they only need to be streamed to the device when it is their
+// turn.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+//
+// Include necessary headers...
+//
+
+#include <pappl-retrofit/prerender-private.h>
+#include <pappl-retrofit/pappl-retrofit-private.h>
+#include <pappl-retrofit/pappl1-private.h>
+#include <pappl-retrofit/libcups2-private.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+
+//
+// Types...
+//
+
+typedef struct pr_prerender_scan_s	// Data for finding pending jobs
+{
+  int   depth;				// Jobs to look ahead
+  int   num_ids;			// Pending jobs found
+  int   ids[64];			// Their IDs, in queue order
+} pr_prerender_scan_t;
+
+
+//
+// 'pr_prerender_queue()' - Pre-render stage of a printer.
+//
+
+static pr_prerender_queue_t *		// O - Pre-render stage
+pr_prerender_queue(pappl_printer_t *printer) // I - Printer
+{
+  pappl_pr_driver_data_t driver_data;	// Printer's driver data
+
+
+  papplPrinterGetDriverData(printer, &driver_data);
+  return (&((pr_driver_extension_t *)driver_data.extension)->prerender);
+}
+
+
+//
+// 'pr_prerender_find()' - Find the entry of a job, queue must be
+//                         locked.
+//
+
+static pr_prerendered_t *		// O - Entry or NULL
+pr_prerender_find(pr_prerender_queue_t *queue, // I - Pre-render stage
+		  int                  job_id) // I - Job ID
+{
+  pr_prerendered_t *entry;
+
+
+  for (entry = (pr_prerendered_t *)cupsArrayGetFirst(queue->jobs);
+       entry;
+       entry = (pr_prerendered_t *)cupsArrayGetNext(queue->jobs))
+    if (entry->job_id == job_id)
+      return (entry);
+
+  return (NULL);
+}
+
+
+//
+// 'pr_prerender_pending()' - Collect the pending jobs of a printer.
+//
+
+static void
+pr_prerender_pending(pappl_job_t *job,	// I - Active job
+		     void        *data)	// I - Scan data
+{
+  pr_prerender_scan_t *scan = (pr_prerender_scan_t *)data;
+
+
+  if (papplJobGetState(job) == IPP_JSTATE_PENDING &&
+      scan->num_ids < scan->depth &&
+      scan->num_ids < (int)(sizeof(scan->ids) / sizeof(scan->ids[0])))
+    scan->ids[scan->num_ids ++] = papplJobGetID(job);
+}
+
+
+//
+// 'pr_prerender_render()' - Render a job into a file. This runs in the
+//                           pre-render thread, the filters of the job
+//                           get forked off by the filter chain and
+//                           stopped by its watchdog when the job gets
+//                           canceled.
+//
+
+static bool				// O - `true` on success
+pr_prerender_render(pappl_printer_t *printer, // I - Printer
+		    int             job_id,  // I - Job ID
+		    const char      *filename, // I - Output file
+		    pr_printer_app_global_data_t *global_data)
+					// I - Global data
+{
+  pappl_job_t *job;			// Job
+
+
+  if ((job = papplPrinterFindJob(printer, job_id)) == NULL)
+    return (false);
+
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Rendering job ahead of time");
+
+  return (_prPrerenderJob(job, global_data, filename));
+}
+
+
+//
+// 'pr_prerender_sweep()' - Remove output of jobs which are not waiting
+//                          for printing any more, queue must be
+//                          locked.
+//
+
+static void
+pr_prerender_sweep(pappl_printer_t      *printer, // I - Printer
+		   pr_prerender_queue_t *queue)	  // I - Pre-render stage
+{
+  pr_prerendered_t *entry;
+  pappl_job_t      *job;
+
+
+  for (entry = (pr_prerendered_t *)cupsArrayGetFirst(queue->jobs);
+       entry;
+       entry = (pr_prerendered_t *)cupsArrayGetNext(queue->jobs))
+  {
+    if (!entry->done)
+      continue;
+    if ((job = papplPrinterFindJob(printer, entry->job_id)) != NULL &&
+	papplJobGetState(job) <= IPP_JSTATE_PROCESSING)
+      continue;
+    unlink(entry->filename);
+    cupsArrayRemove(queue->jobs, entry);
+    free(entry);
+  }
+}
+
+
+//
+// 'pr_prerender_thread()' - Render the pending jobs of a printer,
+//                           up to the look-ahead depth and the disk
+//                           budget, until there is nothing left to do.
+//
+
+static void *				// O - Thread exit status (unused)
+pr_prerender_thread(void *data)		// I - Printer
+{
+  pappl_printer_t              *printer = (pappl_printer_t *)data;
+  pr_prerender_queue_t         *queue = pr_prerender_queue(printer);
+  pappl_pr_driver_data_t       driver_data;
+  pr_printer_app_global_data_t *global_data;
+  pr_prerender_scan_t          scan;	// Pending jobs
+  pr_prerendered_t             *entry;
+  pappl_job_t                  *job;
+  struct stat                  fileinfo;
+  off_t                        used;	// Disk space used
+  bool                         ok;	// Rendering successful?
+  int                          i;
+
+
+  papplPrinterGetDriverData(printer, &driver_data);
+  global_data = ((pr_driver_extension_t *)driver_data.extension)->global_data;
+
+  pthread_mutex_lock(&queue->mutex);
+
+  while (!queue->stop)
+  {
+    pr_prerender_sweep(printer, queue);
+
+    // Disk budget
+    for (used = 0, entry = (pr_prerendered_t *)cupsArrayGetFirst(queue->jobs);
+	 entry;
+	 entry = (pr_prerendered_t *)cupsArrayGetNext(queue->jobs))
+      used += entry->size;
+    if (used >= (off_t)global_data->prerender_size)
+      break;
+
+    // Next pending job within the look-ahead depth which we have not
+    // rendered yet, and which goes through the spooling path
+    memset(&scan, 0, sizeof(scan));
+    scan.depth = global_data->prerender_depth;
+    pthread_mutex_unlock(&queue->mutex);
+    papplPrinterIterateActiveJobs(printer, pr_prerender_pending, &scan, 1, 0);
+    pthread_mutex_lock(&queue->mutex);
+
+    for (i = 0; i < scan.num_ids; i ++)
+      if (!pr_prerender_find(queue, scan.ids[i]) &&
+	  (job = papplPrinterFindJob(printer, scan.ids[i])) != NULL &&
+	  papplJobGetNumberOfDocuments(job) == 1 &&
+	  _prFindConversionRoute((pr_driver_extension_t *)driver_data.extension,
+				 papplJobGetDocumentFormat(job, 1)))
+	break;
+    if (i >= scan.num_ids)
+      break;
+
+    // Rendering ahead of time only uses render slots nobody is waiting
+    // for, we try again when the next job starts printing
+    if (!_prGovernorTryAcquire(global_data, printer))
+      break;
+
+    if ((entry =
+	 (pr_prerendered_t *)calloc(1, sizeof(pr_prerendered_t))) == NULL)
+    {
+      _prGovernorRelease(global_data, printer);
+      break;
+    }
+    entry->job_id = scan.ids[i];
+    snprintf(entry->filename, sizeof(entry->filename),
+	     "%s/prerender-%s-%d.prn", global_data->spool_dir,
+	     papplPrinterGetName(printer), entry->job_id);
+    cupsArrayAdd(queue->jobs, entry);
+    pthread_mutex_unlock(&queue->mutex);
+
+    ok = pr_prerender_render(printer, entry->job_id, entry->filename,
+			     global_data);
+    _prGovernorRelease(global_data, printer);
+    if (!ok)
+      unlink(entry->filename);
+
+    pthread_mutex_lock(&queue->mutex);
+    if (ok && stat(entry->filename, &fileinfo) == 0)
+      entry->size = fileinfo.st_size;
+    entry->ok   = ok;
+    entry->done = true;
+    pthread_cond_broadcast(&queue->cond);
+  }
+
+  queue->running = false;
+  pthread_cond_broadcast(&queue->cond);
+  pthread_mutex_unlock(&queue->mutex);
+
+  return (NULL);
+}
+
+
+//
+// '_prPrerenderInit()' - Initialize the pre-render stage of a printer.
+//
+
+void
+_prPrerenderInit(pr_prerender_queue_t *queue) // I - Pre-render stage
+{
+  memset(queue, 0, sizeof(pr_prerender_queue_t));
+  pthread_mutex_init(&queue->mutex, NULL);
+  pthread_cond_init(&queue->cond, NULL);
+  queue->jobs = cupsArrayNew(NULL, NULL, NULL, 0, NULL, NULL);
+}
+
+
+//
+// '_prPrerenderFree()' - Stop the pre-render stage of a printer and
+//                        remove its files.
+//
+
+void
+_prPrerenderFree(pr_prerender_queue_t *queue) // I - Pre-render stage
+{
+  pr_prerendered_t *entry;
+
+
+  pthread_mutex_lock(&queue->mutex);
+  queue->stop = true;
+  while (queue->running)
+    pthread_cond_wait(&queue->cond, &queue->mutex);
+  for (entry = (pr_prerendered_t *)cupsArrayGetFirst(queue->jobs);
+       entry;
+       entry = (pr_prerendered_t *)cupsArrayGetNext(queue->jobs))
+  {
+    unlink(entry->filename);
+    free(entry);
+  }
+  cupsArrayDelete(queue->jobs);
+  queue->jobs = NULL;
+  pthread_mutex_unlock(&queue->mutex);
+
+  pthread_cond_destroy(&queue->cond);
+  pthread_mutex_destroy(&queue->mutex);
+}
+
+
+//
+// '_prPrerenderStart()' - Start rendering the jobs queued behind the
+//                         job which the printer is starting to print,
+//                         if look-ahead is configured.
+//
+
+void
+_prPrerenderStart(pappl_printer_t *printer) // I - Printer
+{
+  pr_prerender_queue_t         *queue = pr_prerender_queue(printer);
+  pappl_pr_driver_data_t       driver_data;
+  pr_printer_app_global_data_t *global_data;
+  pthread_t                    thread;	// Pre-render thread
+
+
+  papplPrinterGetDriverData(printer, &driver_data);
+  global_data = ((pr_driver_extension_t *)driver_data.extension)->global_data;
+  if (global_data->prerender_depth <= 0)
+    return;
+
+  pthread_mutex_lock(&queue->mutex);
+  if (!queue->running && !queue->stop)
+  {
+    if (pthread_create(&thread, NULL, pr_prerender_thread, printer) == 0)
+    {
+      queue->running = true;
+      pthread_detach(thread);
+    }
+    else
+      papplLogPrinter(printer, PAPPL_LOGLEVEL_ERROR,
+		      "Unable to start rendering jobs ahead of time: %s",
+		      strerror(errno));
+  }
+  pthread_mutex_unlock(&queue->mutex);
+}
+
+
+//
+// '_prPrerenderOpen()' - Take the print-ready output of a job rendered
+//                        ahead of time. If it is still being rendered,
+//                        wait for it. Returns a file descriptor to read
+//                        the output from, or -1 if the job has not been
+//                        rendered ahead of time.
+//
+
+int					// O - File descriptor or -1
+_prPrerenderOpen(pappl_job_t *job)	// I - Job
+{
+  pr_prerender_queue_t *queue = pr_prerender_queue(papplJobGetPrinter(job));
+  pr_prerendered_t     *entry;
+  int                  fd = -1;
+
+
+  pthread_mutex_lock(&queue->mutex);
+  while ((entry = pr_prerender_find(queue, papplJobGetID(job))) != NULL &&
+	 !entry->done)
+  {
+    _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	      "Waiting for the rendering ahead of time to finish");
+    pthread_cond_wait(&queue->cond, &queue->mutex);
+  }
+  if (entry)
+  {
+    if (entry->ok && (fd = open(entry->filename, O_RDONLY)) >= 0)
+      _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+		"Using output rendered ahead of time: %s", entry->filename);
+    // The open file descriptor keeps the data
+    unlink(entry->filename);
+    cupsArrayRemove(queue->jobs, entry);
+    free(entry);
+  }
+  pthread_mutex_unlock(&queue->mutex);
+
+  return (fd);
+}
@@ -19,12 +19,14 @@
 //
 
 #include <pappl-retrofit/pappl-retrofit.h>
+#include <pappl-retrofit/intermediate-private.h>
 #include <pappl/pappl.h>
 #include <ppd/ppd.h>
 #include <cupsfilters/log.h>
 #include <cupsfilters/filter.h>
 #include <cups/cups.h>
 #include <signal.h>
+#include <pthread.h>
 
 
 //
@@ -36,6 +38,36 @@ extern "C" {
 #  endif // __cplusplus
 
 
+//
+// Constants...
+//
+
+#define PR_PIPE_SIZE	(1024 * 1024)	// Pipe capacity we request for the
+					// zero-copy device output path
+#define PR_DEVICE_BUFFER_CHUNK	65536	// Size of one buffer of the device
+					// output ring
+#define PR_DEVICE_BUFFER_SIZE_DEFAULT (4 * 1024 * 1024)
+					// Default memory budget for
+					// buffering output to the device
+#define PR_RENDER_CHUNK_PAGES	16	// Minimum pages per chunk for
+					// page-parallel rendering
+#define PR_MAX_RENDER_CHUNKS	64	// Maximum chunks for page-parallel
+					// rendering
+#define PR_SPOOL_CLEANUP_INTERVAL_DEFAULT 3600
+					// Default interval for the spool
+					// janitor (seconds)
+#define PR_DEBUG_COPY_MAX_AGE_DEFAULT (24 * 60 * 60)
+					// Default time to keep debug copies
+					// (seconds)
+#define PR_CANCEL_POLL_INTERVAL 100000	// Check for the job being canceled
+					// while filters run (microseconds)
+#define PR_PROGRESS_WINDOW	8	// Pages for the current page rate
+#define PR_PROGRESS_INTERVAL	1.0	// Interval for updating the job's
+					// progress (seconds)
+#define PR_CANCEL_GRACE_PERIOD	3	// Time filters and backend get to
+					// exit after SIGTERM (seconds)
+
+
 //
 // Types...
 //
@@ -48,8 +80,108 @@ typedef struct pr_print_filter_function_data_s
   char           *device_uri;                  // Printer device URI
   pappl_job_t    *job;                         // Job
   pr_printer_app_global_data_t *global_data;   // Global data
+  char           debug_copy[2048];             // Name for debug copy of the
+                                               // job, empty for none
+  char           cache_file[2048];             // File to put a copy of the
+                                               // output for the output
+                                               // cache into, empty for none
+  char           replay_file[2048];            // File to write one copy of
+                                               // the output into instead of
+                                               // the device, to be replayed
+                                               // for all copies, empty for
+                                               // printing directly
+  pid_t          job_pid;                      // Process of the job's thread,
+                                               // to tell whether we run in
+                                               // a forked filter process
+  pr_intermediate_t *replay;                   // Intermediate file to write
+                                               // one copy of the output
+                                               // into, used like
+                                               // "replay_file", NULL for
+                                               // none
 } pr_print_filter_function_data_t;
 
+// Chunk of a job rendered page-parallel
+typedef struct pr_render_chunk_s
+{
+  int            first_page,                   // Page range of the chunk
+                 last_page;
+  pid_t          pid;                          // Rendering process
+  int            status_fd;                    // Pipe telling when done
+  char           filename[1024];               // Rendered output
+} pr_render_chunk_t;
+
+typedef struct pr_render_chunks_s
+{
+  int            num_chunks;                   // Number of chunks
+  pr_render_chunk_t chunks[PR_MAX_RENDER_CHUNKS]; // Chunks in page order
+  pappl_job_t    *job;                         // Job
+  pthread_mutex_t mutex;                       // Lock for the watchdog
+  pthread_cond_t cond;                         // Signalled when rendering
+                                               // is done
+  bool           done;                         // Rendering done?
+} pr_render_chunks_t;
+
+typedef struct pr_job_progress_s	// Page progress of a job, in memory
+					// shared with the filter processes
+{
+  int              pages;		// Impressions completed
+  int              reported;		// Impressions reported to PAPPL
+  int              logs;		// "PAGE:" messages received
+  double           start;		// Time the filters got started
+  double           times[PR_PROGRESS_WINDOW];
+					// Times of the latest "PAGE:"
+					// messages
+  int              counts[PR_PROGRESS_WINDOW];
+					// Impressions completed at these
+					// times
+} pr_job_progress_t;
+
+typedef struct pr_job_log_s		// Log data of the job's filter chain,
+					// for _prJobLog()
+{
+  pappl_job_t      *job;		// Job
+  pr_job_progress_t *progress;		// Page progress of the job, NULL if
+					// not tracked
+} pr_job_log_t;
+
+typedef struct pr_cancel_watch_s	// Data of the cancel watchdog, which
+					// also reports the job's progress
+{
+  pappl_job_t      *job;		// Job
+  pr_job_progress_t *progress;		// Page progress of the job
+  struct pr_filter_stats_s *filters;	// Filter processes of the chain
+  int              num_filters;		// Number of filters
+  pthread_mutex_t  mutex;		// Lock
+  pthread_cond_t   cond;		// Signalled when the chain is done
+  bool             done;		// Chain is done?
+  double           canceled;		// Time the cancel was seen, 0.0 if
+					// not canceled
+} pr_cancel_watch_t;
+
+// Entry of the list of debug copy files, for the spool janitor
+typedef struct pr_debug_copy_s
+{
+  char           *filename;                    // Name of the file
+  time_t         created;                      // Time of creation
+} pr_debug_copy_t;
+
+// Ring of buffers for _prPrintFilterFunction(), filled by the job's
+// filter chain and drained to the device by a writer thread
+typedef struct pr_device_writer_s
+{
+  pappl_device_t  *device;                     // Device to write to
+  pthread_mutex_t mutex;                       // Lock for the ring state
+  pthread_cond_t  cond;                        // Signal buffer filled/freed
+  int             num_bufs;                    // Number of buffers
+  char            **bufs;                      // Buffers
+  size_t          *lens;                       // Bytes in each buffer
+  int             head,                        // Next buffer to fill
+                  tail,                        // Next buffer to write
+                  count;                       // Buffers waiting for output
+  bool            eof,                         // Input finished?
+                  error;                       // Device write failed?
+} pr_device_writer_t;
+
 typedef struct pr_job_data_s		// Job data
 {
   char                  *device_uri;    // Printer device URI
@@ -64,7 +196,9 @@ typedef struct pr_job_data_s		// Job data
                                         // raster input
   cups_array_t          *chain;         // Filter function chain
   cf_filter_filter_in_chain_t *ppd_filter, // Filter from PPD file
-                        *print;         // Filter function call for printing
+                        *print,         // Filter function call for printing
+                        *pool_filter;   // Filter handing conversion over to
+                                        // the render pool
   int                   device_fd;      // File descriptor to pipe output
                                         // to the device
   int                   device_pid;     // Process ID for device output
@@ -74,6 +208,9 @@ typedef struct pr_job_data_s		// Job data
   int                   line_count;     // Raster lines actually received for
                                         // this page
   void                  *data;          // Job-type-specific data
+  pr_job_log_t          log;            // Log data of the filters, with
+                                        // the page progress shared with
+                                        // the filter processes
   pr_printer_app_global_data_t *global_data; // Global data
 } pr_job_data_t;
 
@@ -88,6 +225,9 @@ extern pappl_content_t _prGetFileContentType(pappl_job_t *job);
 extern pr_job_data_t *_prCreateJobData(pappl_job_t *job,
 					 pappl_pr_options_t *job_options);
 extern bool   _prFilter(pappl_job_t *job, pappl_device_t *device, void *data);
+extern bool   _prPrerenderJob(pappl_job_t *job,
+				pr_printer_app_global_data_t *global_data,
+				const char *filename);
 extern void   _prFreeJobData(pr_job_data_t *job_data);
 extern int    _prJobIsCanceled(void *data);
 extern void   _prJobLog(void *data, cf_loglevel_t level,
@@ -95,6 +235,10 @@ extern void   _prJobLog(void *data, cf_loglevel_t level,
 extern void   _prOneBitDitherOnDraft(pappl_job_t *job,
 				     pappl_pr_options_t *options);
 extern void   _prCleanDebugCopies(pr_printer_app_global_data_t *global_data);
+extern bool   _prRegisterDebugCopy(pr_printer_app_global_data_t *global_data,
+				   pappl_job_t *job, char *filename,
+				   size_t filenamesize);
+extern bool   _prSpoolJanitor(pappl_system_t *system, void *data);
 extern int    _prPrintFilterFunction(int inputfd, int outputfd,
 				     int inputseekable, cf_filter_data_t *data,
 				     void *parameters);
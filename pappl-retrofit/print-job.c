@@ -23,6 +23,13 @@
 #include <pappl-retrofit/pappl-retrofit-private.h>
 #include <pappl-retrofit/pappl1-private.h>
 #include <pappl-retrofit/libcups2-private.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <cupsfilters/pdf.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#  include <sys/sendfile.h>
+#endif // HAVE_SYS_SENDFILE_H
 
 
 //
@@ -292,9 +299,9 @@ _prGetFileContentType(pappl_job_t *job)
     FILE *pd = popen(command, "r");
     if (!pd)
     {
-      papplLogJob(job, PAPPL_LOGLEVEL_WARN,
-		  "Unable to get PDF metadata from %s with both pdfinfo and exiftool",
-		  filename);
+      _prLogJob(job, PAPPL_LOGLEVEL_WARN,
+		"Unable to get PDF metadata from %s with both pdfinfo and exiftool",
+		filename);
     }
     else
     {
@@ -320,8 +327,8 @@ _prGetFileContentType(pappl_job_t *job)
 	      p ++;
 	    while ((q = p + strlen(p) - 1) && (*q == '\n' || *q == '\r'))
 	      *q = '\0';
-	    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-			"PDF metadata line: %s: %s", fields[i], p);
+	    _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+		      "PDF metadata line: %s: %s", fields[i], p);
 	    creatorline_found = 1;
 	    for (j = 0; j < 5; j ++)
 	    {
@@ -333,8 +340,8 @@ _prGetFileContentType(pappl_job_t *job)
 		  {
 		    found = creating_apps[j][k];
 		    content_type = 1 << j;
-		    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-				"  Found: %s", creating_apps[j][k]);
+		    _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+			      "  Found: %s", creating_apps[j][k]);
 		    break;
 		  }
 		  else
@@ -353,15 +360,15 @@ _prGetFileContentType(pappl_job_t *job)
       pclose(pd);
     }
     if (creatorline_found == 0)
-      papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-		  "No suitable PDF metadata line found");
+      _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+		"No suitable PDF metadata line found");
   }
 
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-	      "Input file format: %s%s%s%s -> Content optimization: %s",
-	      informat,
-	      found ? " (" : "", found ? found : "", found ? ")" : "", 
-	      (content_type == PAPPL_CONTENT_AUTO ? "No optimization" :
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	    "Input file format: %s%s%s%s -> Content optimization: %s",
+	    informat,
+	    found ? " (" : "", found ? found : "", found ? ")" : "", 
+	    (content_type == PAPPL_CONTENT_AUTO ? "No optimization" :
 	       (content_type == PAPPL_CONTENT_PHOTO ? "Photo" :
 		(content_type == PAPPL_CONTENT_GRAPHIC ? "Graphics" :
 		 (content_type == PAPPL_CONTENT_TEXT ? "Text" :
@@ -372,13 +379,16 @@ _prGetFileContentType(pappl_job_t *job)
 
 
 //
-// '_prCreateJobData()' - Load the printer's PPD file and set the PPD options
-//                          according to the job options
+// 'pr_create_job_data()' - Load the printer's PPD file and set the PPD
+//                          options according to the job options, in
+//                          the given PPD data instead of the printer's
+//                          if it is not NULL
 //
 
-pr_job_data_t *
-_prCreateJobData(pappl_job_t *job,
-		   pappl_pr_options_t *job_options)
+static pr_job_data_t *
+pr_create_job_data(pappl_job_t *job,
+		   pappl_pr_options_t *job_options,
+		   ppd_file_t *ppd)
 {
   int                   i, j, k, count, intval = 0;
   pr_driver_extension_t *extension;
@@ -432,7 +442,7 @@ _prCreateJobData(pappl_job_t *job,
   extension = (pr_driver_extension_t *)driver_data.extension;
   job_data->global_data = extension->global_data;
   job_data->device_uri = (char *)papplPrinterGetDeviceURI(printer);
-  job_data->ppd = extension->ppd;
+  job_data->ppd = ppd ? ppd : extension->ppd;
   pc = job_data->ppd->cache;
   job_data->temp_ppd_name = extension->temp_ppd_name;
   job_data->stream_filter = extension->stream_filter;
@@ -462,7 +472,7 @@ _prCreateJobData(pappl_job_t *job,
   }
 
   // Finishings
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Adding options for finishings");
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Adding options for finishings");
   if (job_options->finishings & PAPPL_FINISHINGS_PUNCH)
     num_options = ppdCacheGetFinishingOptions(pc, NULL, IPP_FINISHINGS_PUNCH,
 					      num_options, &(options));
@@ -474,7 +484,7 @@ _prCreateJobData(pappl_job_t *job,
 					      num_options, &(options));
 
   // PageSize/media/media-size/media-size-name
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Adding option: PageSize");
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Adding option: PageSize");
   attrs = ippNew();
   media_col = ippNew();
   media_size = ippNew();
@@ -496,10 +506,10 @@ _prCreateJobData(pappl_job_t *job,
 		"media-bottom-margin", job_options->media.bottom_margin);
   ippAddCollection(attrs, IPP_TAG_PRINTER, "media-col", media_col);
   ippDelete(media_col);
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "  Requesting size: W=%d H=%d L=%d R=%d T=%d B=%d (1/100 mm)",
-	      job_options->media.size_width, job_options->media.size_length,
-	      job_options->media.left_margin, job_options->media.right_margin,
-	      job_options->media.top_margin, job_options->media.bottom_margin);
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG, "  Requesting size: W=%d H=%d L=%d R=%d T=%d B=%d (1/100 mm)",
+	    job_options->media.size_width, job_options->media.size_length,
+	    job_options->media.left_margin, job_options->media.right_margin,
+	    job_options->media.top_margin, job_options->media.bottom_margin);
   if ((choicestr = ppdCacheGetPageSize(pc, attrs, NULL, NULL)) != NULL)
     num_options = cupsAddOption("PageSize", choicestr,
 					  num_options,
@@ -507,8 +517,8 @@ _prCreateJobData(pappl_job_t *job,
   ippDelete(attrs);
 
   // InputSlot/media-source
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Adding option: %s",
-	      pc->source_option ? pc->source_option : "InputSlot");
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Adding option: %s",
+	    pc->source_option ? pc->source_option : "InputSlot");
   if ((choicestr = ppdCacheGetInputSlot(pc, NULL,
 					job_options->media.source)) !=
       NULL)
@@ -516,15 +526,15 @@ _prCreateJobData(pappl_job_t *job,
 				num_options, &(options));
 
   // MediaType/media-type
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Adding option: MediaType");
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Adding option: MediaType");
   if ((choicestr = ppdCacheGetMediaType(pc, NULL,
 					job_options->media.type)) != NULL)
     num_options = cupsAddOption("MediaType", choicestr,
 				num_options, &(options));
 
   // orientation-requested (filter option)
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-	      "Adding option: orientation-requested");
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	    "Adding option: orientation-requested");
   if (job_options->orientation_requested >= IPP_ORIENT_PORTRAIT &&
       job_options->orientation_requested <  IPP_ORIENT_NONE)
   {
@@ -536,7 +546,7 @@ _prCreateJobData(pappl_job_t *job,
   // OutputBin/output-bin
   if ((count = pc->num_bins) > 0)
   {
-    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Adding option: OutputBin");
+    _prLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Adding option: OutputBin");
     val = job_options->output_bin;
     for (i = 0, pwg_map = pc->bins; i < count; i ++, pwg_map ++)
       if (!strcmp(pwg_map->pwg, val))
@@ -547,8 +557,8 @@ _prCreateJobData(pappl_job_t *job,
   }
 
   // Presets, selected by color/bw and print quality
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-	      "Adding option presets depending on requested print quality and color mode");
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	    "Adding option presets depending on requested print quality and color mode");
   if (job_data->ppd->color_device &&
       (job_options->print_color_mode &
        (PAPPL_COLOR_MODE_AUTO | PAPPL_COLOR_MODE_COLOR)) != 0)
@@ -563,32 +573,32 @@ _prCreateJobData(pappl_job_t *job,
     pq = 1;
   num_presets = pc->num_presets[pcm][pq];
   presets     = pc->presets[pcm][pq];
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-	      "%sresets for %s printing in %s quality%s",
-	      num_presets ? "P" : "No p",
-	      pcm == 1 ? "color" : "black and white",
-	      pq == 0 ? "draft" : (pq == 1 ? "normal" : "high"),
-	      num_presets ? ":" : "");
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	    "%sresets for %s printing in %s quality%s",
+	    num_presets ? "P" : "No p",
+	    pcm == 1 ? "color" : "black and white",
+	    pq == 0 ? "draft" : (pq == 1 ? "normal" : "high"),
+	    num_presets ? ":" : "");
   if (num_presets > 0)
   {
     for (i = 0; i < num_presets; i ++)
     {
-      papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-		  "  Adding option: %s=%s", presets[i].name, presets[i].value);
+      _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+		"  Adding option: %s=%s", presets[i].name, presets[i].value);
       num_options = cupsAddOption(presets[i].name, presets[i].value,
 				  num_options, &(options));
     }
   }
 
   // Optimize presets, selected by print content optimization
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-	      "Adding option presets depending on requested content optimization");
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	    "Adding option presets depending on requested content optimization");
 
   // Find out about input file content type if not specified
   if (job_options->print_content_optimize == PAPPL_CONTENT_AUTO)
   {
-    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-		"Automatic content type selection ...");
+    _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	      "Automatic content type selection ...");
     job_options->print_content_optimize = _prGetFileContentType(job);
   }
 
@@ -613,15 +623,15 @@ _prCreateJobData(pappl_job_t *job,
   }
   num_presets = pc->num_optimize_presets[pco];
   presets     = pc->optimize_presets[pco];
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-	      "%sresets for %s printing%s",
-	      num_presets ? "P" : "No p",
-	      (pco == 0 ? "automatic" :
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	    "%sresets for %s printing%s",
+	    num_presets ? "P" : "No p",
+	    (pco == 0 ? "automatic" :
 	       (pco == 1 ? "photo" :
 		(pco == 2 ? "graphics" :
 		 (pco == 3 ? "text" :
 		  "text and graphics")))),
-	      num_presets ? ":" : "");
+	    num_presets ? ":" : "");
   if (num_presets > 0)
   {
     for (i = 0; i < num_presets; i ++)
@@ -630,16 +640,16 @@ _prCreateJobData(pappl_job_t *job,
 	  cupsGetOption(presets[i].name, num_options,
 			options) == NULL)
       {
-	papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-		    "  Adding option: %s=%s",
-		    presets[i].name, presets[i].value);
+	_prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+		  "  Adding option: %s=%s",
+		  presets[i].name, presets[i].value);
 	num_options = cupsAddOption(presets[i].name, presets[i].value,
 				    num_options, &(options));
       }
       else
-	papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-		    "    Skipping option: %s=%s (This option would also switch to high-quality printing)",
-		    presets[i].name, presets[i].value);
+	_prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+		  "    Skipping option: %s=%s (This option would also switch to high-quality printing)",
+		  presets[i].name, presets[i].value);
     }
   }
 
@@ -653,7 +663,7 @@ _prCreateJobData(pappl_job_t *job,
   }
 
   // print-scaling (filter option)
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Adding option: print-scaling");
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Adding option: print-scaling");
   if (job_options->print_scaling)
   {
     if (job_options->print_scaling & PAPPL_SCALING_AUTO)
@@ -674,7 +684,7 @@ _prCreateJobData(pappl_job_t *job,
   }
 
   // Duplex/sides
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Adding option: Duplex");
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Adding option: Duplex");
   if (job_options->sides && pc->sides_option)
   {
     if (job_options->sides & PAPPL_SIDES_ONE_SIDED &&
@@ -704,8 +714,8 @@ _prCreateJobData(pappl_job_t *job,
 			     1 : 0);
     if ((param = strchr(extension->vendor_ppd_options[i], ':')) == NULL)
     {
-      papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Adding option: %s",
-		  extension->vendor_ppd_options[i] + controlled_by_presets);
+      _prLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Adding option: %s",
+		extension->vendor_ppd_options[i] + controlled_by_presets);
       coption = NULL;
       num_cparams = 0;
       k = 0;
@@ -713,7 +723,7 @@ _prCreateJobData(pappl_job_t *job,
     else
     {
       param ++;
-      papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "  Custom parameter: %s", param);
+      _prLogJob(job, PAPPL_LOGLEVEL_DEBUG, "  Custom parameter: %s", param);
     }
     if ((attr = papplJobGetAttribute(job, driver_data.vendor[i])) == NULL ||
 	ippGetString(attr, 0, NULL) == NULL)
@@ -775,25 +785,25 @@ _prCreateJobData(pappl_job_t *job,
 	if (option == NULL)
         {
 	  // Should never happen
-	  papplLogJob(job, PAPPL_LOGLEVEL_ERROR,
-		      "  PPD Option not correctly registered (bug), "
-		      "skipping ...");
+	  _prLogJob(job, PAPPL_LOGLEVEL_ERROR,
+		    "  PPD Option not correctly registered (bug), "
+		    "skipping ...");
 	  continue;
 	}
 	if (val == NULL)
         {
 	  // Should never happen
-	  papplLogJob(job, PAPPL_LOGLEVEL_ERROR,
-		      "  PPD option not enumerated choice or boolean, "
-		      "skipping ...");
+	  _prLogJob(job, PAPPL_LOGLEVEL_ERROR,
+		    "  PPD option not enumerated choice or boolean, "
+		    "skipping ...");
 	  continue;
 	}
 	if (controlled_by_presets && !strcasecmp(val, "automatic-selection"))
 	{
 	  // Option controlled by presets
-	  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-		      "  PPD option %s controlled by the presets",
-		      option->keyword);
+	  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+		    "  PPD option %s controlled by the presets",
+		    option->keyword);
 	  continue;
 	}
 	for (j = 0;
@@ -830,11 +840,13 @@ _prCreateJobData(pappl_job_t *job,
        papplJobGetAttribute(job,
 			    "multiple-document-handling")) != NULL)
   {
-    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Adding option: Collate");
+    _prLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Adding option: Collate");
     val = ippGetString(attr, 0, NULL);
+    // The "single-document" values ask for copies of the whole set of
+    // documents, so they are collated, too
     if (strstr(val, "uncollate"))
       choicestr = "False";
-    else if (strstr(val, "collate"))
+    else
       choicestr = "True";
     num_options = cupsAddOption("Collate", choicestr, num_options, &(options));
   }
@@ -870,9 +882,9 @@ _prCreateJobData(pappl_job_t *job,
   }
 
   // Log the option settings which will get used
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "PPD options to be used:");
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG, "PPD options to be used:");
   for (i = num_options, opt = options; i > 0; i --, opt ++)
-    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "  %s=%s", opt->name, opt->value);
+    _prLogJob(job, PAPPL_LOGLEVEL_DEBUG, "  %s=%s", opt->name, opt->value);
 
   // Set environment variables for filters
   if ((val = papplPrinterGetName(printer)) != NULL && val[0])
@@ -908,7 +920,8 @@ _prCreateJobData(pappl_job_t *job,
   filter_data->side_pipe[1] = -1;
   filter_data->logfunc = _prJobLog; // Job log function catching page counts
                                     // ("PAGE: XX YY" messages)
-  filter_data->logdata = job;
+  job_data->log.job = job;
+  filter_data->logdata = &job_data->log;
   filter_data->iscanceledfunc = _prJobIsCanceled; // Function to indicate
                                                   // whether the job got
                                                   // canceled
@@ -930,493 +943,2999 @@ _prCreateJobData(pappl_job_t *job,
 
 
 //
-// '_prFilter()' - PAPPL generic filter function wrapper for printing
-//                 in spooling mode
+// '_prCreateJobData()' - Load the printer's PPD file and set the PPD options
+//                          according to the job options
 //
 
-bool
-_prFilter(
-    pappl_job_t    *job,		// I - Job
-    pappl_device_t *device,		// I - Device
-    void *data)                         // I - Global data
+pr_job_data_t *
+_prCreateJobData(pappl_job_t *job,
+		   pappl_pr_options_t *job_options)
 {
-  int                   i;
-  pr_printer_app_global_data_t *global_data =
-    (pr_printer_app_global_data_t *)data;
-  pr_cups_device_data_t *device_data = NULL;
-  pr_job_data_t         *job_data;      // PPD data for job
-  ppd_filter_data_ext_t *filter_data_ext;
-  ppd_file_t            *ppd;           // PPD of the printer
-  const char            *informat;
-  const char		*filename;	// Input filename
-  int			fd;		// Input file descriptor
-  pr_spooling_conversion_t *conversion; // Spooling conversion to use
-                                        // for pre-filtering
-  char                  *filter_path = NULL; // Filter from PPD to use for
-                                        // this job
-  int                   nullfd;         // File descriptor for /dev/null
-  pappl_pr_options_t	*job_options;	// Job options
-  bool			ret = false;	// Return value
-  cf_filter_external_t* ppd_filter_params = NULL; // Parameters for CUPS
-                                        // filter defined in the PPD
-  pr_print_filter_function_data_t *print_params; // Parameters for
-                                        // _prPrintFilterFunction()
-  cf_filter_filter_in_chain_t banner_filter = // cfFilterBannerToPDF() filter
-                                        // function in filter chain, mainly for
-  {                                     // PDF test pages
-    cfFilterBannerToPDF,
-    NULL,
-    "bannertopdf"
-  };
-  int                   is_banner = 0;  // Do we have cfFilterBannerToPDF()
-                                        // instructions in our PDF input file
+  return (pr_create_job_data(job, job_options, NULL));
+}
 
 
-  //
-  // Load the printer's assigned PPD file, and find out which PPD option
-  // seetings correspond to our job options
-  //
+//
+// 'pr_load_ppd()' - Prepare the PPD data for the filters of a job with
+//                   ppdFilterLoadPPD(). The printer attributes it
+//                   derives from the PPD are the same for every job
+//                   of the driver, so they are derived only for the
+//                   first job and then copied for the following jobs,
+//                   until the driver gets set up again. We rely on
+//                   ppdFilterLoadPPD() keeping printer attributes
+//                   which are already in the filter data instead of
+//                   deriving them, and on ppdFilterFreePPD() freeing
+//                   them, so every job gets its own copy. The marking
+//                   of the job's options stays per job.
+//
 
-  job_options = papplJobCreatePrintOptions(job, 1, INT_MAX, 1);
+static void
+pr_load_ppd(pappl_job_t   *job,		// I - Job
+	    pr_job_data_t *job_data)	// I - Job data
+{
+  pappl_pr_driver_data_t driver_data;	// Printer's driver data
+  pr_driver_extension_t  *extension;	// Driver extension data
+  cf_filter_data_t       *filter_data = job_data->filter_data;
 
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-	      "Printing job in spooling mode");
 
-  job_data = _prCreateJobData(job, job_options);
-  filter_data_ext =
-    (ppd_filter_data_ext_t *)cfFilterDataGetExt(job_data->filter_data,
-						PPD_FILTER_DATA_EXT);
-  ppd = filter_data_ext->ppd;
+  papplPrinterGetDriverData(papplJobGetPrinter(job), &driver_data);
+  extension = (pr_driver_extension_t *)driver_data.extension;
 
-  //
-  // Open the input file...
-  //
+  pthread_mutex_lock(&extension->attrs_mutex);
+  if (extension->filter_printer_attrs && !filter_data->printer_attrs &&
+      (filter_data->printer_attrs = ippNew()) != NULL)
+    ippCopyAttributes(filter_data->printer_attrs,
+		      extension->filter_printer_attrs, 1, NULL, NULL);
+  pthread_mutex_unlock(&extension->attrs_mutex);
+
+  ppdFilterLoadPPD(filter_data);
+
+  pthread_mutex_lock(&extension->attrs_mutex);
+  if (!extension->filter_printer_attrs && filter_data->printer_attrs &&
+      (extension->filter_printer_attrs = ippNew()) != NULL)
+    ippCopyAttributes(extension->filter_printer_attrs,
+		      filter_data->printer_attrs, 1, NULL, NULL);
+  pthread_mutex_unlock(&extension->attrs_mutex);
+}
 
-  filename = papplJobGetDocumentFilename(job, 1);
-  if ((fd = open(filename, O_RDONLY)) < 0)
-  {
-    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to open input file '%s' for printing: %s",
-		filename, strerror(errno));
-    _prFreeJobData(job_data);
-    return (false);
-  }
 
-  //
-  // Get input file format
-  //
+#ifdef HAVE_OPEN_MEMSTREAM
+//
+// 'pr_passthrough_possible()' - Check whether a job in spooling mode
+//                               can be sent to the printer as it is,
+//                               without running a filter chain. This
+//                               is the case if the printer takes the
+//                               job's format natively (PPD filter is
+//                               the null filter "-" or "." for native
+//                               PostScript), the conversion is only
+//                               pdftopdf or pstops, there is no
+//                               banner, and no job option asks these
+//                               filters for any page manipulation. For
+//                               PostScript the input must be
+//                               DSC-conforming and the PPD must not
+//                               have per-page option code, as the
+//                               option code gets inserted into the
+//                               document's prolog and setup sections.
+//                               As we do not check the page sizes,
+//                               print-scaling must be "none", the
+//                               filters could scale or rotate the
+//                               pages otherwise.
+//
 
-  informat = papplJobGetDocumentFormat(job, 1);
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-	      "Input file format: %s", informat);
+static bool                                   // O - Pass through job?
+pr_passthrough_possible(
+    pappl_job_t              *job,            // I - Job
+    pr_job_data_t            *job_data,       // I - Job data
+    pr_spooling_conversion_t *conversion,     // I - Spooling conversion
+    const char               *filter_path,    // I - Filter from PPD
+    int                      fd)              // I - Input file
+{
+  cf_filter_data_t *filter_data = job_data->filter_data;
+  ppd_file_t       *ppd = job_data->ppd;
+  cf_filter_function_t function;              // Conversion filter
+  const char       *val,                      // Option value
+                   *allowed;                  // Values not changing the job
+  char             *code;                     // PPD code for the pages
+  char             buf[16];                   // Start of input file
+  size_t           len;
+  int              i;
+  static const char * const noop_options[][2] =
+  {                                           // Filter options which must
+                                              // be unset or have one of the
+                                              // given values
+    { "page-ranges",           NULL },
+    { "page-set",              "all" },
+    { "number-up",             "1" },
+    { "orientation-requested", "3" },
+    { "print-scaling",         "none" },
+    { "fit-to-page",           "false,off,no" },
+    { "fitplot",               "false,off,no" },
+    { "natural-scaling",       NULL },
+    { "scaling",               NULL },
+    { "position",              NULL },
+    { "mirror",                "false,off,no" },
+    { "page-border",           "none" },
+    { "output-order",          "normal" },
+    { "booklet",               "off,false,no" }
+  };
 
-  //
-  // Find filters to use for this job
-  //
-  
-  for (conversion =
-	 (pr_spooling_conversion_t *)
-	 cupsArrayGetFirst(global_data->config->spooling_conversions);
-       conversion;
-       conversion =
-	 (pr_spooling_conversion_t *)
-	 cupsArrayGetNext(global_data->config->spooling_conversions))
-  {
-    if (strcmp(conversion->srctype, informat) != 0)
-      continue;
-    if ((filter_path =
-	 _prPPDFindCUPSFilter(conversion->dsttype,
-			      ppd->num_filters, ppd->filters,
-			      global_data->filter_dir)) != NULL)
-      break;
-  }
 
-  if (conversion == NULL || filter_path == NULL)
-  {
-    papplLogJob(job, PAPPL_LOGLEVEL_ERROR,
-		"No pre-filter found for input format %s",
-		informat);
-    _prFreeJobData(job_data);
-    close(fd);
+  // Printer must take the data without PPD's CUPS filter and our
+  // conversion must be a single copying filter
+  if (strlen(filter_path) > 1 || conversion->num_filters != 1)
     return (false);
+  function = conversion->filters[0].function;
+  if (strcmp(conversion->srctype, "application/pdf") == 0 &&
+      strcmp(conversion->dsttype, "application/vnd.cups-pdf") == 0)
+  {
+    if (function != ppdFilterPDFToPDF && function != cfFilterPDFToPDF)
+      return (false);
   }
-
-  // Set input and output formats for the filter chain
-  job_data->filter_data->content_type = conversion->srctype;
-  job_data->filter_data->final_content_type = conversion->dsttype;
-
-  // Convert PPD file data into printer IPP attributes and options,
-  // for the filter functions being able to use it
-  ppdFilterLoadPPD(job_data->filter_data);
-
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-	      "Converting input file to format: %s", conversion->dsttype);
-  if (filter_path[0] == '.')
-    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-		"Passing on PostScript directly to printer");
-  else if (filter_path[0] == '-')
-    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-		"Passing on %s directly to printer", conversion->dsttype);
-  else
-    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-		"Using CUPS filter (printer driver): %s", filter_path);
-
-  //
-  // Connect the job's filter_data to the backend
-  //
-
-  if (strncmp(job_data->device_uri, "cups:", 5) == 0)
+  else if (strcmp(conversion->srctype, "application/postscript") == 0 &&
+	   strcmp(conversion->dsttype, "application/vnd.cups-postscript") == 0)
   {
-    // Get the device data
-    device_data = (pr_cups_device_data_t *)papplDeviceGetData(device);
+    if (function != ppdFilterPSToPS)
+      return (false);
 
-    // Connect the filter_data
-    device_data->filter_data = job_data->filter_data;
+    // Only DSC-conforming PostScript, so that we know where the header
+    // ends
+    if (pread(fd, buf, 11, 0) != 11 || strncmp(buf, "%!PS-Adobe-", 11))
+      return (false);
+
+    // No option code which would need to go into every page
+    if ((code = ppdEmitString(ppd, PPD_ORDER_PAGE, 0.0)) != NULL)
+    {
+      free(code);
+      return (false);
+    }
   }
+  else
+    return (false);
 
-  //
-  // Check whether the PDF input is a banner or test page
-  //
+  // One copy, the filters would do the copies for us
+  if (filter_data->copies > 1)
+    return (false);
 
-  if (strcmp(informat, "application/pdf") == 0 ||
-      strcmp(informat, "application/vnd.cups-pdf") == 0)
+  // No page manipulations requested
+  for (i = 0; i < (int)(sizeof(noop_options) / sizeof(noop_options[0])); i ++)
   {
-    FILE *fp;
-    char *line = NULL;
-    size_t len = 0;
-
-    fp = fdopen(fd, "r");
-    while (getline(&line, &len, fp) != -1)
-      if (strncmp(line, "%%#PDF-BANNER", 13) == 0 ||
-	  strncmp(line, "%%PDF-BANNER", 12) == 0)
-      {
-	papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-		    "Input PDF file is banner or test page file, calling bannertopdf to add printer and job information");
-	is_banner = 1;
-	job_data->filter_data->content_type = "application/vnd.cups-pdf-banner";
+    if ((val = cupsGetOption(noop_options[i][0], filter_data->num_options,
+			     filter_data->options)) == NULL)
+      continue;
+    if ((allowed = noop_options[i][1]) == NULL)
+      return (false);
+    len = strlen(val);
+    while (allowed)
+    {
+      if (strncasecmp(allowed, val, len) == 0 &&
+	  (allowed[len] == ',' || allowed[len] == '\0'))
 	break;
-      }
-    rewind(fp);
-    free(line);
+      if ((allowed = strchr(allowed, ',')) != NULL)
+	allowed ++;
+    }
+    if (!allowed)
+    {
+      _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+		"Option %s=%s requires the job to be filtered",
+		noop_options[i][0], val);
+      return (false);
+    }
   }
 
-  //
-  // Set up filter function chain
-  //
-
-  job_data->chain = cupsArrayNew(NULL, NULL, NULL, 0, NULL, NULL);
-  if (is_banner)
-    cupsArrayAdd(job_data->chain, &banner_filter);
-  for (i = 0; i < conversion->num_filters; i ++)
-    cupsArrayAdd(job_data->chain, &(conversion->filters[i]));
-  if (strlen(filter_path) > 1) // A null filter is a single char, '-'
-                               // or '.', whereas an actual filter has
-                               // a path starting with '/', so at
-                               // least 2 chars.
-  {
-    ppd_filter_params =
-      (cf_filter_external_t *)calloc(1, sizeof(cf_filter_external_t));
-    ppd_filter_params->filter = filter_path;
-    job_data->ppd_filter =
-      (cf_filter_filter_in_chain_t *)calloc(1,
-			                sizeof(cf_filter_filter_in_chain_t));
-    job_data->ppd_filter->function = ppdFilterExternalCUPS;
-    job_data->ppd_filter->parameters = ppd_filter_params;
-    job_data->ppd_filter->name = strrchr(filter_path, '/') + 1;
-    cupsArrayAdd(job_data->chain, job_data->ppd_filter);
-  } else
-    job_data->ppd_filter = NULL;
-  job_data->print =
-    (cf_filter_filter_in_chain_t *)calloc(1,
-					  sizeof(cf_filter_filter_in_chain_t));
-  // Put filter function to send data to PAPPL's built-in backend at the end
-  // of the chain
-  print_params =
-    (pr_print_filter_function_data_t *)
-    calloc(1, sizeof(pr_print_filter_function_data_t));
-  print_params->device = device;
-  print_params->device_uri = job_data->device_uri;
-  print_params->job = job;
-  print_params->global_data = global_data;
-  job_data->print->function = _prPrintFilterFunction;
-  job_data->print->parameters = print_params;
-  job_data->print->name = "Backend";
-  cupsArrayAdd(job_data->chain, job_data->print);
-
-  //
-  // Update status
-  //
+  return (true);
+}
 
-  _prUpdateStatus(papplJobGetPrinter(job), device);
 
-  //
-  // Fire up the filter functions
-  //
+//
+// 'pr_passthrough_write()' - Write a part of the job data to the
+//                            device and to the debug copy file.
+//
 
-  papplJobSetImpressions(job, 1);
+static bool                                   // O - `true` on success
+pr_passthrough_write(pappl_job_t    *job,     // I - Job
+		     pappl_device_t *device,  // I - Device
+		     int            *debug_fd,// IO - Debug copy file, -1 if none
+		     const char     *data,    // I - Data
+		     size_t         len)      // I - Length of data
+{
+  size_t bytes;                               // Bytes of this chunk
 
-  // The filter chain has no output, data is going to the device
-  nullfd = open("/dev/null", O_RDWR);
 
-  // Safety check for filter chain 
-  if (!job_data->chain)
+  while (len > 0)
   {
-    papplLogJob(job, PAPPL_LOGLEVEL_ERROR,
-                "No filter chain available for the print job");
-    close(nullfd);
-    return (false);
+    if (papplJobIsCanceled(job))
+      return (false);
+    if ((bytes = len) > PR_PIPE_SIZE)
+      bytes = PR_PIPE_SIZE;
+    if (papplDeviceWrite(device, data, bytes) < 0)
+      return (false);
+    if (*debug_fd >= 0 && write(*debug_fd, data, bytes) != (ssize_t)bytes)
+    {
+      close(*debug_fd);
+      *debug_fd = -1;
+    }
+    data += bytes;
+    len -= bytes;
   }
 
-  if (cfFilterChain(fd, nullfd, 1, job_data->filter_data, job_data->chain) == 0)
-    ret = true;
-
-  //
-  // Update status
-  //
-
-  _prUpdateStatus(papplJobGetPrinter(job), device);
+  return (true);
+}
 
-  //
-  // Stop the backend and disconnect the job's filter_data from the backend
-  //
 
-  if (strncmp(job_data->device_uri, "cups:", 5) == 0)
-  {
-    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-		"Shutting down CUPS backend");
+//
+// 'pr_dsc_find()' - Find the line starting with a DSC comment in the
+//                   document setup part of PostScript data, NULL if
+//                   the pages or the trailer start before.
+//
 
-    // Stop the backend
-    // We stop it here explicitly as we will free the filter_data structure
-    // and without it the backend shutdoen will not have access to the log
-    // function any more.
-    _prCUPSDevStopBackend(device);
+static const char *                           // O - Line or NULL
+pr_dsc_find(const char *start,                // I - Where to start
+	    const char *end,                  // I - End of data
+	    const char *comment)              // I - DSC comment
+{
+  const char *line,                           // Current line
+             *eol;                            // End of current line
+  size_t     len = strlen(comment);
 
-    // Get the device data
-    device_data = (pr_cups_device_data_t *)papplDeviceGetData(device);
 
-    // Disconnect the filter_data
-    device_data->filter_data = NULL;
+  for (line = start; line < end; line = eol ? eol + 1 : end)
+  {
+    eol = memchr(line, '\n', (size_t)(end - line));
+    if ((size_t)(end - line) >= len && strncmp(line, comment, len) == 0)
+      return (line);
+    if (((size_t)(end - line) >= 7 && strncmp(line, "%%Page:", 7) == 0) ||
+	((size_t)(end - line) >= 9 && strncmp(line, "%%Trailer", 9) == 0))
+      break;
   }
 
-  //
-  // Clean up
-  //
-
-  if (filter_path)
-    free(filter_path);
-  if (ppd_filter_params)
-    free(ppd_filter_params);
-  papplJobDeletePrintOptions(job_options);
-  _prFreeJobData(job_data);
-  close(fd);
-  close(nullfd);
-
-  return (ret);
+  return (NULL);
 }
 
 
 //
-// '_prFreeJobData()' - Clean up job data with PPD options.
+// 'pr_dsc_next_line()' - Get the start of the line after the one at
+//                        "line".
 //
 
-void _prFreeJobData(pr_job_data_t *job_data)
+static const char *                           // O - Next line
+pr_dsc_next_line(const char *line,            // I - Line
+		 const char *end)             // I - End of data
 {
-  ppd_filter_data_ext_t *filter_data_ext =
-    (ppd_filter_data_ext_t *)cfFilterDataRemoveExt(job_data->filter_data,
-						   PPD_FILTER_DATA_EXT);
-
-  unsetenv("PRINTER");
-  unsetenv("PRINTER_LOCATION");
-
-  if (job_data->global_data->config->components & PR_COPTIONS_CUPS_BACKENDS)
-    cfFilterCloseBackAndSidePipes(job_data->filter_data);
-
-  if (filter_data_ext)
-    free(filter_data_ext);
+  const char *eol = memchr(line, '\n', (size_t)(end - line));
 
-  free(job_data->filter_data->printer);
-  free(job_data->filter_data->job_user);
-  free(job_data->filter_data->job_title);
-  ppdFilterFreePPD(job_data->filter_data);
-  cupsFreeOptions(job_data->filter_data->num_options,
-		  job_data->filter_data->options);
-  free(job_data->filter_data);
-  
-  if (job_data->ppd_filter)
-    free(job_data->ppd_filter);
-  if (job_data->print)
-  {
-    free(job_data->print->parameters);
-    free(job_data->print);
-  }
-  if (job_data->chain)
-    cupsArrayDelete(job_data->chain);
-  free(job_data);
+  return (eol ? eol + 1 : end);
 }
 
 
 //
-// '_prJobIsCanceled()' - Return 1 if the job is canceled, which is
-//                        the case when papplJobIsCanceled() returns
-//                        true.
+// 'pr_passthrough_job()' - Send a job which pr_passthrough_possible()
+//                          has approved directly to the device,
+//                          wrapped by the PPD's JCL and, for
+//                          PostScript, with the PPD's option code
+//                          inserted into the prolog and setup
+//                          sections like pstops does. The input
+//                          file is memory-mapped, for CUPS backends
+//                          it is moved into the backend's pipe with
+//                          sendfile().
 //
 
-int
-_prJobIsCanceled(void *data)
+static bool                                   // O - `true` on success
+pr_passthrough_job(pappl_job_t    *job,       // I - Job
+		   pappl_device_t *device,    // I - Device
+		   pr_job_data_t  *job_data,  // I - Job data
+		   int            fd,         // I - Input file
+		   bool           is_ps)      // I - PostScript input?
 {
-  pappl_job_t *job = (pappl_job_t *)data;
+  ppd_file_t       *ppd = job_data->ppd;
+  pr_cups_device_data_t *device_data;         // Data of CUPS backend device
+  char             debug_copy[2048];          // Name for debug copy
+  int              debug_fd = -1;             // Debug copy file
+  struct stat      fileinfo;                  // Input file information
+  char             *data = NULL;              // Mapped input file
+  size_t           header_len = 0;            // Length of the input going
+                                              // into the prefix (DSC header,
+                                              // prolog and setup)
+  const char       *ptr, *end,
+                   *prolog, *prolog_end,      // %%BeginProlog/%%EndProlog
+                   *setup, *setup_end;        // %%BeginSetup/%%EndSetup
+  char             *prefix = NULL,            // JCL and option code
+                   *suffix = NULL,            // JCL end
+                   *code;                     // PPD option code
+  size_t           prefix_len = 0,
+                   suffix_len = 0;
+  FILE             *fp;
+  const char       *job_name = papplJobGetName(job);
+  bool             ret = false;
+
+
+  if (fstat(fd, &fileinfo) || fileinfo.st_size <= 0 ||
+      (data = mmap(NULL, (size_t)fileinfo.st_size, PROT_READ, MAP_SHARED,
+		   fd, 0)) == MAP_FAILED)
+  {
+    _prLogJob(job, PAPPL_LOGLEVEL_ERROR,
+	      "Unable to map input file: %s", strerror(errno));
+    return (false);
+  }
+
+  // Job data start: JCL, for PostScript the DSC header, prolog and
+  // setup with the option code
+  if ((fp = open_memstream(&prefix, &prefix_len)) != NULL)
+  {
+    if (is_ps)
+    {
+      ppdEmitJCL(ppd, fp, papplJobGetID(job), papplJobGetUsername(job),
+		 job_name ? job_name : "Unknown");
+
+      // The header ends with "%%EndComments" or with the first line
+      // which is not a comment
+      end = data + fileinfo.st_size;
+      for (ptr = data; ptr < end;)
+      {
+	const char *line = ptr;               // Current line
+	size_t     len = (size_t)(end - line);// Bytes left
+
+	if (line != data &&
+	    (len < 2 || line[0] != '%' || (line[1] != '%' && line[1] != '!')))
+	  break;
+	ptr = pr_dsc_next_line(line, end);
+	if (len >= 13 && strncmp(line, "%%EndComments", 13) == 0)
+	  break;
+      }
+      fwrite(data, 1, (size_t)(ptr - data), fp);
+      if (ptr > data && ptr[-1] != '\n')
+	fputc('\n', fp);
+
+      // Prolog and setup sections of the document, if any
+      if ((prolog = pr_dsc_find(ptr, end, "%%BeginProlog")) == NULL ||
+	  (prolog_end = pr_dsc_find(prolog, end, "%%EndProlog")) == NULL)
+	prolog = prolog_end = NULL;
+      if ((setup = pr_dsc_find(prolog_end ? prolog_end : ptr, end,
+			       "%%BeginSetup")) == NULL ||
+	  (setup_end = pr_dsc_find(setup, end, "%%EndSetup")) == NULL)
+	setup = setup_end = NULL;
+
+      // Prolog with the patches and the prolog option code first
+      if (prolog)
+	fwrite(ptr, 1, (size_t)(prolog - ptr), fp);
+      fputs("%%BeginProlog\n", fp);
+      if (ppd->patches)
+      {
+	fputs("%%BeginFeature: *JobPatchFile 1\n", fp);
+	fputs(ppd->patches, fp);
+	fputs("\n%%EndFeature\n", fp);
+      }
+      if ((code = ppdEmitString(ppd, PPD_ORDER_PROLOG, 0.0)) != NULL)
+      {
+	fputs(code, fp);
+	free(code);
+      }
+      if (prolog)
+      {
+	ptr = pr_dsc_next_line(prolog, end);
+	fwrite(ptr, 1, (size_t)(prolog_end - ptr), fp);
+	ptr = pr_dsc_next_line(prolog_end, end);
+      }
+      fputs("%%EndProlog\n", fp);
+
+      // Setup with the document option code first
+      if (setup)
+	fwrite(ptr, 1, (size_t)(setup - ptr), fp);
+      fputs("%%BeginSetup\n", fp);
+      if ((code = ppdEmitString(ppd, PPD_ORDER_DOCUMENT, 0.0)) != NULL)
+      {
+	fputs(code, fp);
+	free(code);
+      }
+      if ((code = ppdEmitString(ppd, PPD_ORDER_ANY, 0.0)) != NULL)
+      {
+	fputs(code, fp);
+	free(code);
+      }
+      if (setup)
+      {
+	ptr = pr_dsc_next_line(setup, end);
+	fwrite(ptr, 1, (size_t)(setup_end - ptr), fp);
+	ptr = pr_dsc_next_line(setup_end, end);
+      }
+      fputs("%%EndSetup\n", fp);
+
+      header_len = (size_t)(ptr - data);
+    }
+    else
+      ppdEmitJCLPDF(ppd, fp, papplJobGetID(job), papplJobGetUsername(job),
+		    job_name ? job_name : "Unknown");
+    fclose(fp);
+  }
+
+  // Job data end: JCL end
+  if ((fp = open_memstream(&suffix, &suffix_len)) != NULL)
+  {
+    ppdEmitJCLEnd(ppd, fp);
+    fclose(fp);
+  }
+
+  if (!prefix || !suffix)
+  {
+    _prLogJob(job, PAPPL_LOGLEVEL_ERROR,
+	      "Unable to create JCL for the job: %s", strerror(errno));
+    goto done;
+  }
+
+  _prLogJob(job, PAPPL_LOGLEVEL_INFO,
+	    "Job data needs no conversion, sending it to the printer as is (%ld bytes)",
+	    (long)fileinfo.st_size);
+
+  if (_prRegisterDebugCopy(job_data->global_data, job, debug_copy,
+			   sizeof(debug_copy)))
+    debug_fd = open(debug_copy, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR);
+
+  if (!pr_passthrough_write(job, device, &debug_fd, prefix, prefix_len))
+    goto done;
+
+  ptr = data + header_len;
+  end = data + fileinfo.st_size;
+
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+  // CUPS backends read from a pipe, let the kernel move the data into it
+  if (debug_fd < 0 &&
+      strncmp(job_data->device_uri, "cups:", 5) == 0 &&
+      (device_data = (pr_cups_device_data_t *)papplDeviceGetData(device)) !=
+      NULL &&
+      (device_data->backend_pid || _prCUPSDevLaunchBackend(device)))
+  {
+    off_t   offset = (off_t)header_len;       // Position in input file
+    ssize_t bytes;                            // Bytes moved
+
+    papplDeviceFlush(device);
+    while (offset < fileinfo.st_size && !papplJobIsCanceled(job))
+    {
+      if ((bytes = sendfile(device_data->inputfd, fd, &offset,
+			    (size_t)(fileinfo.st_size - offset))) < 0)
+      {
+	if (errno == EINTR || errno == EAGAIN)
+	  continue;
+	break;
+      }
+      else if (bytes == 0)
+	break;
+    }
+    ptr = data + offset;	// Write the rest (if any) conventionally
+  }
+#else
+  (void)device_data;
+#endif // HAVE_SENDFILE && HAVE_SYS_SENDFILE_H
+
+  if (!pr_passthrough_write(job, device, &debug_fd, ptr, (size_t)(end - ptr)) ||
+      !pr_passthrough_write(job, device, &debug_fd, suffix, suffix_len))
+    goto done;
+
+  papplDeviceFlush(device);
+  papplJobSetImpressionsCompleted(job, 1);
+  ret = true;
+
+ done:
+  if (!ret && !papplJobIsCanceled(job))
+    _prLogJob(job, PAPPL_LOGLEVEL_ERROR,
+	      "Unable to send data to printer.");
+  if (debug_fd >= 0)
+    close(debug_fd);
+  free(prefix);
+  free(suffix);
+  munmap(data, (size_t)fileinfo.st_size);
+
+  return (ret);
+}
+#endif // HAVE_OPEN_MEMSTREAM
+
+
+//
+// 'pr_parallel_chunks()' - Check whether a job in spooling mode can be
+//                          rendered page-parallel and into how many
+//                          chunks it should be split. This is the case
+//                          for PDF input converted to CUPS or PWG
+//                          Raster, as Raster streams of page ranges
+//                          can simply be concatenated, if the job has
+//                          only one copy, no banner, and no options
+//                          which make pages depend on each other
+//                          (page ranges, N-up, booklet, ...). The
+//                          conversion has to start with pdftopdf, as
+//                          this is the filter which applies the page
+//                          range of each chunk. Every chunk beyond
+//                          the first needs a render slot of its own,
+//                          the job's slot covers the first, so the
+//                          number of chunks is capped to the slots
+//                          which are free. pr_parallel_render() gives
+//                          the extra slots back. Returns 0 if the job
+//                          should be rendered in one piece.
+//
+
+static int                                    // O - Number of chunks
+pr_parallel_chunks(
+    pappl_job_t              *job,            // I - Job
+    pr_job_data_t            *job_data,       // I - Job data
+    pr_spooling_conversion_t *conversion,     // I - Spooling conversion
+    const char               *filename,       // I - Input file
+    int                      *num_pages)      // O - Pages in the job
+{
+  pr_printer_app_global_data_t *global_data = job_data->global_data;
+  cf_filter_data_t *filter_data = job_data->filter_data;
+  const char       *val;
+  int              num_chunks,
+                   slots,
+                   i;
+  static const char * const page_options[] =
+  {                                           // Options which make us render
+                                              // in one piece
+    "page-ranges",
+    "page-set",
+    "number-up",
+    "booklet",
+    "output-order"
+  };
+
+
+  *num_pages = 0;
+
+  if (global_data->render_workers < 2 ||
+      strcmp(filter_data->content_type, "application/pdf") ||
+      (strcmp(conversion->dsttype, "application/vnd.cups-raster") &&
+       strcmp(conversion->dsttype, "image/pwg-raster")) ||
+      filter_data->copies > 1 ||
+      conversion->num_filters < 1 ||
+      (conversion->filters[0].function != ppdFilterPDFToPDF &&
+       conversion->filters[0].function != cfFilterPDFToPDF))
+    return (0);
+
+  for (i = 0; i < (int)(sizeof(page_options) / sizeof(page_options[0])); i ++)
+    if ((val = cupsGetOption(page_options[i], filter_data->num_options,
+			     filter_data->options)) != NULL &&
+	strcmp(val, "1") && strcasecmp(val, "all") &&
+	strcasecmp(val, "off") && strcasecmp(val, "normal"))
+      return (0);
+
+  if ((*num_pages = cfPDFPages(filename)) < 2 * PR_RENDER_CHUNK_PAGES)
+    return (0);
+
+  if ((num_chunks = *num_pages / PR_RENDER_CHUNK_PAGES) >
+      global_data->render_workers)
+    num_chunks = global_data->render_workers;
+  if (num_chunks > PR_MAX_RENDER_CHUNKS)
+    num_chunks = PR_MAX_RENDER_CHUNKS;
+
+  for (slots = 1;
+       slots < num_chunks &&
+	 _prGovernorTryAcquire(global_data, papplJobGetPrinter(job));
+       slots ++);
+  if (slots < 2)
+  {
+    _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	      "No free render slots for rendering the job in parallel chunks");
+    return (0);
+  }
+  num_chunks = slots;
+
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	    "Rendering the %d pages of the job in %d parallel chunks",
+	    *num_pages, num_chunks);
+
+  return (num_chunks);
+}
+
+
+//
+// 'pr_concat_chunks()' - Filter function which sends the Raster output
+//                        of the chunks of a page-parallel job in order
+//                        to its output, as soon as each chunk is
+//                        complete. The synchronization word at the
+//                        beginning of each chunk's Raster stream gets
+//                        dropped, except for the first one, so that
+//                        the driver sees a single stream.
+//
+
+static int                                    // O - Error status
+pr_concat_chunks(int inputfd,                 // I - Input (unused)
+		 int outputfd,                // I - Output stream
+		 int inputseekable,           // I - Is input seekable? (unused)
+		 cf_filter_data_t *data,      // I - Job and printer data
+		 void *parameters)            // I - Chunks
+{
+  pr_render_chunks_t *chunks = (pr_render_chunks_t *)parameters;
+  cf_logfunc_t     log = data->logfunc;
+  void             *ld = data->logdata;
+  char             status,                    // Completion status of chunk
+                   buffer[65536];
+  ssize_t          bytes;
+  int              i,
+                   fd,
+                   ret = 0;
+
+
+  (void)inputseekable;
+  close(inputfd);
+
+  for (i = 0; i < chunks->num_chunks && !ret; i ++)
+  {
+    // Wait for the chunk to be complete
+    while ((bytes = read(chunks->chunks[i].status_fd, &status, 1)) < 0 &&
+	   errno == EINTR);
+    if (bytes != 1)
+    {
+      if (log)
+	log(ld, CF_LOGLEVEL_ERROR,
+	    "Parallel rendering: Chunk %d failed", i + 1);
+      ret = 1;
+      break;
+    }
+
+    if ((fd = open(chunks->chunks[i].filename, O_RDONLY)) < 0)
+    {
+      ret = 1;
+      break;
+    }
+
+    if (log)
+      log(ld, CF_LOGLEVEL_DEBUG,
+	  "Parallel rendering: Sending out chunk %d (pages %d-%d)", i + 1,
+	  chunks->chunks[i].first_page, chunks->chunks[i].last_page);
+
+    // Drop the synchronization word of all but the first Raster stream
+    if (i > 0 &&
+	(read(fd, buffer, 4) != 4 ||
+	 (memcmp(buffer, "RaS", 3) && memcmp(buffer + 1, "SaR", 3))))
+    {
+      if (log)
+	log(ld, CF_LOGLEVEL_ERROR,
+	    "Parallel rendering: Chunk %d is not a Raster stream", i + 1);
+      close(fd);
+      ret = 1;
+      break;
+    }
+
+    while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
+      if (write(outputfd, buffer, (size_t)bytes) != bytes)
+      {
+	ret = 1;
+	break;
+      }
+    close(fd);
+  }
+
+  close(outputfd);
+  return (ret);
+}
+
+
+//
+// 'pr_chunks_signal()' - Send a signal to the process groups of the
+//                        chunks of a page-parallel job, so that the
+//                        filters which they have started get it, too.
+//
+
+static void
+pr_chunks_signal(pr_render_chunks_t *chunks,	// I - Chunks
+		 int                sig)	// I - Signal
+{
+  int i;
+
+
+  for (i = 0; i < chunks->num_chunks; i ++)
+    if (chunks->chunks[i].pid > 0)
+      killpg(chunks->chunks[i].pid, sig);
+}
+
+
+//
+// 'pr_chunks_watchdog()' - Thread stopping the chunks of a
+//                          page-parallel job when the job gets
+//                          canceled. The chunks are forked before the
+//                          cancel and so never see the cancel flag by
+//                          themselves. They get SIGTERM and, after
+//                          PR_CANCEL_GRACE_PERIOD, SIGKILL.
+//
+
+static void *				// O - Thread exit status (unused)
+pr_chunks_watchdog(void *data)		// I - Chunks
+{
+  pr_render_chunks_t *chunks = (pr_render_chunks_t *)data;
+  struct timespec    timeout;		// Time to wake up
+  double             now,		// Current time
+                     canceled = 0.0;	// Time the cancel was seen
+
+
+  pthread_mutex_lock(&chunks->mutex);
+  while (!chunks->done)
+  {
+    now = _prGetCurrentTime();
+    if (canceled == 0.0 && papplJobIsCanceled(chunks->job))
+    {
+      _prLogJob(chunks->job, PAPPL_LOGLEVEL_INFO,
+		"Job canceled, stopping the parallel rendering");
+      canceled = now;
+    }
+    if (canceled > 0.0)
+    {
+      if (now - canceled < PR_CANCEL_GRACE_PERIOD)
+	pr_chunks_signal(chunks, SIGTERM);
+      else
+      {
+	pr_chunks_signal(chunks, SIGKILL);
+	break;
+      }
+    }
+
+    now += PR_CANCEL_POLL_INTERVAL / 1000000.0;
+    timeout.tv_sec  = (time_t)now;
+    timeout.tv_nsec = (long)((now - timeout.tv_sec) * 1000000000.0);
+    pthread_cond_timedwait(&chunks->cond, &chunks->mutex, &timeout);
+  }
+  pthread_mutex_unlock(&chunks->mutex);
+
+  return (NULL);
+}
+
+
+//
+// 'pr_parallel_render()' - Render a job in chunks of page ranges, each
+//                          chunk through its own instance of the
+//                          conversion filters in a sub-process, to
+//                          make use of all CPU cores. The output of
+//                          the chunks goes into temporary files, from
+//                          which pr_concat_chunks() feeds them in
+//                          order into the rest of the chain, the
+//                          printer driver filter and the device.
+//                          Gives back the extra render slots which
+//                          pr_parallel_chunks() has taken.
+//
+
+static bool                                   // O - `true` on success
+pr_parallel_render(pappl_job_t              *job,
+		                              // I - Job
+		   pr_job_data_t            *job_data,
+		                              // I - Job data
+		   pr_spooling_conversion_t *conversion,
+		                              // I - Spooling conversion
+		   const char               *filename,
+		                              // I - Input file
+		   int                      nullfd,
+		                              // I - /dev/null
+		   int                      num_chunks,
+		                              // I - Number of chunks, one
+		                              //     render slot each
+		   int                      num_pages)
+		                              // I - Number of pages
+{
+  pr_printer_app_global_data_t *global_data = job_data->global_data;
+  cf_filter_data_t   *filter_data = job_data->filter_data;
+  pr_render_chunks_t chunks;                  // Chunks of the job
+  pr_render_chunk_t  *chunk;
+  cf_filter_filter_in_chain_t concat_filter = // Sends out the chunks
+  {
+    pr_concat_chunks,
+    &chunks,
+    "concat"
+  };
+  cups_array_t       *chain;                  // Filter chain for the chunks
+  const char         *content_type;
+  int                pages_per_chunk,
+                     status_pipe[2],
+                     outfd,
+                     infd,
+                     i,
+                     status;                  // Exit status of chunk filters
+  char               buf[64];
+  pthread_t          watch_thread;            // Cancel watchdog
+  bool               watching = false,
+                     ret = false;
+
+
+  memset(&chunks, 0, sizeof(chunks));
+  chunks.job = job;
+  pthread_mutex_init(&chunks.mutex, NULL);
+  pthread_cond_init(&chunks.cond, NULL);
+  papplJobSetImpressions(job, num_pages);
+
+  // Chunks of an even number of pages, to not disturb duplex
+  pages_per_chunk = (num_pages + num_chunks - 1) / num_chunks;
+  pages_per_chunk += pages_per_chunk % 2;
+
+  for (i = 0; i < num_chunks && (i * pages_per_chunk) < num_pages; i ++)
+  {
+    chunk = chunks.chunks + i;
+    chunk->first_page = i * pages_per_chunk + 1;
+    if ((chunk->last_page = (i + 1) * pages_per_chunk) > num_pages)
+      chunk->last_page = num_pages;
+    chunk->status_fd = -1;
+    chunks.num_chunks ++;
+
+    snprintf(chunk->filename, sizeof(chunk->filename),
+	     "%s/render-%s-%d-%d-XXXXXX", global_data->spool_dir,
+	     papplPrinterGetName(papplJobGetPrinter(job)), papplJobGetID(job),
+	     i + 1);
+    if ((outfd = mkstemp(chunk->filename)) < 0)
+    {
+      _prLogJob(job, PAPPL_LOGLEVEL_ERROR,
+		"Unable to create temporary file for parallel rendering: %s",
+		strerror(errno));
+      chunk->filename[0] = '\0';
+      goto done;
+    }
+
+    if (pipe(status_pipe))
+    {
+      close(outfd);
+      goto done;
+    }
+
+    if ((chunk->pid = fork()) == 0)
+    {
+      // Child: Render the pages of this chunk with the conversion filters,
+      // in its own process group, to stop the filters which it starts
+      // together with it
+      setpgid(0, 0);
+      close(status_pipe[0]);
+      if ((infd = open(filename, O_RDONLY)) < 0)
+	_exit(1);
+      snprintf(buf, sizeof(buf), "%d-%d", chunk->first_page,
+	       chunk->last_page);
+      filter_data->num_options =
+	cupsAddOption("page-ranges", buf, filter_data->num_options,
+		      &(filter_data->options));
+      chain = cupsArrayNew(NULL, NULL, NULL, 0, NULL, NULL);
+      for (i = 0; i < conversion->num_filters; i ++)
+	cupsArrayAdd(chain, &(conversion->filters[i]));
+      status = cfFilterChain(infd, outfd, 1, filter_data, chain);
+      _prLogSinkFlush();
+      if (status != 0)
+	_exit(1);
+      // Tell pr_concat_chunks() that we are done
+      if (write(status_pipe[1], "", 1) != 1)
+	_exit(1);
+      _exit(0);
+    }
+
+    close(outfd);
+    close(status_pipe[1]);
+    chunk->status_fd = status_pipe[0];
+    if (chunk->pid < 0)
+    {
+      _prLogJob(job, PAPPL_LOGLEVEL_ERROR,
+		"Unable to start rendering process: %s", strerror(errno));
+      chunk->pid = 0;
+      goto done;
+    }
+    // Also here, to not depend on whether the child got scheduled yet
+    setpgid(chunk->pid, chunk->pid);
+    _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	      "Rendering pages %d-%d in process %d", chunk->first_page,
+	      chunk->last_page, (int)chunk->pid);
+  }
+
+  watching = (pthread_create(&watch_thread, NULL, pr_chunks_watchdog,
+			     &chunks) == 0);
+
+  // Feed the chunks' output into the printer driver and to the device
+  chain = cupsArrayNew(NULL, NULL, NULL, 0, NULL, NULL);
+  cupsArrayAdd(chain, &concat_filter);
+  if (job_data->ppd_filter)
+    cupsArrayAdd(chain, job_data->ppd_filter);
+  cupsArrayAdd(chain, job_data->print);
+  content_type = filter_data->content_type;
+  filter_data->content_type = conversion->dsttype;
+  ret = (cfFilterChain(nullfd, nullfd, 0, filter_data, chain) == 0);
+  filter_data->content_type = content_type;
+  cupsArrayDelete(chain);
+
+ done:
+  if (watching)
+  {
+    pthread_mutex_lock(&chunks.mutex);
+    chunks.done = true;
+    pthread_cond_signal(&chunks.cond);
+    pthread_mutex_unlock(&chunks.mutex);
+    pthread_join(watch_thread, NULL);
+  }
+  pthread_mutex_destroy(&chunks.mutex);
+  pthread_cond_destroy(&chunks.cond);
+
+  // Stop chunks which are still running after a failure or cancel,
+  // together with the filters which they have started
+  if (!ret)
+    pr_chunks_signal(&chunks, SIGTERM);
+  for (i = 0; i < chunks.num_chunks; i ++)
+  {
+    chunk = chunks.chunks + i;
+    if (chunk->pid > 0)
+      while (waitpid(chunk->pid, NULL, 0) < 0 && errno == EINTR);
+    if (chunk->status_fd >= 0)
+      close(chunk->status_fd);
+    if (chunk->filename[0])
+      unlink(chunk->filename);
+  }
+
+  // The job keeps its own slot for the rest of its documents
+  for (i = 1; i < num_chunks; i ++)
+    _prGovernorRelease(global_data, papplJobGetPrinter(job));
+
+  return (ret);
+}
+
+
+//
+// 'pr_progress_page()' - Record a "PAGE:" message of the filters in the
+//                        job's progress. Called in the filter's
+//                        process.
+//
+
+static void
+pr_progress_page(pr_job_progress_t *progress,// I - Progress of the job
+		 int               copies)	// I - Impressions of the page
+{
+  int slot = progress->logs % PR_PROGRESS_WINDOW;
+					// Slot for the page
+
+
+  progress->pages        += copies;
+  progress->times[slot]  = _prGetCurrentTime();
+  progress->counts[slot] = progress->pages;
+  progress->logs ++;
+}
+
+
+//
+// 'pr_progress_report()' - Pass the progress of a job on to PAPPL:
+//                          Completed impressions and, as job state
+//                          message, the page rate and the estimated
+//                          time to completion. Called in the job's
+//                          process.
+//
+
+static void
+pr_progress_report(pappl_job_t       *job,	// I - Job
+		   pr_job_progress_t *progress)	// I - Progress of the job
+{
+  int    pages = progress->pages,	// Impressions completed
+         logs = progress->logs,		// "PAGE:" messages received
+         total,				// Impressions of the job
+         newest,			// Slot of latest page
+         oldest,			// Slot of oldest page in window
+         remaining;			// Estimated seconds to completion
+  double rate = 0.0,			// Current pages per minute
+         average = 0.0;			// Average pages per minute
+
+
+  if (pages <= progress->reported || logs == 0)
+    return;
+
+  papplJobSetImpressionsCompleted(job, pages - progress->reported);
+  progress->reported = pages;
+
+  newest = (logs - 1) % PR_PROGRESS_WINDOW;
+  oldest = logs > PR_PROGRESS_WINDOW ? logs % PR_PROGRESS_WINDOW : 0;
+  if (progress->times[newest] > progress->start)
+    average = 60.0 * pages / (progress->times[newest] - progress->start);
+  if (newest != oldest &&
+      progress->times[newest] > progress->times[oldest])
+    rate = 60.0 * (progress->counts[newest] - progress->counts[oldest]) /
+      (progress->times[newest] - progress->times[oldest]);
+  else
+    rate = average;
+
+  if ((total = papplJobGetImpressions(job)) > pages && rate > 0.0)
+  {
+    remaining = (int)(60.0 * (total - pages) / rate);
+    papplJobSetMessage(job,
+		       "Printed %d of %d pages, %.1f pages/min (average %.1f), about %d:%02d left",
+		       pages, total, rate, average, remaining / 60,
+		       remaining % 60);
+  }
+  else
+    papplJobSetMessage(job, "Printed %d pages, %.1f pages/min (average %.1f)",
+		       pages, rate, average);
+}
+
+
+//
+// 'pr_cancel_signal()' - Send a signal to the process groups of the
+//                        filters of a chain which are still running.
+//                        Returns the number of filters signalled.
+//
+
+static int				// O - Filters still running
+pr_cancel_signal(pr_cancel_watch_t *watch,// I - Watchdog data
+		 int               sig)	// I - Signal
+{
+  int i,				// Looping var
+      running = 0;			// Filters still running
+
+
+  for (i = 0; i < watch->num_filters; i ++)
+    if (!watch->filters[i].done && watch->filters[i].pgid > 0 &&
+	killpg(watch->filters[i].pgid, sig) == 0)
+      running ++;
+
+  return (running);
+}
+
+
+//
+// 'pr_cancel_watchdog()' - Thread stopping the filters of a job
+//                          actively when the job gets canceled,
+//                          instead of waiting for them to check the
+//                          cancel flag by themselves. The filters
+//                          get SIGTERM and, if they are still running
+//                          after PR_CANCEL_GRACE_PERIOD, SIGKILL, all
+//                          programs they have started included.
+//
+
+static void *				// O - Thread exit status (unused)
+pr_cancel_watchdog(void *data)		// I - Watchdog data
+{
+  pr_cancel_watch_t *watch = (pr_cancel_watch_t *)data;
+  struct timespec   timeout;		// Time to wake up
+  double            now,		// Current time
+                    last_report = 0.0;	// Time of last progress report
+  bool              killed = false;	// SIGKILL sent?
+
+
+  pthread_mutex_lock(&watch->mutex);
+  while (!watch->done)
+  {
+    now = _prGetCurrentTime();
+    if (watch->progress && now - last_report >= PR_PROGRESS_INTERVAL)
+    {
+      pr_progress_report(watch->job, watch->progress);
+      last_report = now;
+    }
+    if (watch->canceled == 0.0 && papplJobIsCanceled(watch->job))
+    {
+      _prLogJob(watch->job, PAPPL_LOGLEVEL_INFO,
+		"Job canceled, stopping the filters");
+      watch->canceled = now;
+    }
+    if (watch->canceled > 0.0 && !killed)
+    {
+      // Repeat SIGTERM as filters which were just forked may not have
+      // had their process group when we checked before
+      if (now - watch->canceled < PR_CANCEL_GRACE_PERIOD)
+	pr_cancel_signal(watch, SIGTERM);
+      else
+      {
+	if (pr_cancel_signal(watch, SIGKILL) > 0)
+	  _prLogJob(watch->job, PAPPL_LOGLEVEL_WARN,
+		    "Filters did not stop within %d seconds, killed them",
+		    PR_CANCEL_GRACE_PERIOD);
+	killed = true;
+      }
+    }
+
+    now += PR_CANCEL_POLL_INTERVAL / 1000000.0;
+    timeout.tv_sec  = (time_t)now;
+    timeout.tv_nsec = (long)((now - timeout.tv_sec) * 1000000000.0);
+    pthread_cond_timedwait(&watch->cond, &watch->mutex, &timeout);
+  }
+  pthread_mutex_unlock(&watch->mutex);
+
+  return (NULL);
+}
+
+
+//
+// 'pr_cancel_device()' - Release the device after the job got
+//                        canceled: Send the PPD's JCL end, which
+//                        resets the printer's interpreter after an
+//                        incomplete job, and stop a CUPS backend
+//                        without waiting for it to finish on its own.
+//
+
+static void
+pr_cancel_device(pappl_job_t    *job,	// I - Job
+		 pr_job_data_t  *job_data,// I - Job data
+		 pappl_device_t *device)// I - Device
+{
+  double start = _prGetCurrentTime();	// Time we started
+
+
+#ifdef HAVE_OPEN_MEMSTREAM
+  char   *reset = NULL;			// Reset sequence
+  size_t reset_len = 0;			// Length of reset sequence
+  FILE   *fp;				// Stream to create reset sequence
+
+  if (job_data->ppd && job_data->ppd->jcl_end &&
+      (fp = open_memstream(&reset, &reset_len)) != NULL)
+  {
+    ppdEmitJCLEnd(job_data->ppd, fp);
+    fclose(fp);
+    if (reset_len > 0)
+    {
+      _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+		"Sending JCL end to reset the printer");
+      if (papplDeviceWrite(device, reset, reset_len) < 0)
+	_prLogJob(job, PAPPL_LOGLEVEL_WARN,
+		  "Unable to send JCL end to the printer");
+      papplDeviceFlush(device);
+    }
+    free(reset);
+  }
+#endif // HAVE_OPEN_MEMSTREAM
+
+  if (strncmp(job_data->device_uri, "cups:", 5) == 0)
+    _prCUPSDevCancelBackend(device, PR_CANCEL_GRACE_PERIOD);
+
+  _prLogJob(job, PAPPL_LOGLEVEL_INFO,
+	    "Device released after cancel (%.2f seconds)",
+	    _prGetCurrentTime() - start);
+}
+
+
+//
+// 'pr_replay_copies()' - Check whether the copies of the job can be
+//                        made by rendering the job once and sending
+//                        the print-ready result to the printer for
+//                        each copy. This is the case if the printer
+//                        has no hardware copies (the filters would
+//                        render each copy again) and the copies are
+//                        collated, so that each copy is the complete
+//                        document. If so, the filters are told to
+//                        produce a single copy. Returns the number of
+//                        copies to replay, 1 for no replay.
+//
+
+static int				// O - Copies to replay
+pr_replay_copies(pappl_job_t   *job,	// I - Job
+		 pr_job_data_t *job_data)	// I - Job data
+{
+  cf_filter_data_t *filter_data = job_data->filter_data;
+  const char       *val;		// Option value
+  int              copies;		// Copies requested
+
+
+  if (filter_data->copies < 2 || !job_data->ppd ||
+      !job_data->ppd->manual_copies ||
+      (val = cupsGetOption("Collate", filter_data->num_options,
+			   filter_data->options)) == NULL ||
+      strcasecmp(val, "True"))
+    return (1);
+
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	    "Rendering the job once and sending it %d times for the copies",
+	    filter_data->copies);
+  copies = filter_data->copies;
+  filter_data->copies = 1;
+
+  return (copies);
+}
+
+
+//
+// 'pr_replay_to_device()' - Send the print-ready output of one copy
+//                           to the device for each copy. Each pass
+//                           contains the complete job with its JCL,
+//                           so the copies are collated.
+//
+
+static bool				// O - `true` on success
+pr_replay_to_device(
+    pappl_job_t                     *job,	  // I - Job
+    pr_job_data_t                   *job_data,	  // I - Job data
+    pr_print_filter_function_data_t *print_params,// I - Backend parameters
+    int                             fd,		  // I - Output of one copy
+    int                             copies)	  // I - Number of copies
+{
+  pr_print_filter_function_data_t params = *print_params;
+					// Parameters for sending the copies
+  int                             i,
+                                  copyfd; // Input for one pass
+
+
+  // The copies go to the device, not into files
+  params.cache_file[0]  = '\0';
+  params.replay_file[0] = '\0';
+  params.replay         = NULL;
+
+  for (i = 1; i <= copies && !papplJobIsCanceled(job); i ++)
+  {
+    if (lseek(fd, 0, SEEK_SET) < 0 || (copyfd = dup(fd)) < 0)
+    {
+      _prLogJob(job, PAPPL_LOGLEVEL_ERROR,
+		"Unable to re-read the job for copy %d: %s", i,
+		strerror(errno));
+      return (false);
+    }
+    _prLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Sending copy %d of %d", i,
+	      copies);
+    // _prPrintFilterFunction() closes both file descriptors
+    if (_prPrintFilterFunction(copyfd, open("/dev/null", O_WRONLY), 1,
+			       job_data->filter_data, &params) != 0)
+      return (false);
+    // Debug copy with only one copy of the job
+    params.debug_copy[0] = '\0';
+  }
+
+  return (true);
+}
+
+
+//
+// 'pr_filter_document()' - Convert one document of a job and send it
+//                          to the device, or, when rendering a job
+//                          ahead of time, into a file.
+//
+
+static bool				// O - `true` on success
+pr_filter_document(
+    pappl_job_t    *job,		// I - Job
+    pappl_device_t *device,		// I - Device
+    pr_printer_app_global_data_t *global_data,
+					// I - Global data
+    pr_job_data_t  *job_data,		// I - Job data
+    int            doc,			// I - Document number
+    int            doc_copies,		// I - Copies of the document
+    bool           first,		// I - First document sent?
+    const char     *output_file)	// I - File for rendering ahead of
+					//     time, NULL for the device
+{
+  const char            *informat;
+  const char		*filename;	// Input filename
+  int			fd;		// Input file descriptor
+  pappl_pr_driver_data_t driver_data;  // Printer's driver data
+  pr_conversion_alternative_t alternative; // Copy of the conversion
+                                        // chosen for the document
+  pr_spooling_conversion_t *conversion; // Spooling conversion to use
+                                        // for pre-filtering
+  char                  *filter_path = NULL; // Filter from PPD to use for
+                                        // this job
+  int                   nullfd = -1;    // File descriptor for /dev/null
+  char                  cache_key[PR_OUTPUT_CACHE_KEY_SIZE];
+                                        // Key for the output cache
+  int                   cache_fd;       // Cached output of identical job
+  int                   num_chunks,     // Chunks for parallel rendering
+                        num_pages;      // Pages of the job
+  pr_chain_stats_t      *chain_stats;   // Instrumented filter chain
+  struct stat           fileinfo;       // Input file information
+  pr_job_progress_t     *progress = NULL;// Page progress of the job
+  pr_cancel_watch_t     watch;          // Cancel watchdog data
+  pthread_t             watch_thread;   // Cancel watchdog
+  bool                  watching = false;// Cancel watchdog running?
+  int                   copies;         // Copies to send of a job rendered
+                                        // only once
+  bool			ret = false;	// Return value
+  cf_filter_external_t* ppd_filter_params = NULL; // Parameters for CUPS
+                                        // filter defined in the PPD
+  const pr_filter_plugin_t *plugin;     // CUPS filter as shared object
+  pr_print_filter_function_data_t *print_params; // Parameters for
+                                        // _prPrintFilterFunction()
+  cf_filter_filter_in_chain_t banner_filter = // cfFilterBannerToPDF() filter
+                                        // function in filter chain, mainly for
+  {                                     // PDF test pages
+    cfFilterBannerToPDF,
+    NULL,
+    "bannertopdf"
+  };
+  int                   is_banner = 0;  // Do we have cfFilterBannerToPDF()
+                                        // instructions in our PDF input file
+
+
+  job_data->filter_data->copies = doc_copies;
+
+  //
+  // Open the input file...
+  //
+
+  filename = papplJobGetDocumentFilename(job, doc);
+  if ((fd = open(filename, O_RDONLY)) < 0)
+  {
+    _prLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to open input file '%s' for printing: %s",
+	      filename, strerror(errno));
+    return (false);
+  }
+
+  //
+  // Get input file format
+  //
+
+  informat = papplJobGetDocumentFormat(job, doc);
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	    "Input file format of document %d: %s", doc, informat);
+
+  //
+  // Find filters to use for this job
+  //
+  
+  papplPrinterGetDriverData(papplJobGetPrinter(job), &driver_data);
+  if (_prChooseConversion((pr_driver_extension_t *)driver_data.extension,
+			  informat, job, &alternative))
+  {
+    conversion = alternative.conversion;
+    filter_path = alternative.filter_path;
+  }
+  else
+  {
+    _prLogJob(job, PAPPL_LOGLEVEL_ERROR,
+	      "No pre-filter found for input format %s",
+	      informat);
+    close(fd);
+    return (false);
+  }
+
+  // Set input and output formats for the filter chain
+  job_data->filter_data->content_type = conversion->srctype;
+  job_data->filter_data->final_content_type = conversion->dsttype;
+
+  // Convert PPD file data into printer IPP attributes and options,
+  // for the filter functions being able to use it, this does not
+  // depend on the document
+  if (first)
+    pr_load_ppd(job, job_data);
+
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	    "Converting input file to format: %s", conversion->dsttype);
+  if (filter_path[0] == '.')
+    _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	      "Passing on PostScript directly to printer");
+  else if (filter_path[0] == '-')
+    _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	      "Passing on %s directly to printer", conversion->dsttype);
+  else
+    _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	      "Using CUPS filter (printer driver): %s", filter_path);
+
+  //
+  // Check whether the PDF input is a banner or test page
+  //
+
+  if (strcmp(informat, "application/pdf") == 0 ||
+      strcmp(informat, "application/vnd.cups-pdf") == 0)
+  {
+    FILE *fp;
+    char *line = NULL;
+    size_t len = 0;
+
+    fp = fdopen(fd, "r");
+    while (getline(&line, &len, fp) != -1)
+      if (strncmp(line, "%%#PDF-BANNER", 13) == 0 ||
+	  strncmp(line, "%%PDF-BANNER", 12) == 0)
+      {
+	_prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+		  "Input PDF file is banner or test page file, calling bannertopdf to add printer and job information");
+	is_banner = 1;
+	job_data->filter_data->content_type = "application/vnd.cups-pdf-banner";
+	break;
+      }
+    rewind(fp);
+    free(line);
+  }
+
+#ifdef HAVE_OPEN_MEMSTREAM
+  //
+  // Fast path: Send data which the printer understands natively and
+  // which needs no page manipulation directly to the device
+  //
+
+  if (!is_banner &&
+      pr_passthrough_possible(job, job_data, conversion,
+			      filter_path, fd))
+  {
+    if (output_file)
+    {
+      // Goes directly to the device, nothing to render ahead of time
+      nullfd = -1;
+      goto done;
+    }
+    _prUpdateStatus(papplJobGetPrinter(job), device);
+    if (papplJobGetImpressions(job) == 0)
+      papplJobSetImpressions(job, 1);
+    ret = pr_passthrough_job(job, device, job_data, fd,
+			     strcmp(conversion->srctype,
+				    "application/postscript") == 0);
+    nullfd = -1;
+    goto done;
+  }
+#endif // HAVE_OPEN_MEMSTREAM
+
+  //
+  // Set up filter function chain
+  //
+
+  job_data->chain = cupsArrayNew(NULL, NULL, NULL, 0, NULL, NULL);
+  if (is_banner)
+    cupsArrayAdd(job_data->chain, &banner_filter);
+  _prRenderPoolAddFilters(job_data, job_data->chain, PR_RENDER_CONVERSION,
+			  conversion);
+  if (strlen(filter_path) > 1) // A null filter is a single char, '-'
+                               // or '.', whereas an actual filter has
+                               // a path starting with '/', so at
+                               // least 2 chars.
+  {
+    job_data->ppd_filter =
+      (cf_filter_filter_in_chain_t *)calloc(1,
+			                sizeof(cf_filter_filter_in_chain_t));
+    if ((plugin = _prFilterPluginFind(global_data, filter_path)) != NULL)
+    {
+      // The driver provides its filter as shared object, run it in-process
+      _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+		"Running CUPS filter %s as filter plugin", plugin->name);
+      job_data->ppd_filter->function = plugin->function;
+      job_data->ppd_filter->parameters = plugin->parameters;
+    }
+    else
+    {
+      ppd_filter_params =
+	(cf_filter_external_t *)calloc(1, sizeof(cf_filter_external_t));
+      ppd_filter_params->filter = filter_path;
+      job_data->ppd_filter->function = ppdFilterExternalCUPS;
+      job_data->ppd_filter->parameters = ppd_filter_params;
+    }
+    job_data->ppd_filter->name = strrchr(filter_path, '/') + 1;
+    cupsArrayAdd(job_data->chain, job_data->ppd_filter);
+  } else
+    job_data->ppd_filter = NULL;
+  job_data->print =
+    (cf_filter_filter_in_chain_t *)calloc(1,
+					  sizeof(cf_filter_filter_in_chain_t));
+  // Put filter function to send data to PAPPL's built-in backend at the end
+  // of the chain
+  print_params =
+    (pr_print_filter_function_data_t *)
+    calloc(1, sizeof(pr_print_filter_function_data_t));
+  print_params->device = device;
+  print_params->device_uri = job_data->device_uri;
+  print_params->job = job;
+  print_params->global_data = global_data;
+  print_params->job_pid = getpid();
+  _prRegisterDebugCopy(global_data, job, print_params->debug_copy,
+		       sizeof(print_params->debug_copy));
+  job_data->print->function = _prPrintFilterFunction;
+  job_data->print->parameters = print_params;
+  job_data->print->name = "Backend";
+  cupsArrayAdd(job_data->chain, job_data->print);
+
+  //
+  // Render-once copies: If the filters would render each copy again,
+  // render one copy into a file and send that for each copy
+  //
+
+  copies = pr_replay_copies(job, job_data);
+
+  //
+  // Output rendered ahead of time or output cache: Send the
+  // print-ready output of this job rendered while the previous job
+  // was printing, or of an identical earlier job if we have it,
+  // otherwise let this job's output go into the cache
+  //
+
+  cache_fd = -1;
+  if (output_file)
+    snprintf(print_params->replay_file, sizeof(print_params->replay_file),
+	     "%s", output_file);
+  else if (doc == 1 && papplJobGetNumberOfDocuments(job) == 1 &&
+	   (cache_fd = _prPrerenderOpen(job)) >= 0)
+    _prLogJob(job, PAPPL_LOGLEVEL_INFO,
+	      "Sending print-ready output rendered ahead of time");
+  else if (_prOutputCacheKey(job, job_data, fd, filter_path, cache_key,
+			     sizeof(cache_key)))
+  {
+    if ((cache_fd = _prOutputCacheOpen(global_data, cache_key)) >= 0)
+      _prLogJob(job, PAPPL_LOGLEVEL_INFO,
+		"Sending print-ready output of an identical earlier job from the output cache");
+    else
+      _prOutputCacheTempName(global_data, cache_key, job,
+			     print_params->cache_file,
+			     sizeof(print_params->cache_file));
+  }
+
+  if (cache_fd >= 0)
+  {
+    _prUpdateStatus(papplJobGetPrinter(job), device);
+    if (papplJobGetImpressions(job) == 0)
+      papplJobSetImpressions(job, 1);
+    if (copies > 1)
+    {
+      // The file has one copy of the job
+      ret = pr_replay_to_device(job, job_data, print_params, cache_fd,
+				copies);
+      close(cache_fd);
+    }
+    else
+      // _prPrintFilterFunction() closes both file descriptors
+      ret = (_prPrintFilterFunction(cache_fd, open("/dev/null", O_WRONLY), 1,
+				    job_data->filter_data, print_params) == 0);
+    nullfd = -1;
+    goto done;
+  }
+
+  // Print-ready output of one copy goes into the output cache file or
+  // into an intermediate file, in memory as long as it is not too
+  // large, to be replayed for the copies
+  if (copies > 1 && !output_file)
+  {
+    if (print_params->cache_file[0])
+      snprintf(print_params->replay_file, sizeof(print_params->replay_file),
+	       "%s", print_params->cache_file);
+    else
+    {
+      snprintf(print_params->replay_file, sizeof(print_params->replay_file),
+	       "%s/copies-%s-%d.prn", global_data->spool_dir,
+	       papplPrinterGetName(papplJobGetPrinter(job)),
+	       papplJobGetID(job));
+      if ((print_params->replay =
+	   _prIntermediateCreate("copies", print_params->replay_file,
+				 global_data->intermediate_mem_size)) == NULL)
+	_prLogJob(job, PAPPL_LOGLEVEL_WARN,
+		  "Unable to create intermediate file for the copies: %s",
+		  strerror(errno));
+    }
+  }
+
+  //
+  // Update status
+  //
+
+  if (device)
+    _prUpdateStatus(papplJobGetPrinter(job), device);
+
+  //
+  // Fire up the filter functions
+  //
+
+  // Keep the page count of the preflight, if we got one
+  if (papplJobGetImpressions(job) == 0)
+    papplJobSetImpressions(job, 1);
+
+  // The filter chain has no output, data is going to the device
+  nullfd = open("/dev/null", O_RDWR);
+
+  // Safety check for filter chain 
+  if (!job_data->chain)
+  {
+    _prLogJob(job, PAPPL_LOGLEVEL_ERROR,
+	      "No filter chain available for the print job");
+    goto done;
+  }
+
+  if (!is_banner && !output_file &&
+      (num_chunks = pr_parallel_chunks(job, job_data, conversion,
+				       filename, &num_pages)) > 1)
+    ret = pr_parallel_render(job, job_data, conversion, filename, nullfd,
+			     num_chunks, num_pages);
+  else
+  {
+    // Measure the filters, to tell where the time of the job goes
+    chain_stats =
+      _prChainStatsCreate(job_data->chain,
+			  papplSystemGetLogLevel(global_data->system));
+    // Page progress gets reported by the watchdog, the "PAGE:" messages
+    // come in from the forked filter processes
+    if (!output_file &&
+	(progress = (pr_job_progress_t *)mmap(NULL, sizeof(pr_job_progress_t),
+					      PROT_READ | PROT_WRITE,
+					      MAP_SHARED | MAP_ANONYMOUS, -1,
+					      0)) != MAP_FAILED)
+    {
+      memset(progress, 0, sizeof(pr_job_progress_t));
+      progress->start    = _prGetCurrentTime();
+      job_data->log.progress = progress;
+    }
+    else
+      progress = NULL;
+    if (chain_stats || progress)
+    {
+      // The filters record their process groups in the shared
+      // measurements, so that we can stop them on cancel
+      memset(&watch, 0, sizeof(watch));
+      watch.job         = job;
+      watch.progress    = progress;
+      if (chain_stats)
+      {
+	watch.filters     = chain_stats->stats;
+	watch.num_filters = chain_stats->num_filters;
+      }
+      pthread_mutex_init(&watch.mutex, NULL);
+      pthread_cond_init(&watch.cond, NULL);
+      watching = (pthread_create(&watch_thread, NULL, pr_cancel_watchdog,
+				 &watch) == 0);
+      if (!watching)
+      {
+	pthread_mutex_destroy(&watch.mutex);
+	pthread_cond_destroy(&watch.cond);
+      }
+    }
+    if (fstat(fd, &fileinfo) != 0)
+      fileinfo.st_size = 0;
+    if (cfFilterChain(fd, nullfd, 1, job_data->filter_data,
+		      chain_stats ? chain_stats->chain : job_data->chain) == 0)
+      ret = true;
+    if (watching)
+    {
+      pthread_mutex_lock(&watch.mutex);
+      watch.done = true;
+      pthread_cond_signal(&watch.cond);
+      pthread_mutex_unlock(&watch.mutex);
+      pthread_join(watch_thread, NULL);
+      pthread_mutex_destroy(&watch.mutex);
+      pthread_cond_destroy(&watch.cond);
+      if (watch.canceled > 0.0)
+	_prLogJob(job, PAPPL_LOGLEVEL_INFO,
+		  "Filters stopped %.2f seconds after the job got canceled",
+		  _prGetCurrentTime() - watch.canceled);
+    }
+    if (progress)
+    {
+      job_data->log.progress = NULL;
+      pr_progress_report(job, progress);
+      if (ret && progress->logs > 0)
+	_prDriverStatsAddPageRate(&((pr_driver_extension_t *)
+				    driver_data.extension)->stats,
+				  progress->pages,
+				  progress->times[(progress->logs - 1) %
+						  PR_PROGRESS_WINDOW] -
+				  progress->start);
+      munmap(progress, sizeof(pr_job_progress_t));
+    }
+    // Cost of the conversion, to choose the cheapest one for the
+    // following jobs, saved by _prDriverStatsSaveTimer()
+    if (global_data->adaptive_conversions &&
+	ret && !papplJobIsCanceled(job) && !is_banner && chain_stats)
+    {
+      _prDriverStatsLoad(&((pr_driver_extension_t *)driver_data.extension)->
+			 stats, papplJobGetPrinter(job), global_data->state_dir);
+      _prDriverStatsAddConversion(&((pr_driver_extension_t *)
+				    driver_data.extension)->stats,
+				  alternative.key, chain_stats,
+				  papplJobGetImpressions(job));
+    }
+    _prChainStatsFinish(chain_stats, job,
+			&((pr_driver_extension_t *)driver_data.extension)->
+			stats, fileinfo.st_size);
+  }
+
+  if (print_params->replay_file[0] && !output_file)
+  {
+    int replay_fd;			// Rendered copy of the job
+
+    if (ret && !papplJobIsCanceled(job))
+    {
+      if (print_params->replay)
+	_prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+		  "Rendered copy has %ld bytes, kept %s",
+		  (long)print_params->replay->size,
+		  print_params->replay->spilled ? "on disk" : "in memory");
+      if ((replay_fd = (print_params->replay ?
+			_prIntermediateOpen(print_params->replay) :
+			open(print_params->replay_file, O_RDONLY))) >= 0)
+      {
+	ret = pr_replay_to_device(job, job_data, print_params, replay_fd,
+				  copies);
+	close(replay_fd);
+      }
+      else
+      {
+	_prLogJob(job, PAPPL_LOGLEVEL_ERROR,
+		  "Unable to open file for the copies %s: %s",
+		  print_params->replay_file, strerror(errno));
+	ret = false;
+      }
+    }
+    if (print_params->replay)
+    {
+      _prIntermediateFree(print_params->replay);
+      print_params->replay = NULL;
+    }
+    else if (!print_params->cache_file[0])
+      unlink(print_params->replay_file);
+  }
+
+  if (print_params->cache_file[0])
+  {
+    if (ret && !papplJobIsCanceled(job))
+      _prOutputCacheStore(global_data, cache_key, print_params->cache_file);
+    else
+      unlink(print_params->cache_file);
+  }
+
+ done:
+
+  //
+  // Clean up the document's filter chain
+  //
+
+  if (ppd_filter_params)
+    free(ppd_filter_params);
+  if (job_data->ppd_filter)
+  {
+    free(job_data->ppd_filter);
+    job_data->ppd_filter = NULL;
+  }
+  if (job_data->print)
+  {
+    _prIntermediateFree(((pr_print_filter_function_data_t *)
+			 job_data->print->parameters)->replay);
+    free(job_data->print->parameters);
+    free(job_data->print);
+    job_data->print = NULL;
+  }
+  if (job_data->pool_filter)
+  {
+    free(job_data->pool_filter->parameters);
+    free(job_data->pool_filter);
+    job_data->pool_filter = NULL;
+  }
+  if (job_data->chain)
+  {
+    cupsArrayDelete(job_data->chain);
+    job_data->chain = NULL;
+  }
+  free(alternative.filter_path);
+  close(fd);
+  if (nullfd >= 0)
+    close(nullfd);
+
+  return (ret);
+}
+
+
+//
+// '_prFilter()' - PAPPL generic filter function wrapper for printing
+//                 in spooling mode. All documents of the job are
+//                 printed in one device session. With several
+//                 copies of several documents, the copies are
+//                 collated unless "multiple-document-handling" asks
+//                 for uncollated copies. "single-document-new-sheet"
+//                 gives the same output as collated copies,
+//                 "single-document" is printed like it, as we do not
+//                 merge the documents to let them share sheets.
+//
+
+bool
+_prFilter(
+    pappl_job_t    *job,		// I - Job
+    pappl_device_t *device,		// I - Device
+    void *data)                         // I - Global data
+{
+  pr_printer_app_global_data_t *global_data =
+    (pr_printer_app_global_data_t *)data;
+  pr_job_data_t         *job_data;      // PPD data for job
+  pappl_pr_options_t	*job_options;	// Job options
+  ipp_attribute_t       *attr;          // "multiple-document-handling"
+  const char            *handling;      // Value of this attribute
+  int                   num_docs,       // Number of documents
+                        doc,            // Current document
+                        passes,         // Passes through all documents
+                        pass,           // Current pass
+                        doc_copies;     // Copies of each document per pass
+  bool			ret = true;	// Return value
+
+
+  //
+  // Load the printer's assigned PPD file, and find out which PPD option
+  // seetings correspond to our job options
+  //
+
+  job_options = papplJobCreatePrintOptions(job, 1, INT_MAX, 1);
+
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	    "Printing job in spooling mode");
+
+  job_data = _prCreateJobData(job, job_options);
+
+  //
+  // Render the jobs queued behind this one while we are printing
+  //
+
+  _prPrerenderStart(papplJobGetPrinter(job));
+
+  //
+  // Connect the job's filter_data to the backend, or the job to the
+  // backend left running by the previous job
+  //
+
+  if (strncmp(job_data->device_uri, "cups:", 5) == 0)
+    _prCUPSDevStartJob(device, job_data->filter_data,
+		       _prCUPSDevSessionPossible(device, job_data->ppd));
+
+  //
+  // Print the documents, copies of more than one document are made
+  // by printing all documents again, unless uncollated copies are
+  // requested
+  //
+
+  num_docs   = papplJobGetNumberOfDocuments(job);
+  passes     = 1;
+  doc_copies = job_options->copies;
+  if ((attr = papplJobGetAttribute(job, "multiple-document-handling")) ==
+      NULL ||
+      (handling = ippGetString(attr, 0, NULL)) == NULL)
+    handling = "separate-documents-collated-copies";
+  if (num_docs > 1 && !strcmp(handling, "single-document"))
+    _prLogJob(job, PAPPL_LOGLEVEL_INFO,
+	      "multiple-document-handling \"single-document\" is not supported, each document starts on a new sheet (\"single-document-new-sheet\")");
+  if (num_docs > 1 && job_options->copies > 1 &&
+      strcmp(handling, "separate-documents-uncollated-copies"))
+  {
+    passes     = job_options->copies;
+    doc_copies = 1;
+  }
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	    "Printing %d document(s), %d pass(es) with %d copies each",
+	    num_docs, passes, doc_copies);
+
+  //
+  // Wait for a render slot, so that the filter chains of all printers
+  // together do not overload the host
+  //
+
+  if ((ret = _prGovernorAcquire(global_data, job)))
+  {
+    for (pass = 0; pass < passes && ret; pass ++)
+      for (doc = 1; doc <= num_docs && ret && !papplJobIsCanceled(job);
+	   doc ++)
+	ret = pr_filter_document(job, device, global_data, job_data, doc,
+				 doc_copies, pass == 0 && doc == 1, NULL);
+    _prGovernorRelease(global_data, papplJobGetPrinter(job));
+  }
+
+  if (papplJobIsCanceled(job))
+    pr_cancel_device(job, job_data, device);
+
+  //
+  // Update status
+  //
+
+  _prUpdateStatus(papplJobGetPrinter(job), device);
+
+  //
+  // Stop the backend and disconnect the job's filter_data from the backend,
+  // unless the backend keeps running for the next job
+  //
+
+  if (strncmp(job_data->device_uri, "cups:", 5) == 0)
+  {
+    // We stop it here explicitly as we will free the filter_data structure
+    // and without it the backend shutdoen will not have access to the log
+    // function any more.
+    if (_prCUPSDevEndJob(device, ret && !papplJobIsCanceled(job)))
+      _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+		"Keeping CUPS backend running for the next job");
+    else
+      _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+		"Shut down CUPS backend");
+  }
+
+  //
+  // Clean up
+  //
+
+  papplJobDeletePrintOptions(job_options);
+  _prFreeJobData(job_data);
+
+  return (ret);
+}
+
+
+//
+// 'pr_prerender_ppd()' - Load a private copy of the printer's PPD file
+//                        for rendering a job ahead of time, so that
+//                        marking the job's options does not interfere
+//                        with the job currently printing.
+//
+
+static ppd_file_t *			// O - PPD data or NULL
+pr_prerender_ppd(pappl_job_t *job,	// I - Job
+		 pr_printer_app_global_data_t *global_data)
+					// I - Global data
+{
+  pappl_printer_t        *printer = papplJobGetPrinter(job);
+  pappl_pr_driver_data_t driver_data;	// Printer's driver data
+  pr_driver_extension_t  *extension;	// Driver extension data
+  pr_ppd_path_t          search_ppd_path,
+                         *ppd_path;	// PPD of the printer's driver
+  cups_file_t            *fp;		// PPD file
+  ppd_file_t             *ppd = NULL;	// PPD data
+
+
+  papplPrinterGetDriverData(printer, &driver_data);
+  extension = (pr_driver_extension_t *)driver_data.extension;
+
+  search_ppd_path.driver_name = papplPrinterGetDriverName(printer);
+  if ((ppd_path = (pr_ppd_path_t *)cupsArrayFind(global_data->ppd_paths,
+						  &search_ppd_path)) == NULL ||
+      (fp = ppdCollectionGetPPD(ppd_path->ppd_path, NULL,
+				(cf_logfunc_t)papplLog,
+				global_data->system)) == NULL)
+    return (NULL);
+  ppd = ppdOpen2(fp);
+  cupsFileClose(fp);
+  if (!ppd)
+    return (NULL);
+
+  // Same state as the printer's PPD data: Defaults, installable
+  // accessories, and the cache
+  ppdMarkDefaults(ppd);
+  ppdMarkOptions(ppd, extension->num_inst_options, extension->inst_options);
+  if ((ppd->cache = ppdCacheCreateWithPPD(ppd)) == NULL)
+  {
+    ppdClose(ppd);
+    return (NULL);
+  }
+
+  return (ppd);
+}
+
+
+//
+// '_prPrerenderJob()' - Render a job ahead of time into a file with
+//                       its print-ready output. This runs in the
+//                       pre-render thread of the printer, with a
+//                       private copy of the PPD data, so the job's
+//                       PPD option settings do not interfere with
+//                       the job currently printing.
+//
+
+bool					// O - `true` on success
+_prPrerenderJob(pappl_job_t *job,	// I - Job
+		pr_printer_app_global_data_t *global_data,
+					// I - Global data
+		const char *filename)	// I - Output file
+{
+  pr_job_data_t      *job_data;		// PPD data for job
+  pappl_pr_options_t *job_options;	// Job options
+  ppd_file_t         *ppd;		// Private copy of the PPD data
+  bool               ret;		// Return value
+
+
+  if ((ppd = pr_prerender_ppd(job, global_data)) == NULL)
+  {
+    _prLogJob(job, PAPPL_LOGLEVEL_ERROR,
+	      "Unable to load the PPD file for rendering ahead of time");
+    return (false);
+  }
+
+  job_options = papplJobCreatePrintOptions(job, 1, INT_MAX, 1);
+  job_data = pr_create_job_data(job, job_options, ppd);
+
+  ret = pr_filter_document(job, NULL, global_data, job_data, 1,
+			   job_options->copies, true, filename);
+
+  papplJobDeletePrintOptions(job_options);
+  _prFreeJobData(job_data);
+
+  // We do the removal of the PPD cache separately to assure that the
+  // function of libppd (and not of libcups) is used
+  ppdCacheDestroy(ppd->cache);
+  ppd->cache = NULL;
+  ppdClose(ppd);
+
+  return (ret);
+}
+
+
+//
+// '_prFreeJobData()' - Clean up job data with PPD options.
+//
+
+void _prFreeJobData(pr_job_data_t *job_data)
+{
+  ppd_filter_data_ext_t *filter_data_ext =
+    (ppd_filter_data_ext_t *)cfFilterDataRemoveExt(job_data->filter_data,
+						   PPD_FILTER_DATA_EXT);
+
+  unsetenv("PRINTER");
+  unsetenv("PRINTER_LOCATION");
+
+  if (job_data->global_data->config->components & PR_COPTIONS_CUPS_BACKENDS)
+    cfFilterCloseBackAndSidePipes(job_data->filter_data);
+
+  if (filter_data_ext)
+    free(filter_data_ext);
+
+  free(job_data->filter_data->printer);
+  free(job_data->filter_data->job_user);
+  free(job_data->filter_data->job_title);
+  ppdFilterFreePPD(job_data->filter_data);
+  cupsFreeOptions(job_data->filter_data->num_options,
+		  job_data->filter_data->options);
+  free(job_data->filter_data);
+  
+  if (job_data->ppd_filter)
+    free(job_data->ppd_filter);
+  if (job_data->print)
+  {
+    free(job_data->print->parameters);
+    free(job_data->print);
+  }
+  if (job_data->pool_filter)
+  {
+    free(job_data->pool_filter->parameters);
+    free(job_data->pool_filter);
+  }
+  if (job_data->chain)
+    cupsArrayDelete(job_data->chain);
+  free(job_data);
+}
+
+
+//
+// '_prJobIsCanceled()' - Return 1 if the job is canceled, which is
+//                        the case when papplJobIsCanceled() returns
+//                        true.
+//
+
+int
+_prJobIsCanceled(void *data)
+{
+  pappl_job_t *job = (pappl_job_t *)data;
+
+
+  return (papplJobIsCanceled(job) ? 1 : 0);
+}
+
+
+//
+// 'pr_parse_page_log()' - Parse a "PAGE: <page> <copies>" control
+//                         message.
+//
+
+static bool				// O - true if it is a page log
+pr_parse_page_log(const char *buf,	// I - Message
+		  int        *page,	// O - Page number
+		  int        *copies)	// O - Copies
+{
+  char *start,				// Start of number
+       *end;				// End of number
+
+
+  if (strncmp(buf, "PAGE:", 5))
+    return (false);
+  start = (char *)buf + 5;
+  *page = (int)strtol(start, &end, 10);
+  if (end == start)
+    return (false);
+  start = end;
+  *copies = (int)strtol(start, &end, 10);
+  return (end != start);
+}
+
+
+//
+// '_prJobLog()' - Job log function which records page logs of filter
+//                 functions in the job's page progress, or calls
+//                 papplJobSetImpressionsCompleted() if it is not
+//                 tracked. The log data is the job's pr_job_log_t.
+//                 Messages below the system's log level are dropped
+//                 before getting formatted.
+//
+
+void
+_prJobLog(void *data,
+	  cf_loglevel_t level,
+	  const char *message,
+	  ...)
+{
+  va_list arglist;
+  pr_job_log_t *job_log = (pr_job_log_t *)data;
+  pappl_job_t *job = job_log->job;
+  char buf[1024];
+  int page, copies;
+
+
+  if (level != CF_LOGLEVEL_CONTROL &&
+      (pappl_loglevel_t)level <
+      papplSystemGetLogLevel(papplPrinterGetSystem(papplJobGetPrinter(job))))
+    return;
+
+  va_start(arglist, message);
+  vsnprintf(buf, sizeof(buf) - 1, message, arglist);
+  va_end(arglist);
+  if (level == CF_LOGLEVEL_CONTROL)
+  {
+    if (pr_parse_page_log(buf, &page, &copies))
+    {
+      // With the progress tracked the job's process reports the
+      // impressions, we may be a forked filter process
+      if (job_log->progress)
+	pr_progress_page(job_log->progress, copies);
+      else
+	papplJobSetImpressionsCompleted(job, copies);
+      _prLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Printing page %d, %d copies",
+		page, copies);
+    }
+    else
+      _prLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Unused control message: %s",
+		buf);
+  }
+  else
+    _prLogJob(job, (pappl_loglevel_t)level, "%s", buf);
+}
+
+
+//
+// '_prOneBitDitherOnDraft()' - If an image job is printed in
+//                              grayscale in draft mode switch to
+//                              1-bit dithering mode to get printing
+//                              as fast as possible
+//
+
+void
+_prOneBitDitherOnDraft(
+    pappl_job_t        *job,     // I   - Job
+    pappl_pr_options_t *options) // I/O - Job options
+{
+  pappl_pr_driver_data_t driver_data;
+
+
+  if (!strcmp(papplJobGetDocumentFormat(job, 1), "image/urf") ||
+      !strcmp(papplJobGetDocumentFormat(job, 1), "image/pwg-raster"))
+  {
+    _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	      "Not changing Raster input color depth on PWG/Apple Raster input");
+    return;
+  }
+
+  papplPrinterGetDriverData(papplJobGetPrinter(job), &driver_data);
+  if (options->print_quality == IPP_QUALITY_DRAFT &&
+      options->print_color_mode != PAPPL_COLOR_MODE_COLOR &&
+      options->header.cupsNumColors == 1)
+  {
+    options->header.cupsBitsPerColor = 1;
+    options->header.cupsBitsPerPixel = 1;
+    options->header.cupsColorSpace = CUPS_CSPACE_K;
+    options->header.cupsColorOrder = CUPS_ORDER_CHUNKED;
+    options->header.cupsNumColors = 1;
+    options->header.cupsBytesPerLine = (options->header.cupsWidth + 7) / 8;
+    _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	      "Monochrome draft quality job -> 1-bit dithering for speed-up");
+    if (options->print_content_optimize == PAPPL_CONTENT_PHOTO ||
+	!strcmp(papplJobGetDocumentFormat(job, 1), "image/jpeg") ||
+	!strcmp(papplJobGetDocumentFormat(job, 1), "image/png"))
+    {
+      memcpy(options->dither, driver_data.pdither, sizeof(options->dither));
+      _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+		"Photo/Image-optimized dither matrix");
+    }
+    else
+    {
+      memcpy(options->dither, driver_data.gdither, sizeof(options->dither));
+      _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+		"General-purpose dither matrix");
+    }
+  }
+  else
+    _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	      "Not in monochrome draft mode -> no color depth change applied");
+}
+
+
+//
+// `_prCleanDebugCopies()' - Remove debug copies of jobs created by
+//                           the _prPrintFilterFunction() function
+//                           which are older than the configured
+//                           maximum age (24 hours by default). This
+//                           avoids filling up the disk should the
+//                           user have switched to debug logging for
+//                           some reason and forgot to turn back after
+//                           solving his problem. This scans the whole
+//                           spool directory and is only done once at
+//                           startup, to catch leftovers of earlier
+//                           runs. Files created while we are running
+//                           are taken care of by _prSpoolJanitor().
+//
+
+void
+_prCleanDebugCopies(pr_printer_app_global_data_t *global_data)
+{
+  cups_dir_t	*dir;			// Directory pointer
+  cups_dentry_t	*dent;			// Directory entry
+  char		filename[2048];		// Name of PPD or directory
+  time_t        outdated;               // Files older than this time
+                                        // get deleted
+
+
+  papplLog(global_data->system, PAPPL_LOGLEVEL_DEBUG,
+	   "Checking for old debug copy files in the spool directory %s",
+	   global_data->spool_dir);
+
+  // Open spool directory
+  if ((dir = cupsDirOpen(global_data->spool_dir)) == NULL)
+  {
+    papplLog(global_data->system, PAPPL_LOGLEVEL_ERROR,
+	     "Unable to open spool directory %s: %s",
+	     global_data->spool_dir, strerror(errno));
+    return;
+  }
+
+  // Files older than the maximum age are outdated and get deleted
+  outdated = time(NULL) - global_data->debug_copy_max_age;
+
+  // Go through all files and remove the outdated debug copies
+  while ((dent = cupsDirRead(dir)) != NULL)
+  {
+    if (S_ISDIR(dent->fileinfo.st_mode) || dent->filename[0] == '.' ||
+	dent->fileinfo.st_mtime > outdated ||
+	strncmp(dent->filename, "debug-jobdata-", 14))
+      continue;
+    snprintf(filename, sizeof(filename), "%s/%s",
+	     global_data->spool_dir, dent->filename);
+    unlink(filename);
+    papplLog(global_data->system, PAPPL_LOGLEVEL_DEBUG,
+	     "Deleted old debug copy file %s", dent->filename);
+  }
+
+  cupsDirClose(dir);
+}
+
+
+//
+// `_prRegisterDebugCopy()' - If we are in debug logging mode, create
+//                            the name of the file for the debug copy
+//                            of the job's printer data and add it to
+//                            the list of files which the spool
+//                            janitor removes after they have reached
+//                            their maximum age. This is done in the
+//                            main process, before the filter chain
+//                            (and with it _prPrintFilterFunction())
+//                            gets forked off. Returns false and an
+//                            empty file name if no debug copy is
+//                            needed.
+//
+
+bool					// O - Create debug copy?
+_prRegisterDebugCopy(pr_printer_app_global_data_t *global_data,
+					// I - Global data
+		     pappl_job_t *job,	// I - Job
+		     char *filename,	// O - Name for debug copy
+		     size_t filenamesize)// I - Size of filename buffer
+{
+  pr_debug_copy_t *debug_copy;		// List entry
+
+
+  filename[0] = '\0';
+
+  if (papplSystemGetLogLevel(global_data->system) != PAPPL_LOGLEVEL_DEBUG)
+    return (false);
+
+  // Debug copy file name (in spool directory)
+  snprintf(filename, filenamesize, "%s/debug-jobdata-%s-%d.prn",
+	   global_data->spool_dir,
+	   papplPrinterGetName(papplJobGetPrinter(job)), papplJobGetID(job));
+
+  if (global_data->debug_copies &&
+      (debug_copy =
+       (pr_debug_copy_t *)calloc(1, sizeof(pr_debug_copy_t))) != NULL)
+  {
+    debug_copy->filename = strdup(filename);
+    debug_copy->created = time(NULL);
+    pthread_mutex_lock(&global_data->debug_copies_mutex);
+    cupsArrayAdd(global_data->debug_copies, debug_copy);
+    pthread_mutex_unlock(&global_data->debug_copies_mutex);
+  }
+
+  return (true);
+}
+
+
+//
+// `_prSpoolJanitor()' - Timer callback to remove the debug copies
+//                       registered by _prRegisterDebugCopy() when
+//                       they have reached their maximum age. As we
+//                       keep the list of the files we have created,
+//                       we do not need to scan the spool directory
+//                       for them.
+//
+
+bool					// O - true to keep the timer running
+_prSpoolJanitor(pappl_system_t *system,	// I - System
+		void *data)		// I - Global data
+{
+  pr_printer_app_global_data_t *global_data =
+    (pr_printer_app_global_data_t *)data;
+  pr_debug_copy_t *debug_copy;		// List entry
+  time_t        outdated;               // Files created before this time
+                                        // get deleted
+
+
+  outdated = time(NULL) - global_data->debug_copy_max_age;
+
+  pthread_mutex_lock(&global_data->debug_copies_mutex);
+  // The list is in order of creation, so we can stop at the first file
+  // which is not outdated yet
+  for (debug_copy =
+	 (pr_debug_copy_t *)cupsArrayGetFirst(global_data->debug_copies);
+       debug_copy && debug_copy->created <= outdated;
+       debug_copy =
+	 (pr_debug_copy_t *)cupsArrayGetNext(global_data->debug_copies))
+  {
+    if (unlink(debug_copy->filename) == 0)
+      papplLog(system, PAPPL_LOGLEVEL_DEBUG,
+	       "Deleted old debug copy file %s", debug_copy->filename);
+    cupsArrayRemove(global_data->debug_copies, debug_copy);
+    free(debug_copy->filename);
+    free(debug_copy);
+  }
+  pthread_mutex_unlock(&global_data->debug_copies_mutex);
+
+  return (true);
+}
+
+
+//
+// 'pr_splice_to_device()' - Move the print data from the input file
+//                           descriptor of _prPrintFilterFunction() to
+//                           a file-descriptor-backed device without
+//                           copying it through user space, using
+//                           splice() and, if a debug copy is
+//                           requested, tee(). Returns -1 if the
+//                           kernel does not support this for the
+//                           given file descriptors and nothing got
+//                           transferred yet, so that the caller can
+//                           fall back to the buffered copy loop.
+//
+
+static int                                    // O - 0 on success, 1 on
+                                              //     error, -1 if not
+                                              //     possible
+pr_splice_to_device(int          inputfd,     // I - Input stream
+		    int          devfd,       // I - Device file descriptor
+		    int          *debug_fd,   // IO - Debug copy file, -1 if none
+		    cf_logfunc_t log,         // I - Log function
+		    void         *ld)         // I - Log function data
+{
+#if defined(HAVE_SPLICE) && defined(HAVE_TEE)
+  struct stat  fileinfo;                      // Input file info
+  int          teepipe[2] = { -1, -1 };       // Pipe for the debug copy
+  ssize_t      bytes,                         // Bytes in current chunk
+               moved;                         // Bytes moved by splice()
+  size_t       total = 0;                     // Total bytes sent to device
+  int          ret = 0;
+
+
+  // tee() works only between pipes, splice() needs a pipe on one end
+  // and the device end is always a pipe (CUPS backend input)
+  if (fstat(devfd, &fileinfo) || !S_ISFIFO(fileinfo.st_mode))
+    return (-1);
+  if (fstat(inputfd, &fileinfo) ||
+      (*debug_fd >= 0 && !S_ISFIFO(fileinfo.st_mode)))
+    return (-1);
+
+  // Larger pipes mean less context switches between the filters and
+  // the backend, failure is not fatal, the kernel caps the size for
+  // unprivileged processes
+  if (S_ISFIFO(fileinfo.st_mode))
+    fcntl(inputfd, F_SETPIPE_SZ, PR_PIPE_SIZE);
+  fcntl(devfd, F_SETPIPE_SZ, PR_PIPE_SIZE);
+
+  if (*debug_fd >= 0)
+  {
+    if (pipe(teepipe))
+      return (-1);
+    fcntl(teepipe[1], F_SETPIPE_SZ, PR_PIPE_SIZE);
+  }
+
+  for (;;)
+  {
+    // Number of bytes to move in this step. With a debug copy we
+    // duplicate the data waiting in the input pipe with tee() first and
+    // then move exactly that amount to the device and to the debug file.
+    if (*debug_fd >= 0)
+      bytes = tee(inputfd, teepipe[1], PR_PIPE_SIZE, 0);
+    else
+      bytes = PR_PIPE_SIZE;
+
+    if (bytes < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+	continue;
+      if (total == 0 && errno == EINVAL)
+	ret = -1;
+      else
+      {
+	if (log)
+	  log(ld, CF_LOGLEVEL_ERROR,
+	      "Backend: Unable to duplicate print data for debug copy: %s",
+	      strerror(errno));
+	ret = 1;
+      }
+      break;
+    }
+    else if (bytes == 0)
+      break;
+
+    while (bytes > 0)
+    {
+      if ((moved = splice(inputfd, NULL, devfd, NULL, (size_t)bytes,
+			  SPLICE_F_MOVE | SPLICE_F_MORE)) < 0)
+      {
+	if (errno == EINTR || errno == EAGAIN)
+	  continue;
+	if (total == 0 && errno == EINVAL)
+	  ret = -1;
+	else
+	{
+	  if (log)
+	    log(ld, CF_LOGLEVEL_ERROR,
+		"Backend: Output to device: Unable to send data to printer: %s",
+		strerror(errno));
+	  ret = 1;
+	}
+	goto done;
+      }
+      else if (moved == 0)
+      {
+	if (*debug_fd < 0)
+	  goto done;		// End of input
+	break;
+      }
+      total += (size_t)moved;
+      if (*debug_fd < 0)
+	break;			// Without debug copy we simply loop
+      bytes -= moved;
+    }
+
+    if (*debug_fd >= 0)
+    {
+      // Drain what tee() has duplicated into the debug copy file
+      while ((bytes = splice(teepipe[0], NULL, *debug_fd, NULL, PR_PIPE_SIZE,
+			     SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) > 0);
+      if (bytes < 0 && errno != EAGAIN && errno != EINTR)
+      {
+	if (log)
+	  log(ld, CF_LOGLEVEL_ERROR,
+	      "Backend: Debug copy: Unable to write data, stopping debug copy, continuing job output.");
+	close(*debug_fd);
+	*debug_fd = -1;
+	close(teepipe[0]);
+	close(teepipe[1]);
+	teepipe[0] = teepipe[1] = -1;
+      }
+    }
+  }
+
+ done:
+  if (teepipe[0] >= 0)
+    close(teepipe[0]);
+  if (teepipe[1] >= 0)
+    close(teepipe[1]);
+
+  if (ret == 0 && log)
+    log(ld, CF_LOGLEVEL_DEBUG,
+	"Backend: Sent %lu bytes to the device without copying (splice)",
+	(unsigned long)total);
+
+  return (ret);
+#else
+  (void)inputfd;
+  (void)devfd;
+  (void)debug_fd;
+  (void)log;
+  (void)ld;
+
+  return (-1);
+#endif // HAVE_SPLICE && HAVE_TEE
+}
+
+
+//
+// 'pr_device_writer_thread()' - Writer thread of
+//                               pr_buffered_to_device(), sends the
+//                               filled buffers of the ring to the
+//                               device, so that the filter chain can
+//                               go on producing data while a slow
+//                               printer is draining.
+//
+
+static void *                                 // O - Thread exit status
+pr_device_writer_thread(void *data)           // I - Ring buffer
+{
+  pr_device_writer_t *writer = (pr_device_writer_t *)data;
+  int                slot;                    // Buffer to write
+
+
+  pthread_mutex_lock(&writer->mutex);
+  for (;;)
+  {
+    while (writer->count == 0 && !writer->eof)
+      pthread_cond_wait(&writer->cond, &writer->mutex);
+    if (writer->count == 0)
+      break;			// EOF and everything written
+
+    slot = writer->tail;
+    pthread_mutex_unlock(&writer->mutex);
+
+    if (papplDeviceWrite(writer->device, writer->bufs[slot],
+			 writer->lens[slot]) < 0)
+    {
+      pthread_mutex_lock(&writer->mutex);
+      writer->error = true;
+      pthread_cond_signal(&writer->cond);
+      break;
+    }
+
+    pthread_mutex_lock(&writer->mutex);
+    writer->tail = (writer->tail + 1) % writer->num_bufs;
+    writer->count --;
+    pthread_cond_signal(&writer->cond);
+  }
+  pthread_mutex_unlock(&writer->mutex);
+
+  return (NULL);
+}
+
+
+//
+// 'pr_buffered_to_device()' - Copy the print data from the input
+//                             file descriptor to the device through
+//                             a ring of buffers. If the memory budget
+//                             allows more than one buffer, a writer
+//                             thread sends the data to the device
+//                             while we keep reading from the filter
+//                             chain, otherwise we read and write
+//                             strictly in turn.
+//
+
+static int                                    // O - 0 on success, 1 on
+                                              //     error
+pr_buffered_to_device(int            inputfd, // I - Input stream
+		      pappl_device_t *device, // I - Device
+		      int            *debug_fd,// IO - Debug copy file, -1 if
+		                              //      none
+		      size_t         budget,  // I - Memory budget in bytes
+		      cf_logfunc_t   log,     // I - Log function
+		      void           *ld)     // I - Log function data
+{
+  pr_device_writer_t writer;                  // Ring buffer and writer state
+  pthread_t          tid;                     // Writer thread
+  ssize_t            bytes;                   // Bytes read
+  int                i,
+                     slot,                    // Buffer to fill
+                     allocated,               // Buffers to free
+                     err;                     // pthread_create() error
+  int                ret = 0;
+
+
+  memset(&writer, 0, sizeof(writer));
+  writer.device = device;
+  if ((writer.num_bufs = (int)(budget / PR_DEVICE_BUFFER_CHUNK)) < 1)
+    writer.num_bufs = 1;
+  writer.bufs = (char **)calloc((size_t)writer.num_bufs, sizeof(char *));
+  writer.lens = (size_t *)calloc((size_t)writer.num_bufs, sizeof(size_t));
+  for (i = 0; writer.bufs && i < writer.num_bufs; i ++)
+    if ((writer.bufs[i] = (char *)malloc(PR_DEVICE_BUFFER_CHUNK)) == NULL)
+      break;
+  if (writer.bufs && writer.lens && i < writer.num_bufs)
+    writer.num_bufs = i;	// Ran out of memory, use what we got
+  allocated = writer.num_bufs;
+  if (!writer.bufs || !writer.lens || writer.num_bufs < 1)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR,
+	  "Backend: Unable to allocate device output buffer");
+    ret = 1;
+    goto done;
+  }
 
+  if (log)
+    log(ld, CF_LOGLEVEL_DEBUG,
+	"Backend: Device output buffer: %d KB (%d buffer%s of %d KB)%s",
+	writer.num_bufs * (PR_DEVICE_BUFFER_CHUNK / 1024), writer.num_bufs,
+	writer.num_bufs == 1 ? "" : "s", PR_DEVICE_BUFFER_CHUNK / 1024,
+	writer.num_bufs > 1 ? ", writing asynchronously" : "");
 
-  return (papplJobIsCanceled(job) ? 1 : 0);
+  if (writer.num_bufs > 1)
+  {
+    pthread_mutex_init(&writer.mutex, NULL);
+    pthread_cond_init(&writer.cond, NULL);
+    if ((err = pthread_create(&tid, NULL, pr_device_writer_thread,
+			      &writer)) != 0)
+    {
+      pthread_cond_destroy(&writer.cond);
+      pthread_mutex_destroy(&writer.mutex);
+      if (log)
+	log(ld, CF_LOGLEVEL_WARN,
+	    "Backend: Unable to start device output thread, writing synchronously: %s",
+	    strerror(err));
+      writer.num_bufs = 1;	// Fall back to synchronous output
+    }
+  }
+
+  for (;;)
+  {
+    // Wait for a free buffer
+    if (writer.num_bufs > 1)
+    {
+      pthread_mutex_lock(&writer.mutex);
+      while (writer.count == writer.num_bufs && !writer.error)
+	pthread_cond_wait(&writer.cond, &writer.mutex);
+      if (writer.error)
+      {
+	pthread_mutex_unlock(&writer.mutex);
+	break;
+      }
+      pthread_mutex_unlock(&writer.mutex);
+    }
+    slot = writer.head;
+
+    if ((bytes = read(inputfd, writer.bufs[slot],
+		      PR_DEVICE_BUFFER_CHUNK)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+	continue;
+      break;
+    }
+    else if (bytes == 0)
+      break;
+
+    if (*debug_fd >= 0)
+      if (write(*debug_fd, writer.bufs[slot], (size_t)bytes) != bytes)
+      {
+	if (log)
+	  log(ld, CF_LOGLEVEL_ERROR,
+	      "Backend: Debug copy: Unable to write %d bytes, stopping debug copy, continuing job output.",
+	      (int)bytes);
+	close(*debug_fd);
+	*debug_fd = -1;
+      }
+
+    if (writer.num_bufs == 1)
+    {
+      if (papplDeviceWrite(device, writer.bufs[slot], (size_t)bytes) < 0)
+      {
+	writer.error = true;
+	break;
+      }
+    }
+    else
+    {
+      // Hand the buffer over to the writer thread
+      pthread_mutex_lock(&writer.mutex);
+      writer.lens[slot] = (size_t)bytes;
+      writer.head = (writer.head + 1) % writer.num_bufs;
+      writer.count ++;
+      pthread_cond_signal(&writer.cond);
+      pthread_mutex_unlock(&writer.mutex);
+    }
+  }
+
+  if (writer.num_bufs > 1)
+  {
+    // Let the writer thread drain the remaining buffers
+    pthread_mutex_lock(&writer.mutex);
+    writer.eof = true;
+    pthread_cond_signal(&writer.cond);
+    pthread_mutex_unlock(&writer.mutex);
+    pthread_join(tid, NULL);
+    pthread_cond_destroy(&writer.cond);
+    pthread_mutex_destroy(&writer.mutex);
+  }
+
+  if (writer.error)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR,
+	  "Backend: Output to device: Unable to send data to printer.");
+    ret = 1;
+  }
+  else
+    papplDeviceFlush(device);
+
+ done:
+  for (i = 0; writer.bufs && i < allocated; i ++)
+    free(writer.bufs[i]);
+  free(writer.bufs);
+  free(writer.lens);
+
+  return (ret);
 }
 
 
 //
-// '_prJobLog()' - Job log function which calls
-//                 papplJobSetImpressionsCompleted() on page logs of
-//                 filter functions
+// 'pr_resume_write()' - Write a buffer completely to the backend.
 //
 
-void
-_prJobLog(void *data,
-	  cf_loglevel_t level,
-	  const char *message,
-	  ...)
+static int				// O - 0 on success, -1 on error
+pr_resume_write(int        fd,		// I - Backend input
+		const char *buf,	// I - Data
+		size_t     len)		// I - Length of data
 {
-  va_list arglist;
-  pappl_job_t *job = (pappl_job_t *)data;
-  char buf[1024];
-  int page, copies;
+  ssize_t n;				// Bytes written
 
 
-  va_start(arglist, message);
-  vsnprintf(buf, sizeof(buf) - 1, message, arglist);
-  fflush(stdout);
-  va_end(arglist);
-  if (level == CF_LOGLEVEL_CONTROL)
+  while (len > 0)
   {
-    if (sscanf(buf, "PAGE: %d %d", &page, &copies) == 2)
+    if ((n = write(fd, buf, len)) < 0)
     {
-      papplJobSetImpressionsCompleted(job, copies);
-      papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Printing page %d, %d copies",
-		  page, copies);
+      if (errno == EINTR || errno == EAGAIN)
+	continue;
+      return (-1);
     }
-    else
-      papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Unused control message: %s",
-		  buf);
+    buf += n;
+    len -= (size_t)n;
   }
-  else
-    papplLogJob(job, (pappl_loglevel_t)level, "%s", buf);
+
+  return (0);
 }
 
 
 //
-// '_prOneBitDitherOnDraft()' - If an image job is printed in
-//                              grayscale in draft mode switch to
-//                              1-bit dithering mode to get printing
-//                              as fast as possible
+// 'pr_resume_back_channel()' - Pass what the printer reported on the
+//                              back channel to the journal, without
+//                              waiting.
 //
 
-void
-_prOneBitDitherOnDraft(
-    pappl_job_t        *job,     // I   - Job
-    pappl_pr_options_t *options) // I/O - Job options
+static void
+pr_resume_back_channel(pr_resume_t           *res,
+					// I - Journal
+		       pr_cups_device_data_t *device_data)
+					// I - Backend
 {
-  pappl_pr_driver_data_t driver_data;
+  struct pollfd pfd;			// Back channel to poll
+  char          buf[256];		// Back channel data
+  ssize_t       bytes;			// Bytes read
 
 
-  if (!strcmp(papplJobGetDocumentFormat(job, 1), "image/urf") ||
-      !strcmp(papplJobGetDocumentFormat(job, 1), "image/pwg-raster"))
-  {
-    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-		"Not changing Raster input color depth on PWG/Apple Raster input");
+  if (device_data->backfd < 0)
     return;
+
+  pfd.fd     = device_data->backfd;
+  pfd.events = POLLIN;
+  while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN) &&
+	 (bytes = read(device_data->backfd, buf, sizeof(buf))) > 0)
+    _prResumeBackChannel(res, buf, (size_t)bytes);
+}
+
+
+//
+// 'pr_resume_replay()' - Send a part of the journal to the backend.
+//
+
+static int				// O - 0 on success, -1 on error
+pr_resume_replay(pr_resume_t           *res,
+					// I - Journal
+		 pr_cups_device_data_t *device_data,
+					// I - Backend
+		 int                   fd,// I - Journal, opened for reading
+		 off_t                 from,// I - Start offset
+		 off_t                 to,// I - End offset
+		 off_t                 *sent)// O - Offset sent up to
+{
+  char    buf[PR_DEVICE_BUFFER_CHUNK];	// Copy buffer
+  ssize_t bytes;			// Bytes read
+
+
+  while (from < to)
+  {
+    if ((bytes = pread(fd, buf, to - from < (off_t)sizeof(buf) ?
+		       (size_t)(to - from) : sizeof(buf), from)) < 0)
+    {
+      if (errno == EINTR)
+	continue;
+      return (-1);
+    }
+    if (bytes == 0 || pr_resume_write(device_data->inputfd, buf,
+				      (size_t)bytes))
+      return (-1);
+    from += bytes;
+    *sent = from;
+    pr_resume_back_channel(res, device_data);
   }
 
-  papplPrinterGetDriverData(papplJobGetPrinter(job), &driver_data);
-  if (options->print_quality == IPP_QUALITY_DRAFT &&
-      options->print_color_mode != PAPPL_COLOR_MODE_COLOR &&
-      options->header.cupsNumColors == 1)
+  return (0);
+}
+
+
+//
+// 'pr_resumable_to_device()' - Send the print data to a CUPS backend,
+//                              keeping it in a journal. If the
+//                              connection to the printer gets lost,
+//                              the rest of the job still gets taken
+//                              from the filters, and after launching
+//                              the backend again the job continues at
+//                              the first page not printed yet, without
+//                              rendering anything again.
+//
+
+static int                                    // O - 0 on success, 1 on
+                                              //     error, -1 if not
+                                              //     possible
+pr_resumable_to_device(
+    int                             inputfd,  // I - Input stream
+    pappl_device_t                  *device,  // I - Device
+    pr_print_filter_function_data_t *params,  // I - Backend parameters
+    int                             *debug_fd,// IO - Debug copy file, -1
+                                              //      if none
+    cf_logfunc_t                    log,      // I - Log function
+    void                            *ld)      // I - Log function data
+{
+  pr_cups_device_data_t *device_data =
+    (pr_cups_device_data_t *)papplDeviceGetData(device);
+  pr_printer_app_global_data_t *global_data = params->global_data;
+  pr_resume_t *res;			// Journal of the job's output
+  char        buf[PR_DEVICE_BUFFER_CHUNK],// Copy buffer
+              filename[2048];		// Journal file when on disk
+  ssize_t     bytes;			// Bytes read
+  off_t       sent = 0,			// Offset sent to the printer
+              failed = -1,		// Offset when connection got lost
+              offset,			// Offset to continue at
+              header;			// Bytes of job setup
+  int         attempt,			// Reconnect attempt
+              page,			// Page to continue at
+              fd,			// Journal, opened for reading
+              ret = 0;
+  bool        ok;			// Job setup sent?
+
+
+  snprintf(filename, sizeof(filename), "%s/resume-%s-%d.prn",
+	   global_data->spool_dir,
+	   papplPrinterGetName(papplJobGetPrinter(params->job)),
+	   papplJobGetID(params->job));
+  if ((res = _prResumeCreate(filename,
+			     global_data->intermediate_mem_size)) == NULL)
+    return (-1);
+
+  while ((bytes = read(inputfd, buf, sizeof(buf))) != 0)
   {
-    options->header.cupsBitsPerColor = 1;
-    options->header.cupsBitsPerPixel = 1;
-    options->header.cupsColorSpace = CUPS_CSPACE_K;
-    options->header.cupsColorOrder = CUPS_ORDER_CHUNKED;
-    options->header.cupsNumColors = 1;
-    options->header.cupsBytesPerLine = (options->header.cupsWidth + 7) / 8;
-    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-		"Monochrome draft quality job -> 1-bit dithering for speed-up");
-    if (options->print_content_optimize == PAPPL_CONTENT_PHOTO ||
-	!strcmp(papplJobGetDocumentFormat(job, 1), "image/jpeg") ||
-	!strcmp(papplJobGetDocumentFormat(job, 1), "image/png"))
+    if (bytes < 0)
     {
-      memcpy(options->dither, driver_data.pdither, sizeof(options->dither));
-      papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-		  "Photo/Image-optimized dither matrix");
+      if (errno == EINTR || errno == EAGAIN)
+	continue;
+      ret = 1;
+      break;
+    }
+
+    if (_prResumeAdd(res, buf, (size_t)bytes))
+    {
+      if (log)
+	log(ld, CF_LOGLEVEL_ERROR,
+	    "Backend: Unable to keep the print data for resuming: %s",
+	    strerror(errno));
+      ret = 1;
+      break;
+    }
+
+    if (*debug_fd >= 0 &&
+	write(*debug_fd, buf, (size_t)bytes) != bytes)
+    {
+      if (log)
+	log(ld, CF_LOGLEVEL_ERROR,
+	    "Backend: Debug copy: Unable to write %d bytes, stopping debug copy, continuing job output.",
+	    (int)bytes);
+      close(*debug_fd);
+      *debug_fd = -1;
     }
+
+    if (failed < 0)
+    {
+      if (pr_resume_write(device_data->inputfd, buf, (size_t)bytes) == 0)
+	sent += bytes;
+      else
+      {
+	failed = sent;
+	if (log)
+	  log(ld, CF_LOGLEVEL_WARN,
+	      "Backend: Connection to printer lost after %lld bytes (%s), keeping the rest of the job for resuming",
+	      (long long)failed, strerror(errno));
+      }
+    }
+
+    pr_resume_back_channel(res, device_data);
+  }
+
+  // Reconnect and send what did not get printed
+  for (attempt = 1; failed >= 0 && ret == 0; attempt ++)
+  {
+    if (attempt > PR_RESUME_MAX_ATTEMPTS || papplJobIsCanceled(params->job))
+    {
+      ret = 1;
+      break;
+    }
+
+    sleep(PR_RESUME_RETRY_DELAY);
+
+    _prCUPSDevCancelBackend(device, 0);
+    if (!_prCUPSDevLaunchBackend(device))
+      continue;
+
+    offset = _prResumeOffset(res, failed, &header, &page);
+    if (log)
+      log(ld, CF_LOGLEVEL_INFO,
+	  "Backend: Reconnected to printer (attempt %d), resuming at page %d (byte %lld of %lld)%s",
+	  attempt, page, (long long)offset,
+	  (long long)res->journal->size,
+	  res->printed >= 0 ? ", as reported by the printer" : "");
+
+    if ((fd = _prIntermediateOpen(res->journal)) < 0)
+    {
+      ret = 1;
+      break;
+    }
+    // Job setup first, then the pages
+    ok = (pr_resume_replay(res, device_data, fd, 0, header, &sent) == 0);
+    sent = offset;
+    if (ok &&
+	pr_resume_replay(res, device_data, fd, offset, res->journal->size,
+			 &sent) == 0)
+      failed = -1;
     else
     {
-      memcpy(options->dither, driver_data.gdither, sizeof(options->dither));
-      papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-		  "General-purpose dither matrix");
+      // Lost again, continue from where we got this time
+      failed = sent > offset ? sent : offset;
+      if (log)
+	log(ld, CF_LOGLEVEL_WARN,
+	    "Backend: Connection to printer lost again after byte %lld",
+	    (long long)failed);
     }
+    close(fd);
   }
-  else
-    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-		"Not in monochrome draft mode -> no color depth change applied");
+
+  // A backend we launched in a filter process has to finish here, the
+  // job's process does not know about it
+  if (attempt > 1 && getpid() != params->job_pid)
+    _prCUPSDevStopBackend(device);
+
+  _prResumeFree(res);
+
+  return (ret);
 }
 
 
 //
-// `_prCleanDebugCopies()' - Remove debug copies of jobs created by
-//                           the _prPrintFilterFunction() function
-//                           more than 24 hours ago. This avoids
-//                           filling up the disk should the user have
-//                           switched to debug logging for some reason
-//                           and forgot to turn back after solving his
-//                           problem.
+// 'pr_copy_to_intermediate()' - Copy all data from a file descriptor
+//                               into an intermediate file.
 //
 
-void
-_prCleanDebugCopies(pr_printer_app_global_data_t *global_data)
+static int				// O - 0 on success, -1 on error
+pr_copy_to_intermediate(int inputfd,	// I - Input
+			pr_intermediate_t *im)// I - Intermediate file
 {
-  cups_dir_t	*dir;			// Directory pointer
-  cups_dentry_t	*dent;			// Directory entry
-  char		filename[2048];		// Name of PPD or directory
-  time_t        outdated;               // Files older than this time
-                                        // get deleted
-
+  char    buf[PR_DEVICE_BUFFER_CHUNK];	// Copy buffer
+  ssize_t bytes;			// Bytes read
 
-  papplLog(global_data->system, PAPPL_LOGLEVEL_DEBUG,
-	   "Checking for old debug copy files in the spool directory %s",
-	   global_data->spool_dir);
 
-  // Open spool directory
-  if ((dir = cupsDirOpen(global_data->spool_dir)) == NULL)
+  while ((bytes = read(inputfd, buf, sizeof(buf))) != 0)
   {
-    papplLog(global_data->system, PAPPL_LOGLEVEL_ERROR,
-	     "Unable to open spool directory %s: %s",
-	     global_data->spool_dir, strerror(errno));
-    return;
+    if (bytes < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+	continue;
+      return (-1);
+    }
+    if (_prIntermediateWrite(im, buf, (size_t)bytes))
+      return (-1);
   }
 
-  // Files older than 24 hours are outdated and get deleted
-  outdated = time(NULL) - 24 * 60 * 60;
+  return (0);
+}
 
-  // Go through all files and remov ethe outdated debug copied
-  while ((dent = cupsDirRead(dir)) != NULL)
+
+//
+// 'pr_copy_fd()' - Copy all data from one file descriptor to another.
+//
+
+static int				// O - 0 on success, -1 on error
+pr_copy_fd(int inputfd,			// I - Input
+	   int outputfd)		// I - Output
+{
+  char    buf[PR_DEVICE_BUFFER_CHUNK];	// Copy buffer
+  ssize_t bytes,			// Bytes read
+          written,			// Bytes written
+          n;
+
+
+  while ((bytes = read(inputfd, buf, sizeof(buf))) != 0)
   {
-    if (S_ISDIR(dent->fileinfo.st_mode) || dent->filename[0] == '.' ||
-	dent->fileinfo.st_mtime > outdated ||
-	strncmp(dent->filename, "debug-jobdata-", 14))
-      continue;
-    snprintf(filename, sizeof(filename), "%s/%s",
-	     global_data->spool_dir, dent->filename);
-    unlink(filename);
-    papplLog(global_data->system, PAPPL_LOGLEVEL_DEBUG,
-	     "Deleted old debug copy file %s", dent->filename);
+    if (bytes < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+	continue;
+      return (-1);
+    }
+    for (written = 0; written < bytes; written += n)
+      if ((n = write(outputfd, buf + written, bytes - written)) < 0)
+      {
+	if (errno != EINTR && errno != EAGAIN)
+	  return (-1);
+	n = 0;
+      }
   }
 
-  cupsDirClose(dir);
+  return (0);
 }
 
 
@@ -1444,10 +3963,21 @@ _prCleanDebugCopies(pr_printer_app_global_data_t *global_data)
 //                              web interface) from every job a copy
 //                              of the data actually sent to the
 //                              printer gets saved in a file
-//                              (debug-copy-PRINTER-JOB.prn) in the
+//                              (debug-jobdata-PRINTER-JOB.prn) in the
 //                              spool directory. These files are kept
-//                              for 24 hours (clean-up done with every
-//                              new job, independent of log level).
+//                              for 24 hours by default (clean-up done
+//                              periodically by _prSpoolJanitor(),
+//                              independent of log level).
+//                              If the device is a CUPS backend, which
+//                              we feed through a pipe, the data is
+//                              moved with splice() without copying it
+//                              through our buffer. Otherwise the
+//                              data goes through a ring of buffers
+//                              (memory budget set with the
+//                              DEVICE_BUFFER_SIZE environment
+//                              variable) which a separate thread
+//                              writes to the device, so the filters
+//                              are not stalled by a slow printer.
 //
 
 int                                           // O - Error status
@@ -1460,76 +3990,126 @@ _prPrintFilterFunction(int inputfd,           // I - File descriptor input
 		       cf_filter_data_t *data,// I - Job and printer data
 		       void *parameters)      // I - PAPPL output device
 {
-  ssize_t	       bytes;	              // Bytes read/written
-  char	               buffer[65536];         // Read/write buffer
   cf_logfunc_t         log = data->logfunc;   // Log function
   void                 *ld = data->logdata;   // log function data
   pr_print_filter_function_data_t *params =
     (pr_print_filter_function_data_t *)parameters;
   pappl_device_t       *device = params->device; // PAPPL output device
-  pappl_job_t          *job = params->job;
-  pappl_printer_t      *printer;
   pr_printer_app_global_data_t *global_data = params->global_data;
-  char                 filename[2048];        // Name for debug copy of the
-                                              // job
-  int                  debug_fd = -1;         // File descriptor for debug copy
+  int                  copy_fd = -1;          // File descriptor for copy of
+                                              // the output (debug copy or
+                                              // output cache)
+  pr_cups_device_data_t *device_data;         // Data of CUPS backend device
+  int                  ret = -1;
 
 
   (void)inputseekable;
 
-  // Remove debug copies of old jobs
-  _prCleanDebugCopies(global_data);
+  if (params->replay)
+  {
+    // Render-once copies: One copy goes into the intermediate file
+    // only, _prFilter() sends it to the device for each copy
+    if ((ret = pr_copy_to_intermediate(inputfd, params->replay)) != 0 && log)
+      log(ld, CF_LOGLEVEL_ERROR,
+	  "Backend: Unable to write intermediate file for the copies: %s",
+	  strerror(errno));
+    _prIntermediateFinish(params->replay);
+    close(inputfd);
+    close(outputfd);
+    return (ret);
+  }
+
+  if (params->replay_file[0])
+  {
+    // Render-once copies: One copy goes into the replay file only,
+    // _prFilter() sends it to the device for each copy
+    if ((copy_fd = open(params->replay_file, O_CREAT | O_WRONLY | O_TRUNC,
+			S_IRUSR | S_IWUSR)) < 0)
+    {
+      if (log)
+	log(ld, CF_LOGLEVEL_ERROR,
+	    "Backend: Unable to create file for the copies %s: %s",
+	    params->replay_file, strerror(errno));
+    }
+    else if ((ret = pr_copy_fd(inputfd, copy_fd)) != 0 && log)
+      log(ld, CF_LOGLEVEL_ERROR,
+	  "Backend: Unable to write file for the copies %s: %s",
+	  params->replay_file, strerror(errno));
+    if (copy_fd >= 0)
+      close(copy_fd);
+    close(inputfd);
+    close(outputfd);
+    return (ret);
+  }
 
-  if (papplSystemGetLogLevel(global_data->system) == PAPPL_LOGLEVEL_DEBUG)
+  if (params->cache_file[0])
+  {
+    // Output goes into the output cache, if we are in debug mode the
+    // debug copy gets linked to the cache file when we are done
+    copy_fd = open(params->cache_file, O_CREAT | O_WRONLY | O_TRUNC,
+		   S_IRUSR | S_IWUSR);
+  }
+  else if (params->debug_copy[0])
   {
-    // We are in debug mode
-    // Debug copy file name (in spool directory)
-    printer = papplJobGetPrinter(job);
-    snprintf(filename, sizeof(filename), "%s/debug-jobdata-%s-%d.prn",
-	     global_data->spool_dir, papplPrinterGetName(printer),
-	     papplJobGetID(job));
+    // We are in debug mode, file name got set by _prRegisterDebugCopy()
     if (log)
       log(ld, CF_LOGLEVEL_DEBUG,
 	  "Backend: Creating debug copy of what goes to the printer: %s",
-	  filename);
+	  params->debug_copy);
     // Open the file
-    debug_fd = open(filename, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR);
+    copy_fd = open(params->debug_copy, O_CREAT | O_WRONLY,
+		   S_IRUSR | S_IWUSR);
   }
 
-  while ((bytes = read(inputfd, buffer, sizeof(buffer))) > 0)
+  // CUPS backends can be launched again when the connection to the
+  // printer gets lost, keep the data to resume the job then
+  if (global_data->resume_jobs && params->job &&
+      strncmp(params->device_uri, "cups:", 5) == 0 &&
+      (device_data = (pr_cups_device_data_t *)papplDeviceGetData(device)) !=
+      NULL &&
+      (device_data->backend_pid || _prCUPSDevLaunchBackend(device)))
   {
-    if (debug_fd >= 0)
-      if (write(debug_fd, buffer, (size_t)bytes) != bytes)
-      {
-	if (log)
-	  log(ld, CF_LOGLEVEL_ERROR,
-	      "Backend: Debug copy: Unable to write %d bytes, stopping debug copy, continuing job output.",
-	      (int)bytes);
-	close(debug_fd);
-	debug_fd = -1;
-      }
+    papplDeviceFlush(device);
+    ret = pr_resumable_to_device(inputfd, device, params, &copy_fd, log, ld);
+  }
 
-    if (papplDeviceWrite(device, buffer, (size_t)bytes) < 0)
+  // Zero-copy path for CUPS backends, their input is a pipe
+  if (ret < 0 && strncmp(params->device_uri, "cups:", 5) == 0 &&
+      (device_data = (pr_cups_device_data_t *)papplDeviceGetData(device)) !=
+      NULL &&
+      (device_data->backend_pid || _prCUPSDevLaunchBackend(device)))
+  {
+    // Get anything already buffered by PAPPL out first
+    papplDeviceFlush(device);
+    ret = pr_splice_to_device(inputfd, device_data->inputfd, &copy_fd,
+			      log, ld);
+  }
+
+  if (ret < 0)
+    ret = pr_buffered_to_device(inputfd, device, &copy_fd,
+				global_data->device_buffer_size, log, ld);
+
+  if (params->cache_file[0])
+  {
+    if (copy_fd < 0 || ret)
+      // Copy incomplete, do not let it go into the cache
+      unlink(params->cache_file);
+    else if (params->debug_copy[0])
     {
-      if (log)
-	log(ld, CF_LOGLEVEL_ERROR,
-	    "Backend: Output to device: Unable to send %d bytes to printer.",
-	    (int)bytes);
-      if (debug_fd >= 0)
-	close(debug_fd);
-      close(inputfd);
-      close(outputfd);
-      return (1);
+      unlink(params->debug_copy);
+      if (link(params->cache_file, params->debug_copy) == 0 && log)
+	log(ld, CF_LOGLEVEL_DEBUG,
+	    "Backend: Debug copy of what went to the printer: %s",
+	    params->debug_copy);
     }
   }
-  papplDeviceFlush(device);
 
-  if (debug_fd >= 0)
-    close(debug_fd);
+  if (copy_fd >= 0)
+    close(copy_fd);
 
   close(inputfd);
   close(outputfd);
-  return (0);
+  return (ret);
 }
 
 
@@ -1550,29 +4130,35 @@ _prRasterPrepareJob(
     pappl_device_t   *device,   // I - Device
     char             *starttype)// I - MIME type to feed into the filters
 {
-  int                    i;
   pr_job_data_t          *job_data;  // PPD data for job
-  pr_cups_device_data_t  *device_data = NULL; // Device data of CUPS backend
-                                     // device
   int                    nullfd;     // File descriptor pointing to /dev/null
   cf_filter_external_t   *ppd_filter_params = NULL;
                                      // Parameters for call of PPD's
                                      // CUPS filter via ppdFilterExternalCUPS()
+  const pr_filter_plugin_t *plugin;  // CUPS filter as shared object
   pr_print_filter_function_data_t *print_params; // Paramaters for
                                      // _prPrintFilterFunction()
 
 
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-	      "Printing job in streaming mode");
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-	      "Converting raster input to format %s for further filtering",
-	      starttype);
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	    "Printing job in streaming mode");
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	    "Converting raster input to format %s for further filtering",
+	    starttype);
 
   // Load PPD file and determine the PPD options equivalent to the job options
   job_data = _prCreateJobData(job, options);
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-	      "Filtering data to get format %s to send off to the driver or device",
-	      job_data->stream_format->dsttype);
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	    "Filtering data to get format %s to send off to the driver or device",
+	    job_data->stream_format->dsttype);
+
+  // Wait for a render slot, so that the filter chains of all printers
+  // together do not overload the host
+  if (!_prGovernorAcquire(job_data->global_data, job))
+  {
+    _prFreeJobData(job_data);
+    return (NULL);
+  }
 
   // Do not generate copies in post-filtering, for PWG/Apple Raster input
   // the client has to generate copies, for images PAPPL generates them
@@ -1587,15 +4173,11 @@ _prRasterPrepareJob(
 		  job_data->filter_data->num_options,
 		  &job_data->filter_data->options);
 
-  // Connect the job's filter_data to the backend
+  // Connect the job's filter_data to the backend, or the job to the
+  // backend left running by the previous job
   if (strncmp(job_data->device_uri, "cups:", 5) == 0)
-  {
-    // Get the device data
-    device_data = (pr_cups_device_data_t *)papplDeviceGetData(device);
-
-    // Connect the filter_data
-    device_data->filter_data = job_data->filter_data;
-  }
+    _prCUPSDevStartJob(device, job_data->filter_data,
+		       _prCUPSDevSessionPossible(device, job_data->ppd));
 
   // The filter chain has no output, data is going directly to the device
   nullfd = open("/dev/null", O_RDWR);
@@ -1606,14 +4188,14 @@ _prRasterPrepareJob(
   // data format and/or call the CUPS filter defined in the PPD file, and the
   // print filter function
   job_data->chain = cupsArrayNew(NULL, NULL, NULL, 0, NULL, NULL);
-  for (i = 0; i < job_data->stream_format->num_filters; i ++)
-    cupsArrayAdd(job_data->chain, &(job_data->stream_format->filters[i]));
+  _prRenderPoolAddFilters(job_data, job_data->chain, PR_RENDER_STREAM,
+			  job_data->stream_format);
   // Set input and output formats for the filter chain
   job_data->filter_data->content_type = starttype;
   job_data->filter_data->final_content_type = job_data->stream_format->dsttype;
   // Convert PPD file data into printer IPP attributes and options,
   // for the filter functions being able to use it
-  ppdFilterLoadPPD(job_data->filter_data);
+  pr_load_ppd(job, job_data);
   // Filter from PPD?
   if (strlen(job_data->stream_filter) > 1) // A null filter is a
                                            // single char, '-' or '.',
@@ -1622,17 +4204,29 @@ _prRasterPrepareJob(
                                            // '/', so at least 2
                                            // chars.
   {
-    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-		"Using CUPS filter (printer driver): %s",
-		job_data->stream_filter);
-    ppd_filter_params =
-      (cf_filter_external_t *)calloc(1, sizeof(cf_filter_external_t));
-    ppd_filter_params->filter = job_data->stream_filter;
+    _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	      "Using CUPS filter (printer driver): %s",
+	      job_data->stream_filter);
     job_data->ppd_filter =
       (cf_filter_filter_in_chain_t *)calloc(1,
 					  sizeof(cf_filter_filter_in_chain_t));
-    job_data->ppd_filter->function = ppdFilterExternalCUPS;
-    job_data->ppd_filter->parameters = ppd_filter_params;
+    if ((plugin = _prFilterPluginFind(job_data->global_data,
+				      job_data->stream_filter)) != NULL)
+    {
+      // The driver provides its filter as shared object, run it in-process
+      _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+		"Running CUPS filter %s as filter plugin", plugin->name);
+      job_data->ppd_filter->function = plugin->function;
+      job_data->ppd_filter->parameters = plugin->parameters;
+    }
+    else
+    {
+      ppd_filter_params =
+	(cf_filter_external_t *)calloc(1, sizeof(cf_filter_external_t));
+      ppd_filter_params->filter = job_data->stream_filter;
+      job_data->ppd_filter->function = ppdFilterExternalCUPS;
+      job_data->ppd_filter->parameters = ppd_filter_params;
+    }
     job_data->ppd_filter->name = strrchr(job_data->stream_filter, '/') + 1;
     cupsArrayAdd(job_data->chain, job_data->ppd_filter);
   } else
@@ -1646,6 +4240,9 @@ _prRasterPrepareJob(
   print_params->device_uri = job_data->device_uri;
   print_params->job = job;
   print_params->global_data = job_data->global_data;
+  print_params->job_pid = getpid();
+  _prRegisterDebugCopy(job_data->global_data, job, print_params->debug_copy,
+		       sizeof(print_params->debug_copy));
   job_data->print =
     (cf_filter_filter_in_chain_t *)calloc(1,
 					  sizeof(cf_filter_filter_in_chain_t));
@@ -1664,10 +4261,11 @@ _prRasterPrepareJob(
 
   if (job_data->device_fd < 0)
   {
-    papplLogJob(job, PAPPL_LOGLEVEL_ERROR,
-		"Unable to create pipe for filtering and sending off the job");
+    _prLogJob(job, PAPPL_LOGLEVEL_ERROR,
+	      "Unable to create pipe for filtering and sending off the job");
     if (strlen(job_data->stream_filter) > 1)
       free(ppd_filter_params);
+    _prGovernorRelease(job_data->global_data, papplJobGetPrinter(job));
     _prFreeJobData(job_data);
     return (NULL);
   }
@@ -1688,40 +4286,38 @@ _prRasterCleanUpJob(pappl_job_t      *job,      // I - Job
 		    pappl_device_t   *device)   // I - Device
 {
   pr_job_data_t *job_data = (pr_job_data_t *)papplJobGetData(job);
-  pr_cups_device_data_t *device_data = NULL; // Device data of CUPS backend
-                                             // device
 
 
   // Stop the filter chain
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-	      "Shutting down filter chain");
+  _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+	    "Shutting down filter chain");
   cfFilterPClose(job_data->device_fd, job_data->device_pid,
 	       job_data->filter_data);
 
   // Update status
   _prUpdateStatus(papplJobGetPrinter(job), device);
 
-  // Stop the backend and disconnect the job's filter_data to the backend
+  // Stop the backend and disconnect the job's filter_data to the backend,
+  // unless the backend keeps running for the next job
   if (strncmp(job_data->device_uri, "cups:", 5) == 0)
   {
-    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG,
-		"Shutting down CUPS backend");
-
-    // Stop the backend
     // We stop it here explicitly as we will free the filter_data structure
     // and without it the backend shutdoen will not have access to the log
     // function any more.
-    _prCUPSDevStopBackend(device);
-
-    // Get the device data
-    device_data = (pr_cups_device_data_t *)papplDeviceGetData(device);
-
-    // Disconnect the filter_data
-    device_data->filter_data = NULL;
+    if (_prCUPSDevEndJob(device, !papplJobIsCanceled(job)))
+      _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+		"Keeping CUPS backend running for the next job");
+    else
+      _prLogJob(job, PAPPL_LOGLEVEL_DEBUG,
+		"Shut down CUPS backend");
   }
 
+  // Give the render slot back
+  _prGovernorRelease(job_data->global_data, papplJobGetPrinter(job));
+
   // Free the data structures
-  if (strlen(job_data->stream_filter) > 1)
+  if (job_data->ppd_filter &&
+      job_data->ppd_filter->function == ppdFilterExternalCUPS)
     free(job_data->ppd_filter->parameters);
   _prFreeJobData(job_data);
   papplJobSetData(job, NULL);
@@ -1816,8 +4412,8 @@ prPWGRasterStartJob(
 
   if (!job_data)
   {
-    papplLogJob(job, PAPPL_LOGLEVEL_ERROR,
-		"Unable to create job metadata record");
+    _prLogJob(job, PAPPL_LOGLEVEL_ERROR,
+	      "Unable to create job metadata record");
     return (false);
   }
 
@@ -1825,8 +4421,8 @@ prPWGRasterStartJob(
   raster = cupsRasterOpen(job_data->device_fd, CUPS_RASTER_WRITE_PWG);
   if (raster == NULL)
   {
-    papplLogJob(job, PAPPL_LOGLEVEL_ERROR,
-		"Unable to open PWG Raster output stream");
+    _prLogJob(job, PAPPL_LOGLEVEL_ERROR,
+	      "Unable to open PWG Raster output stream");
     return(false);
   }
   job_data->data = raster;
@@ -1859,8 +4455,8 @@ prPWGRasterStartPage(
 
   if (!cupsRasterWriteHeader(raster, &(options->header)))
   {
-    papplLogJob(job, PAPPL_LOGLEVEL_ERROR,
-		"Unable to output PWG Raster header for page %d", page);
+    _prLogJob(job, PAPPL_LOGLEVEL_ERROR,
+	      "Unable to output PWG Raster header for page %d", page);
     return(false);
   }
 
@@ -1895,8 +4491,8 @@ prPWGRasterWriteLine(
     if (!cupsRasterWritePixels(raster, (unsigned char *)pixels,
 			       options->header.cupsBytesPerLine))
     {
-      papplLogJob(job, PAPPL_LOGLEVEL_ERROR,
-		  "Unable to output PWG Raster pixel line %d", y);
+      _prLogJob(job, PAPPL_LOGLEVEL_ERROR,
+		"Unable to output PWG Raster pixel line %d", y);
       return(false);
     }
   job_data->line_count ++;
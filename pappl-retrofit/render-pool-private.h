@@ -0,0 +1,107 @@
+//
+// PPD/Classic CUPS driver retro-fit Printer Application Library
+// (libpappl-retrofit) for the Printer Application Framework (PAPPL)
+//
+// render-pool-private.h
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#ifndef _PAPPL_RETROFIT_RENDER_POOL_H_
+#  define _PAPPL_RETROFIT_RENDER_POOL_H_
+
+//
+// Include necessary headers...
+//
+
+#include <pappl-retrofit/pappl-retrofit.h>
+#include <pappl-retrofit/print-job-private.h>
+#include <pappl/pappl.h>
+#include <cupsfilters/filter.h>
+
+
+//
+// C++ magic...
+//
+
+#  ifdef __cplusplus
+extern "C" {
+#  endif // __cplusplus
+
+
+//
+// Constants...
+//
+
+#define PR_RENDER_POOL_MAX_WORKERS 64	// Maximum size of the pool
+#define PR_RENDER_POOL_MAX_JOBS_DEFAULT 100
+					// Default for jobs done by a worker
+					// before it gets replaced
+#define PR_RENDER_WORKER_SHUTDOWN 2	// Exit status of a worker when the
+					// pool got shut down
+
+
+//
+// Types...
+//
+
+typedef enum pr_render_kind_e		// Which filters a worker has to run
+{
+  PR_RENDER_CONVERSION,			// Filters of a spooling conversion
+  PR_RENDER_STREAM			// Filters of a stream format
+} pr_render_kind_t;
+
+typedef struct pr_render_request_s	// Job for a render worker, the input,
+					// output, and status file descriptors
+					// get sent along with it
+{
+  pr_render_kind_t kind;		// Spooling conversion or stream format
+  int            index;			// Index in list of conversions/formats
+  int            job_id;		// Job ID
+  int            copies;		// Number of copies
+  char           printer[256],		// Printer name
+                 user[256],		// Job user
+                 title[256],		// Job title
+                 content_type[256],	// Input format
+                 final_content_type[256],// Output format
+                 ppdfile[1024];		// PPD file
+  int            num_options;		// Number of options
+  size_t         options_len;		// Bytes used in options
+  char           options[16384];	// Options, as name/value pairs of
+					// nul-terminated strings
+} pr_render_request_t;
+
+typedef struct pr_render_pool_filter_s	// Parameters of _prRenderPoolFilter()
+{
+  pr_printer_app_global_data_t *global_data;
+					// Global data
+  pr_render_kind_t kind;		// Spooling conversion or stream format
+  int            index;			// Index in list of conversions/formats
+} pr_render_pool_filter_t;
+
+
+//
+// Functions...
+//
+
+extern void   _prRenderPoolAddFilters(pr_job_data_t *job_data,
+				      cups_array_t *chain,
+				      pr_render_kind_t kind, void *format);
+extern int    _prRenderPoolFilter(int inputfd, int outputfd,
+				  int inputseekable, cf_filter_data_t *data,
+				  void *parameters);
+extern void   _prRenderPoolStart(pr_printer_app_global_data_t *global_data);
+extern void   _prRenderPoolStop(pr_printer_app_global_data_t *global_data);
+
+
+//
+// C++ magic...
+//
+
+#  ifdef __cplusplus
+}
+#  endif // __cplusplus
+
+
+#endif // !_PAPPL_RETROFIT_RENDER_POOL_H_
@@ -0,0 +1,770 @@
+//
+// PPD/Classic CUPS driver retro-fit Printer Application Library
+// (libpappl-retrofit) for the Printer Application Framework (PAPPL)
+//
+// render-pool.c
+//
+// Pool of long-lived render worker processes which run the
+// Ghostscript-based conversion filters of jobs, so that jobs do not
+// need to fork the (large, multi-threaded) Printer Application
+// process to render. A single-threaded supervisor process gets forked
+// at startup, before PAPPL starts its threads. It starts the workers
+// and replaces them when they have done a configurable number of jobs
+// or when they crash.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+//
+// Include necessary headers...
+//
+
+#include <pappl-retrofit/render-pool-private.h>
+#include <pappl-retrofit/pappl-retrofit-private.h>
+#include <pappl-retrofit/libcups2-private.h>
+#include <ppd/ppd-filter.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+
+//
+// Local globals...
+//
+
+static volatile sig_atomic_t pr_render_pool_stopping = 0;
+					// Supervisor got SIGTERM?
+
+
+//
+// 'pr_render_worker_log()' - Log function for filters run by a render
+//                            worker, logs into the system log with the
+//                            job ID.
+//
+
+static void
+pr_render_worker_log(void *data,		// I - Global data
+		     cf_loglevel_t level,	// I - Log level
+		     const char *message,	// I - Message
+		     ...)			// I - Additional arguments
+{
+  pr_printer_app_global_data_t *global_data =
+    (pr_printer_app_global_data_t *)data;
+  va_list	arglist;			// Argument list
+  char		buf[2048];
+
+
+  // Page count messages are of no use here, the job's page count comes
+  // from the printer driver filter
+  if (level == CF_LOGLEVEL_CONTROL ||
+      (pappl_loglevel_t)level < papplSystemGetLogLevel(global_data->system))
+    return;
+
+  va_start(arglist, message);
+  vsnprintf(buf, sizeof(buf), message, arglist);
+  va_end(arglist);
+
+  papplLog(global_data->system, (pappl_loglevel_t)level,
+	   "[Render worker %d] %s", (int)getpid(), buf);
+}
+
+
+//
+// 'pr_render_worker_job()' - Run the filters of one job in a render
+//                            worker.
+//
+
+static int				// O - Exit status of filter chain
+pr_render_worker_job(
+    pr_printer_app_global_data_t *global_data,
+					// I - Global data
+    pr_render_request_t *request,	// I - Job
+    int inputfd,			// I - Input data
+    int outputfd)			// I - Output data
+{
+  cf_filter_data_t filter_data;		// Job data for the filters
+  cf_filter_filter_in_chain_t *filters;	// Filters to run
+  pr_spooling_conversion_t *conversion;
+  pr_stream_format_t *stream_format;
+  cups_array_t   *chain;
+  const char     *name,
+                 *value;
+  size_t         pos;
+  int            num_filters = 0,
+                 i,
+                 ret;
+
+
+  if (request->kind == PR_RENDER_CONVERSION &&
+      (conversion =
+       (pr_spooling_conversion_t *)
+       cupsArrayGetElement(global_data->config->spooling_conversions,
+			   request->index)) != NULL)
+  {
+    filters = conversion->filters;
+    num_filters = conversion->num_filters;
+  }
+  else if (request->kind == PR_RENDER_STREAM &&
+	   (stream_format =
+	    (pr_stream_format_t *)
+	    cupsArrayGetElement(global_data->config->stream_formats,
+				request->index)) != NULL)
+  {
+    filters = stream_format->filters;
+    num_filters = stream_format->num_filters;
+  }
+  else
+    return (1);
+
+  memset(&filter_data, 0, sizeof(filter_data));
+  filter_data.printer = request->printer;
+  filter_data.job_id = request->job_id;
+  filter_data.job_user = request->user;
+  filter_data.job_title = request->title;
+  filter_data.copies = request->copies;
+  filter_data.content_type = request->content_type;
+  filter_data.final_content_type = request->final_content_type;
+  for (i = 0, pos = 0;
+       i < request->num_options && pos < request->options_len;
+       i ++)
+  {
+    name = request->options + pos;
+    pos += strlen(name) + 1;
+    value = request->options + pos;
+    pos += strlen(value) + 1;
+    filter_data.num_options = cupsAddOption(name, value,
+					    filter_data.num_options,
+					    &filter_data.options);
+  }
+  filter_data.back_pipe[0] = filter_data.back_pipe[1] = -1;
+  filter_data.side_pipe[0] = filter_data.side_pipe[1] = -1;
+  filter_data.logfunc = pr_render_worker_log;
+  filter_data.logdata = global_data;
+
+  setenv("PRINTER", request->printer, 1);
+
+  // Load the PPD file, as the filters need it
+  if (request->ppdfile[0])
+    ppdFilterLoadPPDFile(&filter_data, request->ppdfile);
+
+  chain = cupsArrayNew(NULL, NULL, NULL, 0, NULL, NULL);
+  for (i = 0; i < num_filters; i ++)
+    cupsArrayAdd(chain, filters + i);
+
+  papplLog(global_data->system, PAPPL_LOGLEVEL_DEBUG,
+	   "[Render worker %d] Rendering job %d of printer %s", (int)getpid(),
+	   request->job_id, request->printer);
+
+  ret = cfFilterChain(inputfd, outputfd, 1, &filter_data, chain);
+
+  cupsArrayDelete(chain);
+  if (request->ppdfile[0])
+    ppdFilterFreePPDFile(&filter_data);
+  cupsFreeOptions(filter_data.num_options, filter_data.options);
+
+  return (ret);
+}
+
+
+//
+// 'pr_render_worker_run()' - Run a job in a sub-process of the render
+//                            worker, in its own process group. When
+//                            the job gets canceled, the requesting
+//                            filter closes its end of the status pipe,
+//                            and we stop the job's filters with
+//                            SIGTERM and, after PR_CANCEL_GRACE_PERIOD,
+//                            SIGKILL.
+//
+
+static int				// O - Exit status of filter chain
+pr_render_worker_run(
+    pr_printer_app_global_data_t *global_data,
+					// I - Global data
+    pr_render_request_t *request,	// I - Job
+    int fds[3])				// I - Input, output, status
+{
+  struct pollfd  pfds[2];		// Job process and status pipe
+  int            done_pipe[2],		// Closed when the job process ends
+                 status;
+  pid_t          pid;
+  double         now,
+                 canceled = 0.0;	// Time the cancel was seen
+
+
+  if (pipe(done_pipe))
+    return (1);
+
+  if ((pid = fork()) == 0)
+  {
+    setpgid(0, 0);
+    close(done_pipe[0]);
+    _exit(pr_render_worker_job(global_data, request, fds[0], fds[1]));
+  }
+  close(done_pipe[1]);
+  if (pid < 0)
+  {
+    close(done_pipe[0]);
+    return (1);
+  }
+  // Also here, to not depend on whether the child got scheduled yet
+  setpgid(pid, pid);
+
+  // poll() reports an error for our end of the status pipe when the
+  // requester has closed its end
+  memset(pfds, 0, sizeof(pfds));
+  pfds[0].fd     = done_pipe[0];
+  pfds[0].events = POLLIN;
+  pfds[1].fd     = fds[2];
+  pfds[1].events = 0;
+
+  for (;;)
+  {
+    if (poll(pfds, canceled > 0.0 ? 1 : 2,
+	     canceled > 0.0 ? PR_CANCEL_POLL_INTERVAL / 1000 : -1) < 0)
+    {
+      if (errno == EINTR)
+	continue;
+      break;
+    }
+    if (pfds[0].revents)
+      break;				// Job process done
+
+    now = _prGetCurrentTime();
+    if (canceled == 0.0 && (pfds[1].revents & (POLLERR | POLLHUP)))
+    {
+      papplLog(global_data->system, PAPPL_LOGLEVEL_INFO,
+	       "[Render worker %d] Job %d canceled, stopping its filters",
+	       (int)getpid(), request->job_id);
+      canceled = now;
+    }
+    if (canceled > 0.0)
+      killpg(pid, now - canceled < PR_CANCEL_GRACE_PERIOD ? SIGTERM :
+	     SIGKILL);
+  }
+  close(done_pipe[0]);
+
+  while (waitpid(pid, &status, 0) < 0)
+    if (errno != EINTR)
+      return (1);
+
+  return (WIFEXITED(status) ? WEXITSTATUS(status) : 1);
+}
+
+
+//
+// 'pr_render_worker()' - Main loop of a render worker, takes jobs from
+//                        the pool's socket until it has done the
+//                        configured number of jobs.
+//
+
+static void
+pr_render_worker(pr_printer_app_global_data_t *global_data)
+					// I - Global data
+{
+  pr_render_request_t *request;		// Job to do
+  struct msghdr  msg;			// Message with file descriptors
+  struct iovec   iov;
+  struct cmsghdr *cmsg;
+  char           control[CMSG_SPACE(3 * sizeof(int))];
+  int            fds[3],		// Input, output, status
+                 num_fds,
+                 jobs,
+                 status,
+                 i;
+  ssize_t        bytes;
+
+
+  if ((request = (pr_render_request_t *)malloc(sizeof(pr_render_request_t)))
+      == NULL)
+    _exit(1);
+
+  for (jobs = 0; jobs < global_data->render_pool_max_jobs; jobs ++)
+  {
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = request;
+    iov.iov_len = sizeof(pr_render_request_t);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if ((bytes = recvmsg(global_data->render_pool_fds[0], &msg, 0)) < 0)
+    {
+      if (errno == EINTR)
+      {
+	jobs --;
+	continue;
+      }
+      break;
+    }
+    else if (bytes == 0)
+      _exit(PR_RENDER_WORKER_SHUTDOWN);
+
+    // Take all file descriptors which came with the message, so that we
+    // close them also if the message is not a complete job. The
+    // requester waits for all copies of the status pipe to get closed.
+    for (num_fds = 0, cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+	 cmsg = CMSG_NXTHDR(&msg, cmsg))
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+	for (i = 0;
+	     i < (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int)) &&
+	       num_fds < 3;
+	     i ++, num_fds ++)
+	  memcpy(fds + num_fds, CMSG_DATA(cmsg) + i * sizeof(int),
+		 sizeof(int));
+
+    if (num_fds == 3 && bytes == sizeof(pr_render_request_t) &&
+	!(msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+    {
+      status = pr_render_worker_run(global_data, request, fds);
+      if (write(fds[2], &status, sizeof(status)) < 0)
+	papplLog(global_data->system, PAPPL_LOGLEVEL_DEBUG,
+		 "[Render worker %d] Unable to report job status: %s",
+		 (int)getpid(), strerror(errno));
+    }
+    else
+    {
+      papplLog(global_data->system, PAPPL_LOGLEVEL_ERROR,
+	       "[Render worker %d] Received incomplete job, rejecting it",
+	       (int)getpid());
+      if (num_fds == 3)
+      {
+	status = 1;
+	if (write(fds[2], &status, sizeof(status)) < 0)
+	  papplLog(global_data->system, PAPPL_LOGLEVEL_DEBUG,
+		   "[Render worker %d] Unable to report job status: %s",
+		   (int)getpid(), strerror(errno));
+      }
+    }
+    for (i = 0; i < num_fds; i ++)
+      close(fds[i]);
+  }
+
+  _exit(0);
+}
+
+
+//
+// 'pr_render_pool_spawn()' - Start a render worker.
+//
+
+static pid_t				// O - Process ID or -1
+pr_render_pool_spawn(pr_printer_app_global_data_t *global_data)
+					// I - Global data
+{
+  pid_t pid;
+
+
+  if ((pid = fork()) == 0)
+  {
+    signal(SIGTERM, SIG_DFL);
+    pr_render_worker(global_data);
+  }
+  else if (pid < 0)
+    papplLog(global_data->system, PAPPL_LOGLEVEL_ERROR,
+	     "Unable to start render worker: %s", strerror(errno));
+
+  return (pid);
+}
+
+
+//
+// 'pr_render_pool_sigterm()' - Signal handler of the supervisor.
+//
+
+static void
+pr_render_pool_sigterm(int sig)		// I - Signal (unused)
+{
+  (void)sig;
+
+  pr_render_pool_stopping = 1;
+}
+
+
+//
+// 'pr_render_pool_supervisor()' - Main loop of the supervisor process,
+//                                 starts the render workers and
+//                                 replaces those which have exited,
+//                                 after having done their number of
+//                                 jobs or after a crash. Being
+//                                 single-threaded it can fork safely,
+//                                 unlike the Printer Application.
+//
+
+static void
+pr_render_pool_supervisor(pr_printer_app_global_data_t *global_data)
+					// I - Global data
+{
+  pid_t            pids[PR_RENDER_POOL_MAX_WORKERS],
+                   pid;
+  struct sigaction action;
+  int              i,
+                   status;
+
+
+  // Only the Printer Application sends jobs, the workers see the end of
+  // the socket when it closes its end
+  close(global_data->render_pool_fds[1]);
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = pr_render_pool_sigterm;
+  sigaction(SIGTERM, &action, NULL);
+
+  for (i = 0; i < global_data->render_pool_size; i ++)
+    pids[i] = pr_render_pool_spawn(global_data);
+
+  while (!pr_render_pool_stopping)
+  {
+    if ((pid = waitpid(-1, &status, 0)) < 0)
+    {
+      if (errno == EINTR)
+	continue;
+      break;				// No workers left
+    }
+
+    for (i = 0; i < global_data->render_pool_size; i ++)
+      if (pids[i] == pid)
+	break;
+    if (i >= global_data->render_pool_size)
+      continue;
+    pids[i] = -1;
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == PR_RENDER_WORKER_SHUTDOWN)
+      break;				// Pool shut down
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+    {
+      papplLog(global_data->system, PAPPL_LOGLEVEL_WARN,
+	       "Render worker %d stopped unexpectedly, replacing it",
+	       (int)pid);
+      // Do not replace crashing workers in a tight loop
+      sleep(1);
+    }
+    pids[i] = pr_render_pool_spawn(global_data);
+  }
+
+  for (i = 0; i < global_data->render_pool_size; i ++)
+    if (pids[i] > 0)
+      kill(pids[i], SIGTERM);
+  while (wait(NULL) > 0 || errno == EINTR);
+
+  _exit(0);
+}
+
+
+//
+// '_prRenderPoolStart()' - Start the pool of render workers if it is
+//                          configured. To be called before PAPPL
+//                          starts its threads.
+//
+
+void
+_prRenderPoolStart(pr_printer_app_global_data_t *global_data)
+					// I - Global data
+{
+  global_data->render_pool_fds[0] = global_data->render_pool_fds[1] = -1;
+  global_data->render_pool_supervisor = -1;
+
+  if (global_data->render_pool_size <= 0)
+    return;
+  if (global_data->render_pool_size > PR_RENDER_POOL_MAX_WORKERS)
+    global_data->render_pool_size = PR_RENDER_POOL_MAX_WORKERS;
+
+  // All workers read jobs from the same socket, each message goes to
+  // exactly one of them
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, global_data->render_pool_fds))
+  {
+    papplLog(global_data->system, PAPPL_LOGLEVEL_ERROR,
+	     "Unable to create socket for render workers: %s",
+	     strerror(errno));
+    global_data->render_pool_size = 0;
+    return;
+  }
+
+  if ((global_data->render_pool_supervisor = fork()) == 0)
+    pr_render_pool_supervisor(global_data);
+
+  // The workers have the receiving end, without them sending jobs
+  // fails instead of blocking
+  close(global_data->render_pool_fds[0]);
+  global_data->render_pool_fds[0] = -1;
+
+  if (global_data->render_pool_supervisor < 0)
+  {
+    papplLog(global_data->system, PAPPL_LOGLEVEL_ERROR,
+	     "Unable to start render workers: %s", strerror(errno));
+    close(global_data->render_pool_fds[1]);
+    global_data->render_pool_fds[1] = -1;
+    global_data->render_pool_size = 0;
+    return;
+  }
+
+  papplLog(global_data->system, PAPPL_LOGLEVEL_INFO,
+	   "Started %d render workers, replaced after %d jobs each",
+	   global_data->render_pool_size, global_data->render_pool_max_jobs);
+}
+
+
+//
+// '_prRenderPoolStop()' - Shut down the pool of render workers.
+//
+
+void
+_prRenderPoolStop(pr_printer_app_global_data_t *global_data)
+					// I - Global data
+{
+  if (global_data->render_pool_size <= 0 ||
+      global_data->render_pool_supervisor <= 0)
+    return;
+
+  // Closing our end of the socket makes idle workers exit, the
+  // supervisor stops the busy ones
+  close(global_data->render_pool_fds[1]);
+  global_data->render_pool_fds[1] = -1;
+  kill(global_data->render_pool_supervisor, SIGTERM);
+  while (waitpid(global_data->render_pool_supervisor, NULL, 0) < 0 &&
+	 errno == EINTR);
+  global_data->render_pool_supervisor = -1;
+}
+
+
+//
+// '_prRenderPoolFilter()' - Filter function which hands the job's
+//                           conversion over to a render worker and
+//                           waits for it to finish. Takes the place
+//                           of the conversion filters in the filter
+//                           chain.
+//
+
+int					// O - Error status
+_prRenderPoolFilter(int inputfd,	// I - Input stream
+		    int outputfd,	// I - Output stream
+		    int inputseekable,	// I - Is input seekable? (unused)
+		    cf_filter_data_t *data,// I - Job and printer data
+		    void *parameters)	// I - Filter parameters
+{
+  pr_render_pool_filter_t *params = (pr_render_pool_filter_t *)parameters;
+  pr_printer_app_global_data_t *global_data = params->global_data;
+  ppd_filter_data_ext_t *filter_data_ext;
+  cf_logfunc_t   log = data->logfunc;
+  void           *ld = data->logdata;
+  pr_render_request_t *request;
+  struct msghdr  msg;
+  struct iovec   iov;
+  struct cmsghdr *cmsg;
+  struct pollfd  pfd;
+  char           control[CMSG_SPACE(3 * sizeof(int))];
+  int            status_pipe[2],
+                 fds[3],
+                 status = 1,
+                 i;
+  size_t         len;
+  ssize_t        bytes;
+
+
+  (void)inputseekable;
+
+  if ((request = (pr_render_request_t *)calloc(1, sizeof(pr_render_request_t)))
+      == NULL || pipe(status_pipe))
+  {
+    free(request);
+    close(inputfd);
+    close(outputfd);
+    return (1);
+  }
+
+  request->kind = params->kind;
+  request->index = params->index;
+  request->job_id = data->job_id;
+  request->copies = data->copies;
+  snprintf(request->printer, sizeof(request->printer), "%s",
+	   data->printer ? data->printer : "");
+  snprintf(request->user, sizeof(request->user), "%s",
+	   data->job_user ? data->job_user : "");
+  snprintf(request->title, sizeof(request->title), "%s",
+	   data->job_title ? data->job_title : "");
+  snprintf(request->content_type, sizeof(request->content_type), "%s",
+	   data->content_type);
+  snprintf(request->final_content_type,
+	   sizeof(request->final_content_type), "%s",
+	   data->final_content_type);
+  if ((filter_data_ext =
+       (ppd_filter_data_ext_t *)cfFilterDataGetExt(data,
+						   PPD_FILTER_DATA_EXT)) !=
+      NULL && filter_data_ext->ppdfile)
+    snprintf(request->ppdfile, sizeof(request->ppdfile), "%s",
+	     filter_data_ext->ppdfile);
+  for (i = 0; i < data->num_options; i ++)
+  {
+    len = strlen(data->options[i].name) + strlen(data->options[i].value) + 2;
+    if (request->options_len + len > sizeof(request->options))
+    {
+      if (log)
+	log(ld, CF_LOGLEVEL_WARN,
+	    "Render pool: Too many options, dropping %s",
+	    data->options[i].name);
+      continue;
+    }
+    strcpy(request->options + request->options_len, data->options[i].name);
+    request->options_len += strlen(data->options[i].name) + 1;
+    strcpy(request->options + request->options_len, data->options[i].value);
+    request->options_len += strlen(data->options[i].value) + 1;
+    request->num_options ++;
+  }
+
+  // Send the job with our input and output to a worker
+  fds[0] = inputfd;
+  fds[1] = outputfd;
+  fds[2] = status_pipe[1];
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = request;
+  iov.iov_len = sizeof(pr_render_request_t);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  if (log)
+    log(ld, CF_LOGLEVEL_DEBUG, "Render pool: Handing job over to a worker");
+
+  while ((bytes = sendmsg(global_data->render_pool_fds[1], &msg,
+			  MSG_NOSIGNAL)) < 0 &&
+	 errno == EINTR);
+
+  // The worker has its own copies of the file descriptors now
+  close(inputfd);
+  close(outputfd);
+  close(status_pipe[1]);
+  free(request);
+
+  if (bytes < 0)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR,
+	  "Render pool: Unable to send job to worker: %s", strerror(errno));
+  }
+  else
+  {
+    // Wait for the worker to report, no report means it crashed. On
+    // cancel we close our end of the status pipe, which tells the
+    // worker to stop the job's filters.
+    pfd.fd     = status_pipe[0];
+    pfd.events = POLLIN;
+    for (;;)
+    {
+      if (data->iscanceledfunc &&
+	  (data->iscanceledfunc)(data->iscanceleddata))
+      {
+	if (log)
+	  log(ld, CF_LOGLEVEL_DEBUG,
+	      "Render pool: Job canceled, stopping the worker's filters");
+	status = 1;
+	break;
+      }
+      if ((i = poll(&pfd, 1, PR_CANCEL_POLL_INTERVAL / 1000)) < 0 &&
+	  errno != EINTR)
+	i = 1;				// Let read() tell the error
+      if (i <= 0)
+	continue;
+      while ((bytes = read(status_pipe[0], &status, sizeof(status))) < 0 &&
+	     errno == EINTR);
+      if (bytes != sizeof(status))
+      {
+	if (log)
+	  log(ld, CF_LOGLEVEL_ERROR,
+	      "Render pool: Worker stopped unexpectedly");
+	status = 1;
+      }
+      break;
+    }
+  }
+  close(status_pipe[0]);
+
+  return (status);
+}
+
+
+//
+// '_prRenderPoolAddFilters()' - Add the filters of a spooling conversion
+//                               or stream format to a job's filter
+//                               chain. If the render pool is running
+//                               and the filters use Ghostscript, and
+//                               the PPD file is available for the
+//                               workers, they get replaced by a
+//                               single _prRenderPoolFilter() call.
+//
+
+void
+_prRenderPoolAddFilters(pr_job_data_t *job_data,
+					// I - Job data
+			cups_array_t *chain,
+					// I - Filter chain
+			pr_render_kind_t kind,
+					// I - Conversion or stream format
+			void *format)	// I - pr_spooling_conversion_t or
+					//     pr_stream_format_t
+{
+  pr_printer_app_global_data_t *global_data = job_data->global_data;
+  cf_filter_filter_in_chain_t *filters;
+  pr_render_pool_filter_t *params;
+  cups_array_t   *formats;
+  int            num_filters,
+                 index = -1,
+                 i;
+  bool           use_pool = false;
+
+
+  if (kind == PR_RENDER_CONVERSION)
+  {
+    filters = ((pr_spooling_conversion_t *)format)->filters;
+    num_filters = ((pr_spooling_conversion_t *)format)->num_filters;
+    formats = global_data->config->spooling_conversions;
+  }
+  else
+  {
+    filters = ((pr_stream_format_t *)format)->filters;
+    num_filters = ((pr_stream_format_t *)format)->num_filters;
+    formats = global_data->config->stream_formats;
+  }
+
+  if (global_data->render_pool_size > 0 &&
+      global_data->render_pool_fds[1] >= 0 && job_data->temp_ppd_name)
+  {
+    for (i = 0; i < num_filters; i ++)
+      if (filters[i].function == cfFilterGhostscript)
+	use_pool = true;
+    for (i = 0; use_pool && i < cupsArrayGetCount(formats); i ++)
+      if (cupsArrayGetElement(formats, i) == format)
+      {
+	index = i;
+	break;
+      }
+  }
+
+  if (index >= 0 &&
+      (job_data->pool_filter =
+       (cf_filter_filter_in_chain_t *)
+       calloc(1, sizeof(cf_filter_filter_in_chain_t))) != NULL &&
+      (params =
+       (pr_render_pool_filter_t *)
+       calloc(1, sizeof(pr_render_pool_filter_t))) != NULL)
+  {
+    params->global_data = global_data;
+    params->kind = kind;
+    params->index = index;
+    job_data->pool_filter->function = _prRenderPoolFilter;
+    job_data->pool_filter->parameters = params;
+    job_data->pool_filter->name = "renderpool";
+    cupsArrayAdd(chain, job_data->pool_filter);
+    return;
+  }
+
+  free(job_data->pool_filter);
+  job_data->pool_filter = NULL;
+  for (i = 0; i < num_filters; i ++)
+    cupsArrayAdd(chain, filters + i);
+}
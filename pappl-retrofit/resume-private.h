@@ -0,0 +1,86 @@
+//
+// PPD/Classic CUPS driver retro-fit Printer Application Library
+// (libpappl-retrofit) for the Printer Application Framework (PAPPL)
+//
+// resume-private.h
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#ifndef _PAPPL_RETROFIT_RESUME_H_
+#  define _PAPPL_RETROFIT_RESUME_H_
+
+//
+// Include necessary headers...
+//
+
+#include <pappl-retrofit/intermediate-private.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+
+//
+// C++ magic...
+//
+
+#  ifdef __cplusplus
+extern "C" {
+#  endif // __cplusplus
+
+
+//
+// Constants...
+//
+
+#define PR_RESUME_MAX_ATTEMPTS	3	// Reconnects per job
+#define PR_RESUME_RETRY_DELAY	5	// Time before reconnecting (seconds)
+#define PR_RESUME_UNCONFIRMED_PAGES 1	// Pages before the one sent when the
+					// connection got lost which get sent
+					// again if the printer does not
+					// report printed pages
+
+
+//
+// Types...
+//
+
+typedef struct pr_resume_s		// Print-ready output of a job kept
+					// for resuming
+{
+  pr_intermediate_t *journal;		// Output sent to the printer
+  off_t          *pages;		// Offsets where the pages start
+  int            num_pages,		// Number of pages found
+                 alloc_pages;		// Allocated page offsets
+  int            match;			// Characters of "\n%%Page:" matched
+					// at the end of the data so far
+  int            printed;		// Pages the printer reported as
+					// printed, -1 if it does not report
+  char           back[256];		// Back channel data not parsed yet
+  size_t         backlen;		// Length of back channel data
+} pr_resume_t;
+
+
+//
+// Functions...
+//
+
+extern pr_resume_t *_prResumeCreate(const char *spill_file, size_t max_mem);
+extern int   _prResumeAdd(pr_resume_t *res, const char *buf, size_t len);
+extern void  _prResumeBackChannel(pr_resume_t *res, const char *buf,
+				  size_t len);
+extern off_t _prResumeOffset(pr_resume_t *res, off_t failed, off_t *header,
+			     int *page);
+extern void  _prResumeFree(pr_resume_t *res);
+
+
+//
+// C++ magic...
+//
+
+#  ifdef __cplusplus
+}
+#  endif // __cplusplus
+
+
+#endif // !_PAPPL_RETROFIT_RESUME_H_
@@ -0,0 +1,229 @@
+//
+// PPD/Classic CUPS driver retro-fit Printer Application Library
+// (libpappl-retrofit) for the Printer Application Framework (PAPPL)
+//
+// resume.c
+//
+// Resuming jobs after the connection to the printer got lost: The
+// print-ready output is kept in a journal while it gets sent, with the
+// offsets of the pages taken from the DSC "%%Page:" comments, so that
+// after reconnecting the job setup and the pages the printer has not
+// printed yet can be sent again without rendering the job again.
+// Printers which report printed pages via PJL ("@PJL USTATUS PAGE" on
+// the back channel) tell us exactly where to continue.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+//
+// Include necessary headers...
+//
+
+#include <pappl-retrofit/resume-private.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+//
+// Local globals...
+//
+
+static const char pr_page_comment[] = "\n%%Page:";
+					// Start of a page in PostScript
+static const char pr_pjl_page[] = "@PJL USTATUS PAGE";
+					// Printed page reported by printer
+
+
+//
+// '_prResumeCreate()' - Create the journal for a job's output.
+//
+
+pr_resume_t *				// O - Journal or NULL
+_prResumeCreate(const char *spill_file,	// I - File name when on disk
+		size_t     max_mem)	// I - Size limit for memory
+{
+  pr_resume_t *res;			// Journal
+
+
+  if ((res = (pr_resume_t *)calloc(1, sizeof(pr_resume_t))) == NULL)
+    return (NULL);
+
+  if ((res->journal = _prIntermediateCreate("resume", spill_file,
+					    max_mem)) == NULL)
+  {
+    free(res);
+    return (NULL);
+  }
+
+  res->match   = 1;			// Data starts at the start of a line
+  res->printed = -1;
+
+  return (res);
+}
+
+
+//
+// '_prResumeAdd()' - Add output of the job to the journal, noting where
+//                    pages start.
+//
+
+int					// O - 0 on success, -1 on error
+_prResumeAdd(pr_resume_t *res,		// I - Journal
+	     const char  *buf,		// I - Data
+	     size_t      len)		// I - Length of data
+{
+  off_t  start = res->journal->size;	// Offset of the data
+  off_t  *pages;			// Reallocated page offsets
+  size_t i;				// Looping var
+
+
+  for (i = 0; i < len; i ++)
+  {
+    if (buf[i] == pr_page_comment[res->match])
+    {
+      if (++ res->match < (int)sizeof(pr_page_comment) - 1)
+	continue;
+
+      // "%%Page:" at the start of a line
+      if (res->num_pages >= res->alloc_pages)
+      {
+	if ((pages = (off_t *)realloc(res->pages,
+				      (res->alloc_pages + 64) *
+				      sizeof(off_t))) == NULL)
+	  return (-1);
+	res->pages = pages;
+	res->alloc_pages += 64;
+      }
+      res->pages[res->num_pages ++] =
+	start + (off_t)i - (off_t)(sizeof(pr_page_comment) - 3);
+      res->match = 0;
+    }
+    else
+      res->match = (buf[i] == '\n' || buf[i] == '\r') ? 1 : 0;
+  }
+
+  return (_prIntermediateWrite(res->journal, buf, len));
+}
+
+
+//
+// '_prResumeBackChannel()' - Look for printed pages reported by the
+//                            printer in back channel data.
+//
+
+void
+_prResumeBackChannel(pr_resume_t *res,	// I - Journal
+		     const char  *buf,	// I - Back channel data
+		     size_t      len)	// I - Length of data
+{
+  char   *ptr,				// Report of printed page
+         *end;				// End of page number
+  size_t keep;				// Bytes kept for the next call
+  long   page;				// Page number
+
+
+  while (len > 0)
+  {
+    // Add as much as fits, keeping the buffer nul-terminated
+    keep = sizeof(res->back) - 1 - res->backlen;
+    if (keep > len)
+      keep = len;
+    memcpy(res->back + res->backlen, buf, keep);
+    res->backlen += keep;
+    res->back[res->backlen] = '\0';
+    buf += keep;
+    len -= keep;
+
+    // "@PJL USTATUS PAGE", newline, page number, newline, form feed
+    while ((ptr = strstr(res->back, pr_pjl_page)) != NULL)
+    {
+      if ((ptr = strchr(ptr, '\n')) == NULL)
+	break;
+      page = strtol(ptr + 1, &end, 10);
+      if (*end != '\r' && *end != '\n')
+	break;				// Page number not complete yet
+      if (end > ptr + 1 && page > res->printed)
+	res->printed = (int)page;
+      res->backlen -= (size_t)(end - res->back);
+      memmove(res->back, end, res->backlen + 1);
+    }
+
+    // Keep only what can be the start of an incomplete report
+    if ((ptr = strstr(res->back, pr_pjl_page)) != NULL)
+      keep = res->backlen - (size_t)(ptr - res->back);
+    else
+      keep = res->backlen < sizeof(pr_pjl_page) - 1 ? res->backlen :
+	sizeof(pr_pjl_page) - 1;
+    if (keep == sizeof(res->back) - 1)
+      keep = 0;				// Garbage, drop it
+    memmove(res->back, res->back + res->backlen - keep, keep + 1);
+    res->backlen = keep;
+  }
+}
+
+
+//
+// '_prResumeOffset()' - Find where to continue sending after the
+//                       connection got lost at offset "failed": At the
+//                       first page the printer did not report as
+//                       printed, or if it does not report, at the
+//                       page sent when the connection got lost, or
+//                       some pages before. The job setup up to the
+//                       first page ("header" bytes) has to be sent
+//                       before. Without page comments everything
+//                       gets sent again.
+//
+
+off_t					// O - Offset to continue at
+_prResumeOffset(pr_resume_t *res,	// I - Journal
+		off_t       failed,	// I - Offset sent before failure
+		off_t       *header,	// O - Bytes of job setup
+		int         *page)	// O - Page to continue at
+{
+  int current,				// Page sent when the failure occured
+      first;				// First page to send again
+
+
+  *header = 0;
+  *page   = 1;
+
+  if (res->num_pages == 0)
+    return (0);
+
+  for (current = 0; current < res->num_pages; current ++)
+    if (res->pages[current] > failed)
+      break;
+
+  if (res->printed >= 0)
+    first = res->printed + 1;
+  else
+    first = current - PR_RESUME_UNCONFIRMED_PAGES;
+
+  if (first <= 1)
+    return (0);				// From the start, no header needed
+
+  *page = first;
+  if (first > res->num_pages)
+    return (res->journal->size);	// All pages printed
+
+  *header = res->pages[0];
+  return (res->pages[first - 1]);
+}
+
+
+//
+// '_prResumeFree()' - Free the journal of a job.
+//
+
+void
+_prResumeFree(pr_resume_t *res)		// I - Journal
+{
+  if (!res)
+    return;
+
+  _prIntermediateFree(res->journal);
+  free(res->pages);
+  free(res);
+}
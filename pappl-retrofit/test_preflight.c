@@ -0,0 +1,234 @@
+//
+// =============================================================================
+//  test_preflight.c — Hermetic unit tests for pappl-retrofit's job
+//                     preflight page counter
+//                     (pappl-retrofit/preflight.c)
+// =============================================================================
+//
+//  Target source : pappl-retrofit/preflight.c
+//  Target header : pappl-retrofit/preflight-private.h
+//
+//  Public surface exercised:
+//
+//    int    _prPreflightPages(const char *filename, const char *format);
+//    double _prPreflightCost (int pages, off_t bytes);
+//
+//  WHAT THE PREFLIGHT LOOKS AT:
+//
+//    PDF        : "/Count" of the page tree node with "/Type /Pages" and
+//                 no "/Parent" (the root node), the last one if an
+//                 incremental update has added a new version of it.
+//    PostScript : DSC "%%Pages: N" in the header comments, or the last
+//                 "%%Pages: N" of the file for "%%Pages: (atend)".
+//    PWG raster : TotalPageCount of the first page header (file offset
+//                 456, big-endian), 0 means unknown.
+//    URF        : Page count of the "UNIRAST\0" file header (offset 8,
+//                 big-endian), 0 means unknown.
+//
+//  Hermeticity:
+//
+//    Every document is written to a mkstemp(3) file in /tmp which is
+//    removed right after the check.  No PAPPL system, no printer.  The
+//    PDF tests use uncompressed page trees only, so cfPDFPages() (the
+//    fallback for compressed ones) never gets called.
+//
+//  Test groups in this file (4 groups, 12 assertions):
+//
+//    G1 (T01-T04)  ─ PDF page tree
+//    G2 (T05-T07)  ─ PostScript DSC comments
+//    G3 (T08-T10)  ─ PWG raster / URF headers
+//    G4 (T11-T12)  ─ Unknown formats and cost estimate
+// =============================================================================
+//
+
+#include "test-internal.h"
+#include "preflight-private.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+// ==========================================================================
+//  Helper: write a document to a temporary file, count its pages, and
+//  remove the file again.
+// ==========================================================================
+static int
+pages_of(const void *data, size_t len, const char *format)
+{
+  char filename[] = "/tmp/test_preflight.XXXXXX";
+  int  fd, pages;
+
+  if ((fd = mkstemp(filename)) < 0)
+    return (-2);
+  if (write(fd, data, len) != (ssize_t)len)
+  {
+    close(fd);
+    unlink(filename);
+    return (-2);
+  }
+  close(fd);
+
+  pages = _prPreflightPages(filename, format);
+  unlink(filename);
+  return (pages);
+}
+
+
+// ==========================================================================
+//  Helper: big-endian 32-bit store.
+// ==========================================================================
+static void
+put_be32(unsigned char *p, unsigned v)
+{
+  p[0] = (unsigned char)(v >> 24);
+  p[1] = (unsigned char)(v >> 16);
+  p[2] = (unsigned char)(v >> 8);
+  p[3] = (unsigned char)v;
+}
+
+
+int
+main(void)
+{
+  int pages;
+
+
+  // ========================================================================
+  //  GROUP 1 — PDF page tree
+  // ========================================================================
+  testBegin("T01: PDF root /Pages node gives the page count");
+  {
+    const char *pdf =
+      "%PDF-1.4\n"
+      "1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n"
+      "2 0 obj\n<< /Type /Pages /Kids [3 0 R 4 0 R 5 0 R] /Count 3 >>\n"
+      "endobj\n"
+      "3 0 obj\n<< /Type /Page /Parent 2 0 R >>\nendobj\n"
+      "%%EOF\n";
+    pages = pages_of(pdf, strlen(pdf), "application/pdf");
+    testEndMessage(pages == 3, "pages=%d", pages);
+  }
+
+  testBegin("T02: PDF intermediate nodes do not hide the root count");
+  {
+    const char *pdf =
+      "%PDF-1.4\n"
+      "4 0 obj\n<</Type/Pages/Parent 2 0 R/Kids[6 0 R]/Count 7>>\nendobj\n"
+      "2 0 obj\n<</Type/Pages/Kids[4 0 R 5 0 R]/Count 12>>\nendobj\n"
+      "%%EOF\n";
+    pages = pages_of(pdf, strlen(pdf), "application/pdf");
+    testEndMessage(pages == 12, "pages=%d", pages);
+  }
+
+  testBegin("T03: PDF /Type /Page nodes are not taken as page tree");
+  {
+    const char *pdf =
+      "%PDF-1.4\n"
+      "3 0 obj\n<< /Type /Page /Count 99 >>\nendobj\n"
+      "2 0 obj\n<< /Type /Pages /Count 1 /Kids [3 0 R] >>\nendobj\n"
+      "%%EOF\n";
+    pages = pages_of(pdf, strlen(pdf), "application/pdf");
+    testEndMessage(pages == 1, "pages=%d", pages);
+  }
+
+  testBegin("T04: PDF incremental update, the last root counts");
+  {
+    const char *pdf =
+      "%PDF-1.4\n"
+      "2 0 obj\n<< /Type /Pages /Kids [3 0 R 4 0 R] /Count 2 >>\nendobj\n"
+      "%%EOF\n"
+      "2 0 obj\n<< /Type /Pages /Kids [3 0 R 4 0 R 5 0 R] /Count 3 >>\n"
+      "endobj\n"
+      "%%EOF\n";
+    pages = pages_of(pdf, strlen(pdf), "application/pdf");
+    testEndMessage(pages == 3, "pages=%d", pages);
+  }
+
+
+  // ========================================================================
+  //  GROUP 2 — PostScript DSC comments
+  // ========================================================================
+  testBegin("T05: PostScript %%%%Pages: in header");
+  {
+    const char *ps =
+      "%!PS-Adobe-3.0\n%%Pages: 5\n%%EndComments\nshowpage\n%%EOF\n";
+    pages = pages_of(ps, strlen(ps), "application/postscript");
+    testEndMessage(pages == 5, "pages=%d", pages);
+  }
+
+  testBegin("T06: PostScript %%%%Pages: (atend) uses the trailer");
+  {
+    const char *ps =
+      "%!PS-Adobe-3.0\n%%Pages: (atend)\n%%EndComments\n"
+      "%%Page: 1 1\nshowpage\n%%Trailer\n%%Pages: 2\n%%EOF\n";
+    pages = pages_of(ps, strlen(ps), "application/postscript");
+    testEndMessage(pages == 2, "pages=%d", pages);
+  }
+
+  testBegin("T07: PostScript without DSC page count is unknown");
+  {
+    const char *ps = "%!\nshowpage\n";
+    pages = pages_of(ps, strlen(ps), "application/postscript");
+    testEndMessage(pages == -1, "pages=%d", pages);
+  }
+
+
+  // ========================================================================
+  //  GROUP 3 — PWG raster / URF headers
+  // ========================================================================
+  testBegin("T08: PWG raster TotalPageCount");
+  {
+    unsigned char ras[4 + 1796];
+    memset(ras, 0, sizeof(ras));
+    memcpy(ras, "RaS2", 4);
+    put_be32(ras + 456, 4);
+    pages = pages_of(ras, sizeof(ras), "image/pwg-raster");
+    testEndMessage(pages == 4, "pages=%d", pages);
+  }
+
+  testBegin("T09: PWG raster TotalPageCount 0 is unknown");
+  {
+    unsigned char ras[4 + 1796];
+    memset(ras, 0, sizeof(ras));
+    memcpy(ras, "RaS2", 4);
+    pages = pages_of(ras, sizeof(ras), "image/pwg-raster");
+    testEndMessage(pages == -1, "pages=%d", pages);
+  }
+
+  testBegin("T10: URF file header page count");
+  {
+    unsigned char urf[12 + 32];
+    memset(urf, 0, sizeof(urf));
+    memcpy(urf, "UNIRAST", 8);
+    put_be32(urf + 8, 9);
+    pages = pages_of(urf, sizeof(urf), "image/urf");
+    testEndMessage(pages == 9, "pages=%d", pages);
+  }
+
+
+  // ========================================================================
+  //  GROUP 4 — Unknown formats and cost estimate
+  // ========================================================================
+  testBegin("T11: unsupported format is unknown");
+  {
+    const char *txt = "Hello\f World\n";
+    pages = pages_of(txt, strlen(txt), "text/plain");
+    testEndMessage(pages == -1, "pages=%d", pages);
+  }
+
+  testBegin("T12: cost is the page count, or guessed from the size");
+  {
+    bool ok = _prPreflightCost(7, 1) == 7.0 &&
+              _prPreflightCost(-1, 0) == 1.0 &&
+              _prPreflightCost(-1, 3 * PR_PREFLIGHT_PAGE_BYTES) == 4.0;
+    testEnd(ok);
+  }
+
+
+  // ========================================================================
+  //  Suite epilogue.
+  // ========================================================================
+  return (testsPassed ? 0 : 1);
+}
@@ -0,0 +1,176 @@
+//
+// =============================================================================
+//  test_progress.c — Hermetic unit tests for pappl-retrofit's recording of
+//                    the page progress of jobs from the "PAGE:" messages
+//                    of the filters (pappl-retrofit/print-job.c)
+// =============================================================================
+//
+//  Target source : pappl-retrofit/print-job.c
+//  Target header : pappl-retrofit/print-job-private.h
+//
+//  Public surface exercised:
+//
+//    void _prJobLog(void *data, cf_loglevel_t level, const char *message,
+//                   ...);
+//
+//  WHAT THE LOG FUNCTION LOOKS AT:
+//
+//    Log data  : The job's pr_job_log_t, the job and its page progress,
+//                which lives in memory shared with the forked filter
+//                processes.
+//    Page logs : "PAGE: <page> <copies>" control messages, each one adds
+//                <copies> impressions to the progress and the time of
+//                the message to the window for the page rate.
+//
+//  Hermeticity:
+//
+//    The log data has no job (NULL), the messages about the pages go to
+//    papplLogJob() which ignores them.  The progress is tracked in the
+//    same way as in pr_filter_document(), in an anonymous shared mmap(2)
+//    region.  No PAPPL system, no printer, no filters.
+//
+//  Test groups in this file (3 groups, 7 assertions):
+//
+//    G1 (T01-T03)  ─ Page logs
+//    G2 (T04-T05)  ─ Other messages
+//    G3 (T06-T07)  ─ Page rate window and forked filter processes
+// =============================================================================
+//
+
+#include "test-internal.h"
+#include "print-job-private.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+
+// ==========================================================================
+//  Helper: map a fresh page progress like pr_filter_document() does.
+// ==========================================================================
+static pr_job_progress_t *
+progress_create(void)
+{
+  pr_job_progress_t *progress;
+
+
+  if ((progress = (pr_job_progress_t *)mmap(NULL, sizeof(pr_job_progress_t),
+					    PROT_READ | PROT_WRITE,
+					    MAP_SHARED | MAP_ANONYMOUS, -1,
+					    0)) == MAP_FAILED)
+  {
+    perror("mmap");
+    exit(1);
+  }
+  memset(progress, 0, sizeof(pr_job_progress_t));
+  return (progress);
+}
+
+
+int
+main(void)
+{
+  pr_job_log_t      job_log;
+  pr_job_progress_t *progress;
+  pid_t             pid;
+  int               i, status;
+
+
+  memset(&job_log, 0, sizeof(job_log));
+  job_log.progress = progress = progress_create();
+
+
+  // ========================================================================
+  //  GROUP 1 — Page logs
+  // ========================================================================
+  testBegin("T01: a page log is recorded in the progress");
+  {
+    _prJobLog(&job_log, CF_LOGLEVEL_CONTROL, "PAGE: %d %d", 1, 1);
+    testEndMessage(progress->pages == 1 && progress->logs == 1 &&
+		   progress->counts[0] == 1 &&
+		   progress->times[0] > 0.0,
+		   "pages=%d logs=%d", progress->pages, progress->logs);
+  }
+
+  testBegin("T02: copies of a page count as impressions");
+  {
+    _prJobLog(&job_log, CF_LOGLEVEL_CONTROL, "PAGE: 2 3");
+    testEndMessage(progress->pages == 4 && progress->logs == 2 &&
+		   progress->counts[1] == 4 &&
+		   progress->times[1] >= progress->times[0],
+		   "pages=%d logs=%d", progress->pages, progress->logs);
+  }
+
+  testBegin("T03: nothing gets reported to the job yet");
+  {
+    testEndMessage(progress->reported == 0, "reported=%d",
+		   progress->reported);
+  }
+
+
+  // ========================================================================
+  //  GROUP 2 — Other messages
+  // ========================================================================
+  testBegin("T04: malformed page logs and other control messages are "
+	    "ignored");
+  {
+    _prJobLog(&job_log, CF_LOGLEVEL_CONTROL, "PAGE: 3");
+    _prJobLog(&job_log, CF_LOGLEVEL_CONTROL, "PAGE: page 1");
+    _prJobLog(&job_log, CF_LOGLEVEL_CONTROL, "ATTR: job-impressions=3");
+    testEndMessage(progress->pages == 4 && progress->logs == 2,
+		   "pages=%d logs=%d", progress->pages, progress->logs);
+  }
+
+  testBegin("T05: \"PAGE:\" in a normal log message is no page log");
+  {
+    _prJobLog(&job_log, CF_LOGLEVEL_INFO, "PAGE: 3 1");
+    testEndMessage(progress->pages == 4 && progress->logs == 2,
+		   "pages=%d logs=%d", progress->pages, progress->logs);
+  }
+
+
+  // ========================================================================
+  //  GROUP 3 — Page rate window and forked filter processes
+  // ========================================================================
+  testBegin("T06: the page rate window wraps around");
+  {
+    for (i = 3; i <= PR_PROGRESS_WINDOW + 3; i ++)
+      _prJobLog(&job_log, CF_LOGLEVEL_CONTROL, "PAGE: %d 1", i);
+    testEndMessage(progress->pages == PR_PROGRESS_WINDOW + 5 &&
+		   progress->logs == PR_PROGRESS_WINDOW + 3 &&
+		   progress->counts[(progress->logs - 1) %
+					PR_PROGRESS_WINDOW] ==
+		   progress->pages,
+		   "pages=%d logs=%d", progress->pages, progress->logs);
+  }
+
+  testBegin("T07: page logs of a forked filter process reach the job's "
+	    "process");
+  {
+    munmap(progress, sizeof(pr_job_progress_t));
+    job_log.progress = progress = progress_create();
+    if ((pid = fork()) == 0)
+    {
+      _prJobLog(&job_log, CF_LOGLEVEL_CONTROL, "PAGE: 1 2");
+      _prJobLog(&job_log, CF_LOGLEVEL_CONTROL, "PAGE: 2 2");
+      _exit(0);
+    }
+    status = -1;
+    if (pid > 0)
+      waitpid(pid, &status, 0);
+    testEndMessage(status == 0 && progress->pages == 4 &&
+		   progress->logs == 2,
+		   "pages=%d logs=%d", progress->pages, progress->logs);
+  }
+
+  munmap(progress, sizeof(pr_job_progress_t));
+
+
+  // ========================================================================
+  //  Suite epilogue.
+  // ========================================================================
+  return (testsPassed ? 0 : 1);
+}
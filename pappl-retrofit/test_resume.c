@@ -0,0 +1,204 @@
+//
+// =============================================================================
+//  test_resume.c — Hermetic unit tests for pappl-retrofit's journal for
+//                  resuming jobs after the connection to the printer got
+//                  lost (pappl-retrofit/resume.c)
+// =============================================================================
+//
+//  Target source : pappl-retrofit/resume.c
+//  Target header : pappl-retrofit/resume-private.h
+//
+//  Public surface exercised:
+//
+//    pr_resume_t *_prResumeCreate(const char *spill_file, size_t max_mem);
+//    int   _prResumeAdd(pr_resume_t *res, const char *buf, size_t len);
+//    void  _prResumeBackChannel(pr_resume_t *res, const char *buf,
+//                               size_t len);
+//    off_t _prResumeOffset(pr_resume_t *res, off_t failed, off_t *header,
+//                          int *page);
+//    void  _prResumeFree(pr_resume_t *res);
+//
+//  WHAT THE JOURNAL LOOKS AT:
+//
+//    Page starts : DSC "%%Page:" comments at the start of a line, also
+//                  when split between two chunks of data.
+//    Printed     : "@PJL USTATUS PAGE" reports on the back channel, the
+//                  page number on the following line.
+//
+//  Hermeticity:
+//
+//    The journal is kept in memory (or, without memfd_create(), in a
+//    mkstemp(3) file in /tmp which gets removed by _prResumeFree()).
+//    No PAPPL system, no printer, no backend.
+//
+//  Test groups in this file (3 groups, 8 assertions):
+//
+//    G1 (T01-T03)  ─ Page offsets
+//    G2 (T04-T05)  ─ Printed pages reported by the printer
+//    G3 (T06-T08)  ─ Where to continue
+// =============================================================================
+//
+
+#include "test-internal.h"
+#include "resume-private.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+static const char *ps_job =
+  "%!PS-Adobe-3.0\n"
+  "%%Pages: 3\n"
+  "%%EndComments\n"
+  "%%BeginSetup\n<< /Duplex false >> setpagedevice\n%%EndSetup\n"
+  "%%Page: 1 1\n(A) show showpage\n"
+  "%%Page: 2 2\r\n(B) show showpage\n%%PageTrailer\n"
+  "%%Page: 3 3\n(C) show showpage\n"
+  "%%Trailer\n%%EOF\n";
+
+
+// ==========================================================================
+//  Helper: create a journal with the data fed in chunks of "chunk" bytes.
+// ==========================================================================
+static pr_resume_t *
+journal_of(const char *data, size_t chunk)
+{
+  char        filename[] = "/tmp/test_resume.XXXXXX";
+  int         fd;
+  size_t      i, len = strlen(data);
+  pr_resume_t *res;
+
+  if ((fd = mkstemp(filename)) < 0)
+    return (NULL);
+  close(fd);
+  unlink(filename);
+
+  if ((res = _prResumeCreate(filename, 1024 * 1024)) == NULL)
+    return (NULL);
+  for (i = 0; i < len; i += chunk)
+    if (_prResumeAdd(res, data + i, len - i < chunk ? len - i : chunk))
+    {
+      _prResumeFree(res);
+      return (NULL);
+    }
+  return (res);
+}
+
+
+// ==========================================================================
+//  Helper: offset of a string in the test job.
+// ==========================================================================
+static off_t
+offset_of(const char *s)
+{
+  return ((off_t)(strstr(ps_job, s) - ps_job));
+}
+
+
+int
+main(void)
+{
+  pr_resume_t *res;
+  off_t       offset, header;
+  int         page;
+
+
+  // ========================================================================
+  //  GROUP 1 — Page offsets
+  // ========================================================================
+  testBegin("T01: %%%%Page: comments give the page offsets");
+  {
+    res = journal_of(ps_job, 4096);
+    testEndMessage(res && res->num_pages == 3 &&
+		   res->pages[0] == offset_of("%%Page: 1") &&
+		   res->pages[1] == offset_of("%%Page: 2") &&
+		   res->pages[2] == offset_of("%%Page: 3"),
+		   "pages=%d", res ? res->num_pages : -1);
+    _prResumeFree(res);
+  }
+
+  testBegin("T02: comments split between chunks are found");
+  {
+    res = journal_of(ps_job, 3);
+    testEndMessage(res && res->num_pages == 3 &&
+		   res->pages[1] == offset_of("%%Page: 2") &&
+		   res->journal->size == (off_t)strlen(ps_job),
+		   "pages=%d", res ? res->num_pages : -1);
+    _prResumeFree(res);
+  }
+
+  testBegin("T03: %%%%Page: not at the start of a line is no page");
+  {
+    res = journal_of("%!\n(%%Page: 1) show\n%%PageTrailer\n", 4096);
+    testEndMessage(res && res->num_pages == 0, "pages=%d",
+		   res ? res->num_pages : -1);
+    _prResumeFree(res);
+  }
+
+
+  // ========================================================================
+  //  GROUP 2 — Printed pages reported by the printer
+  // ========================================================================
+  testBegin("T04: PJL USTATUS PAGE reports, split between reads");
+  {
+    res = journal_of(ps_job, 4096);
+    _prResumeBackChannel(res, "\f@PJL USTA", 10);
+    _prResumeBackChannel(res, "TUS PAGE\r\n1\r\n\f@PJL USTATUS PAGE\r\n2", 34);
+    page = res->printed;
+    _prResumeBackChannel(res, "\r\n\f", 3);
+    testEndMessage(page == 1 && res->printed == 2, "printed=%d then %d",
+		   page, res->printed);
+    _prResumeFree(res);
+  }
+
+  testBegin("T05: other back channel data is ignored");
+  {
+    res = journal_of(ps_job, 4096);
+    _prResumeBackChannel(res, "@PJL INFO STATUS\r\nCODE=10001\r\n\f", 31);
+    testEndMessage(res->printed == -1, "printed=%d", res->printed);
+    _prResumeFree(res);
+  }
+
+
+  // ========================================================================
+  //  GROUP 3 — Where to continue
+  // ========================================================================
+  testBegin("T06: without reports, the page before the lost one is resent");
+  {
+    res = journal_of(ps_job, 4096);
+    offset = _prResumeOffset(res, offset_of("(C)"), &header, &page);
+    testEndMessage(page == 2 && offset == offset_of("%%Page: 2") &&
+		   header == offset_of("%%Page: 1"),
+		   "page=%d offset=%lld header=%lld", page, (long long)offset,
+		   (long long)header);
+    _prResumeFree(res);
+  }
+
+  testBegin("T07: printed pages reported by the printer are not resent");
+  {
+    res = journal_of(ps_job, 4096);
+    _prResumeBackChannel(res, "@PJL USTATUS PAGE\r\n2\r\n\f", 23);
+    offset = _prResumeOffset(res, offset_of("(C)"), &header, &page);
+    testEndMessage(page == 3 && offset == offset_of("%%Page: 3"),
+		   "page=%d offset=%lld", page, (long long)offset);
+    _prResumeFree(res);
+  }
+
+  testBegin("T08: without page comments everything is resent");
+  {
+    res = journal_of("\033E\033&l1X page data \f more data \f\033E", 4096);
+    offset = _prResumeOffset(res, 20, &header, &page);
+    testEndMessage(offset == 0 && header == 0 && page == 1,
+		   "page=%d offset=%lld header=%lld", page, (long long)offset,
+		   (long long)header);
+    _prResumeFree(res);
+  }
+
+
+  // ========================================================================
+  //  Suite epilogue.
+  // ========================================================================
+  return (testsPassed ? 0 : 1);
+}
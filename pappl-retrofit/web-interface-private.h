@@ -36,6 +36,8 @@ extern "C" {
 
 extern void   _prPrinterWebDeviceConfig(pappl_client_t *client,
 					pappl_printer_t *printer);
+extern void   _prPrinterWebFilterStats(pappl_client_t *client,
+				       pappl_printer_t *printer);
 extern void   _prSystemWebAddPPD(pappl_client_t *client, void *data);
 
 
@@ -744,6 +744,98 @@ _prPrinterWebDeviceConfig(
 }
 
 
+//
+// '_prPrinterWebFilterStats()' - Web interface page showing where the
+//                                time of the printer's jobs goes:
+//                                Aggregated measurements of each
+//                                filter of the filter chains
+//
+
+void
+_prPrinterWebFilterStats(
+    pappl_client_t  *client,		// I - Client
+    pappl_printer_t *printer)		// I - Printer
+{
+  int                   i;              // Looping variable
+  pappl_pr_driver_data_t driver_data;
+  pr_driver_extension_t *extension;
+  pr_driver_stats_t     *stats;         // Statistics of the printer
+  pr_filter_aggregate_t *agg;           // Statistics of a filter
+  pr_conversion_aggregate_t *cagg;      // Statistics of a conversion
+
+
+  if (!papplClientHTMLAuthorize(client))
+    return;
+
+  papplPrinterGetDriverData(printer, &driver_data);
+  extension = (pr_driver_extension_t *)driver_data.extension;
+  stats = &extension->stats;
+
+  papplClientHTMLPrinterHeader(client, printer, "Filter Statistics", 0, NULL, NULL);
+
+  pthread_mutex_lock(&stats->mutex);
+
+  if (stats->rate_jobs > 0)
+    papplClientHTMLPrintf(client,
+			  "          <p>Recent page rate: %.1f pages per minute</p>\n",
+			  stats->page_rate);
+
+  if (stats->num_filters == 0)
+    papplClientHTMLPuts(client,
+			"          <p>No jobs have been printed in spooling mode yet.</p>\n");
+  else
+  {
+    papplClientHTMLPuts(client,
+			"          <p>Averages per job over all jobs and, with more weight on the latest jobs, over recent jobs.</p>\n"
+			"          <table class=\"list\">\n"
+			"            <thead>\n"
+			"              <tr><th>Filter</th><th>Jobs</th><th>Wall time</th><th>CPU time</th><th>Recent wall time</th><th>Recent CPU time</th><th>Output</th><th>Pages</th></tr>\n"
+			"            </thead>\n"
+			"            <tbody>\n");
+    for (i = stats->num_filters, agg = stats->filters; i > 0; i --, agg ++)
+      papplClientHTMLPrintf(client,
+			    "              <tr><td>%s</td><td>%d</td><td>%.3fs</td><td>%.3fs</td><td>%.3fs</td><td>%.3fs</td><td>%.0f kB</td><td>%.1f</td></tr>\n",
+			    agg->name, agg->jobs, agg->wall / agg->jobs,
+			    agg->cpu_jobs > 0 ? agg->cpu / agg->cpu_jobs : 0.0,
+			    agg->recent_wall,
+			    agg->recent_cpu, agg->bytes_out / agg->jobs / 1024,
+			    (double)agg->pages / agg->jobs);
+    papplClientHTMLPuts(client,
+			"            </tbody>\n"
+			"          </table>\n");
+  }
+
+  if (stats->num_conversions > 0)
+  {
+    papplClientHTMLPuts(client,
+			"          <h3>Spooling conversions</h3>\n"
+			"          <p>Throughput and CPU time per page of the conversion filters, without sending the data to the printer, over all jobs (including earlier sessions) and over recent jobs.</p>\n"
+			"          <table class=\"list\">\n"
+			"            <thead>\n"
+			"              <tr><th>Conversion</th><th>Jobs</th><th>Pages</th><th>Pages per second</th><th>CPU time per page</th><th>Recent pages per second</th><th>Recent CPU time per page</th></tr>\n"
+			"            </thead>\n"
+			"            <tbody>\n");
+    for (i = stats->num_conversions, cagg = stats->conversions; i > 0;
+	 i --, cagg ++)
+      papplClientHTMLPrintf(client,
+			    "              <tr><td>%s</td><td>%d</td><td>%d</td><td>%.2f</td><td>%.3fs</td><td>%.2f</td><td>%.3fs</td></tr>\n",
+			    cagg->key, cagg->jobs, cagg->pages,
+			    cagg->wall > 0.0 ? cagg->pages / cagg->wall : 0.0,
+			    cagg->pages > 0 ? cagg->cpu / cagg->pages : 0.0,
+			    cagg->recent_page_wall > 0.0 ?
+			    1.0 / cagg->recent_page_wall : 0.0,
+			    cagg->recent_page_cpu);
+    papplClientHTMLPuts(client,
+			"            </tbody>\n"
+			"          </table>\n");
+  }
+
+  pthread_mutex_unlock(&stats->mutex);
+
+  papplClientHTMLPrinterFooter(client);
+}
+
+
 //
 // '_prSystemWebAddPPD()' - Web interface page for adding/deleting PPD
 //                          files by the user, to add support for